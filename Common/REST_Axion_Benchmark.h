@@ -0,0 +1,250 @@
+#ifndef REST_AXION_BENCHMARK_H
+#define REST_AXION_BENCHMARK_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <regex>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <algorithm>
+
+#include <Rtypes.h>
+#include <RVersion.h>
+#include <unistd.h>
+
+//*******************************************************************************************************
+//*** Description: Micro-benchmark harness of the field and integration kernels. Every benchmark is a
+//*** callable returning the value of one call of the kernel, which is kept alive with KeepValue so the call
+//*** is not optimised away.
+//***
+//*** A run warms the kernel up for a given time, calibrates the number of calls per repetition so that a
+//*** repetition lasts at least the minimum time, which makes sub-microsecond kernels measurable with the
+//*** steady clock, and times the repetitions. The time per call of the repetitions gives the median and the
+//*** median absolute deviation; the repetitions beyond kOutlierDeviations deviations of the median are
+//*** counted as outliers and left out of the mean and the standard deviation. The results and the context
+//*** (date, host, compiler, ROOT version and the parameters set by the macro) are written as JSON, to be
+//*** compared across releases.
+//***
+//*** Usage:
+//***   Benchmark benchmark;
+//***   benchmark.SetContext("fieldName", "babyIAXO_2024_cutoff");
+//***   benchmark.Run("gas/GetPhotonMass", [&]() { return gas->GetPhotonMass(4.2); });
+//***   benchmark.WriteJSON("benchmark.json");
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+struct BenchmarkSettings {
+    // Warm-up time before the calibration (s)
+    Double_t warmupTime = 0.1;
+    // Minimum time of a repetition (s)
+    Double_t minRepetitionTime = 2e-3;
+    Int_t repetitions = 30;
+    // Regular expression on the names, empty runs every benchmark
+    std::string filter;
+};
+
+struct BenchmarkResult {
+    std::string name;
+    Long64_t iterations = 0;
+    Int_t repetitions = 0;
+    Int_t outliers = 0;
+    // Time per call (ns)
+    Double_t mean = 0;
+    Double_t stddev = 0;
+    Double_t median = 0;
+    Double_t mad = 0;
+    Double_t min = 0;
+    Double_t max = 0;
+};
+
+// Makes the compiler assume the value is read, so the call that produced it is kept
+template <typename T>
+inline void KeepValue(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static const volatile void* sink;
+    sink = &value;
+#endif
+}
+
+class Benchmark {
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr Double_t kOutlierDeviations = 3;
+    // Maximum calls per repetition of the calibration
+    static constexpr Long64_t kMaxIterations = 1LL << 30;
+
+    BenchmarkSettings fSettings;
+    std::vector<std::pair<std::string, std::string>> fContext;
+    std::vector<BenchmarkResult> fResults;
+
+    template <typename F>
+    static Double_t Time(F& func, Long64_t iterations) {
+        const auto start = Clock::now();
+        for (Long64_t i = 0; i < iterations; i++) KeepValue(func());
+        return std::chrono::duration<Double_t>(Clock::now() - start).count();
+    }
+
+    static Double_t Median(std::vector<Double_t> values) {
+        std::sort(values.begin(), values.end());
+        const size_t n = values.size();
+        return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+    }
+
+    static std::string Escape(const std::string& text) {
+        std::string escaped;
+        for (const char c : text) {
+            if (c == '"' || c == '\\')
+                escaped += std::string("\\") + c;
+            else if (c == '\n')
+                escaped += "\\n";
+            else
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    // Clock resolution, as the smallest non-null difference of consecutive readings (ns)
+    static Double_t GetClockResolution() {
+        Double_t resolution = 1e9;
+        for (Int_t i = 0; i < 1000; i++) {
+            const auto start = Clock::now();
+            auto end = Clock::now();
+            while (end == start) end = Clock::now();
+            resolution = std::min(resolution, std::chrono::duration<Double_t, std::nano>(end - start).count());
+        }
+        return resolution;
+    }
+
+   public:
+    Benchmark(const BenchmarkSettings& settings = {}) : fSettings(settings) {}
+
+    void SetSettings(const BenchmarkSettings& settings) { fSettings = settings; }
+    const BenchmarkSettings& GetSettings() const { return fSettings; }
+
+    // Parameter of the run written in the context of the JSON output
+    void SetContext(const std::string& key, const std::string& value) {
+        for (auto& entry : fContext)
+            if (entry.first == key) {
+                entry.second = value;
+                return;
+            }
+        fContext.push_back({key, value});
+    }
+    void SetContext(const std::string& key, Double_t value) {
+        std::ostringstream text;
+        text << value;
+        SetContext(key, text.str());
+    }
+
+    Bool_t IsSelected(const std::string& name) const { return fSettings.filter.empty() || std::regex_search(name, std::regex(fSettings.filter)); }
+
+    const std::vector<BenchmarkResult>& GetResults() const { return fResults; }
+
+    // Benchmarks func, a callable returning the value of one call of the kernel. Returns false if the name is
+    // not selected by the filter
+    template <typename F>
+    Bool_t Run(const std::string& name, F func) {
+        if (!IsSelected(name)) return false;
+
+        const auto warmupEnd = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<Double_t>(fSettings.warmupTime));
+        while (Clock::now() < warmupEnd) KeepValue(func());
+
+        Long64_t iterations = 1;
+        Double_t elapsed = Time(func, iterations);
+        while (elapsed < fSettings.minRepetitionTime && iterations < kMaxIterations) {
+            // Aims 20% above the minimum time, at most ten times more calls per step
+            const Double_t factor = elapsed > 0 ? 1.2 * fSettings.minRepetitionTime / elapsed : 10;
+            iterations = std::min<Long64_t>(kMaxIterations, std::max<Long64_t>(iterations + 1, iterations * std::min(factor, 10.)));
+            elapsed = Time(func, iterations);
+        }
+
+        std::vector<Double_t> times(std::max(1, fSettings.repetitions));
+        for (auto& time : times) time = 1e9 * Time(func, iterations) / iterations;
+
+        BenchmarkResult result;
+        result.name = name;
+        result.iterations = iterations;
+        result.repetitions = times.size();
+        result.median = Median(times);
+        std::vector<Double_t> deviations;
+        for (const auto& time : times) deviations.push_back(std::abs(time - result.median));
+        result.mad = Median(deviations);
+        result.min = *std::min_element(times.begin(), times.end());
+        result.max = *std::max_element(times.begin(), times.end());
+
+        // 1.4826 MAD estimates the standard deviation of normal repetitions
+        const Double_t limit = kOutlierDeviations * 1.4826 * result.mad;
+        Double_t sum = 0, sum2 = 0;
+        Int_t kept = 0;
+        for (const auto& time : times) {
+            if (result.mad > 0 && std::abs(time - result.median) > limit) {
+                result.outliers++;
+                continue;
+            }
+            sum += time;
+            sum2 += time * time;
+            kept++;
+        }
+        result.mean = sum / kept;
+        result.stddev = kept > 1 ? std::sqrt(std::max(0., (sum2 - sum * sum / kept) / (kept - 1))) : 0;
+        fResults.push_back(result);
+        return true;
+    }
+
+    void Print() const {
+        std::cout << std::left << std::setw(56) << "Benchmark" << std::right << std::setw(14) << "median (ns)" << std::setw(14)
+                  << "mean (ns)" << std::setw(12) << "stddev" << std::setw(12) << "calls" << std::setw(10) << "outliers" << std::endl;
+        for (const auto& result : fResults)
+            std::cout << std::left << std::setw(56) << result.name << std::right << std::setw(14) << result.median << std::setw(14)
+                      << result.mean << std::setw(12) << result.stddev << std::setw(12) << result.iterations << std::setw(10)
+                      << result.outliers << std::endl;
+    }
+
+    Bool_t WriteJSON(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error: Unable to open " << filename << " for writing" << std::endl;
+            return false;
+        }
+        char host[256] = "";
+        gethostname(host, sizeof(host) - 1);
+        char date[32];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        file << std::setprecision(6);
+        file << "{\n  \"context\": {\n";
+        file << "    \"date\": \"" << date << "\",\n";
+        file << "    \"host\": \"" << Escape(host) << "\",\n";
+#if defined(__VERSION__)
+        file << "    \"compiler\": \"" << Escape(__VERSION__) << "\",\n";
+#endif
+        file << "    \"root\": \"" << ROOT_RELEASE << "\",\n";
+        file << "    \"clockResolution_ns\": " << GetClockResolution() << ",\n";
+        file << "    \"warmupTime_s\": " << fSettings.warmupTime << ",\n";
+        file << "    \"minRepetitionTime_s\": " << fSettings.minRepetitionTime;
+        for (const auto& entry : fContext) file << ",\n    \"" << Escape(entry.first) << "\": \"" << Escape(entry.second) << "\"";
+        file << "\n  },\n  \"benchmarks\": [";
+        for (size_t i = 0; i < fResults.size(); i++) {
+            const BenchmarkResult& result = fResults[i];
+            file << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << Escape(result.name) << "\", \"iterations\": " << result.iterations
+                 << ", \"repetitions\": " << result.repetitions << ", \"outliers\": " << result.outliers << ", \"mean_ns\": " << result.mean
+                 << ", \"stddev_ns\": " << result.stddev << ", \"median_ns\": " << result.median << ", \"mad_ns\": " << result.mad
+                 << ", \"min_ns\": " << result.min << ", \"max_ns\": " << result.max << "}";
+        }
+        file << "\n  ]\n}\n";
+        return true;
+    }
+};
+
+#endif
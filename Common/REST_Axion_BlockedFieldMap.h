@@ -0,0 +1,400 @@
+#ifndef REST_AXION_BLOCKEDFIELDMAP_H
+#define REST_AXION_BLOCKEDFIELDMAP_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <TVector3.h>
+#include "TRestAxionMagneticField.h"
+
+//*******************************************************************************************************
+//*** Description: Alternative storage of the volumes of a TRestAxionMagneticField, optimised for the
+//*** lookups along tracks running almost parallel to z.
+//***
+//*** The field of every volume is kept as structure-of-arrays Bx, By, Bz in float32, tiled in bricks of
+//*** 4 x 4 x 16 cells. A brick holds the 5 x 5 x 17 nodes of its cells, including a one-node halo shared with
+//*** its upper neighbours, so the 8 corners of every cell are in one brick. Inside a brick z is the slowest index
+//*** and the 5 x 5 (x, y) nodes of a z-plane are contiguous, the corners of a cell being two pairs of
+//*** consecutive floats in each of two consecutive planes. The consecutive cells of a track running almost
+//*** parallel to z stay in the same brick for 16 cells, and the next brick follows it in memory, since bricks
+//*** are ordered with z fastest. The halo repeats the nodes on the faces of the bricks, and the halo past the
+//*** last node of an axis repeats that node. The memory used is 5 x 5 x 17 floats per 4 x 4 x 16 nodes, 0.83 of
+//*** the double precision map.
+//***
+//*** The Single functions evaluate the map in single precision too: the position relative to the volume, the
+//*** cell fractions, the interpolation and B_T are computed in float, which packs twice the lanes per vector
+//*** register. The field of the maps is known far worse than the float epsilon (REST_Axion_PrecisionValidation.C
+//*** compares both modes with the spread of the maps), and the phase integrals keep accumulating in double.
+//***
+//*** The map is built by sampling `TRestAxionMagneticField::GetMagneticField` at the nodes of every volume,
+//*** after ReMap, so it reproduces the field of the library at the nodes and interpolates in between with
+//*** the same trilinear (or nearest node) scheme. The storage of a volume is addressed through pointers,
+//*** so it can also be a view on external memory (e.g. a mapped file) through AddVolume.
+//***
+//*** Usage:
+//***   TRestAxionMagneticField field("fields.rml", "babyIAXO_2024_cutoff");
+//***   BlockedFieldMap blocked(&field);
+//***   Double_t Bt = blocked.GetTransversalComponent(position, direction);
+//***
+//*** Dependencies:
+//*** `TRestAxionMagneticField::GetMagneticField`, `TRestAxionMagneticField::GetMeshSize` and the volume
+//*** bounds `TRestAxionMagneticField::GetXmin` ... `TRestAxionMagneticField::GetZmax`.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Brick dimensions in cells, and in nodes with the halo
+constexpr Int_t kBrickX = 4;
+constexpr Int_t kBrickY = 4;
+constexpr Int_t kBrickZ = 16;
+constexpr Int_t kBrickNodesX = kBrickX + 1;
+constexpr Int_t kBrickNodesY = kBrickY + 1;
+constexpr Int_t kBrickNodesZ = kBrickZ + 1;
+constexpr Int_t kBrickSize = kBrickNodesX * kBrickNodesY * kBrickNodesZ;
+// Offsets of the 8 corners of a cell from its lower corner, in the order of the trilinear weights
+constexpr size_t kBrickPlane = kBrickNodesX * kBrickNodesY;
+constexpr size_t kCellCorners[8] = {0, 1, kBrickNodesX, kBrickNodesX + 1, kBrickPlane, kBrickPlane + 1, kBrickPlane + kBrickNodesX,
+                                    kBrickPlane + kBrickNodesX + 1};
+
+// Bricks along an axis of n nodes with the given cells per brick, one at least
+inline Int_t GetNumberOfBricks(Int_t n, Int_t cells) { return std::max(1, (n - 1 + cells - 1) / cells); }
+
+// Floats per component of a volume of nx x ny x nz nodes
+inline size_t GetNumberOfBlockedValues(Int_t nx, Int_t ny, Int_t nz) {
+    return (size_t)GetNumberOfBricks(nx, kBrickX) * GetNumberOfBricks(ny, kBrickY) * GetNumberOfBricks(nz, kBrickZ) * kBrickSize;
+}
+
+// One volume of the map. Node (ix, iy, iz) sits at origin + (ix, iy, iz) * spacing
+struct BlockedVolume {
+    TVector3 origin;
+    TVector3 spacing;
+    Int_t nx = 0, ny = 0, nz = 0;
+
+    // Number of bricks along each axis
+    Int_t bx = 0, by = 0, bz = 0;
+
+    // Brick ordered components, bx * by * bz * kBrickSize floats each
+    const float* Bx = nullptr;
+    const float* By = nullptr;
+    const float* Bz = nullptr;
+
+    size_t GetNumberOfBricks() const { return (size_t)bx * by * bz; }
+
+    // Slot of the node (lx, ly, lz) of the brick (i, j, k)
+    size_t SlotIndex(Int_t i, Int_t j, Int_t k, Int_t lx, Int_t ly, Int_t lz) const {
+        return ((((size_t)i * by + j) * bz + k) * kBrickSize) + ((size_t)lz * kBrickNodesY + ly) * kBrickNodesX + lx;
+    }
+
+    // Slot of a node in the brick of the cells it is the lower corner of, the last node of an axis being in the
+    // last brick. For the lower corner of a cell, the other 7 corners are at kCellCorners from it
+    size_t NodeIndex(Int_t ix, Int_t iy, Int_t iz) const {
+        const Int_t i = std::min(ix / kBrickX, bx - 1), j = std::min(iy / kBrickY, by - 1), k = std::min(iz / kBrickZ, bz - 1);
+        return SlotIndex(i, j, k, ix - i * kBrickX, iy - j * kBrickY, iz - k * kBrickZ);
+    }
+
+    Bool_t IsInside(const TVector3& position) const {
+        const TVector3 local = position - origin;
+        return local.X() >= 0 && local.Y() >= 0 && local.Z() >= 0 && local.X() <= (nx - 1) * spacing.X() &&
+               local.Y() <= (ny - 1) * spacing.Y() && local.Z() <= (nz - 1) * spacing.Z();
+    }
+};
+
+class BlockedFieldMap {
+   private:
+    std::vector<BlockedVolume> fVolumes;
+
+    // Storage of the volumes built by this map, volumes added as views do not own their data
+    std::vector<std::vector<float>> fStorage;
+
+    Bool_t fInterpolation = true;
+
+    // Cell of the coordinate x on an axis of n nodes, clamped to the volume, and the fraction inside the cell
+    static Int_t Cell(Double_t x, Double_t spacing, Int_t n, Double_t& fraction) {
+        if (n < 2) {
+            fraction = 0;
+            return 0;
+        }
+        const Double_t u = std::min(std::max(x / spacing, 0.), (Double_t)(n - 1));
+        const Int_t i = std::min((Int_t)u, n - 2);
+        fraction = u - i;
+        return i;
+    }
+
+    static TVector3 Interpolate(const BlockedVolume& volume, const TVector3& position, Bool_t interpolation) {
+        const TVector3 local = position - volume.origin;
+        Double_t fx, fy, fz;
+        Int_t ix = Cell(local.X(), volume.spacing.X(), volume.nx, fx);
+        Int_t iy = Cell(local.Y(), volume.spacing.Y(), volume.ny, fy);
+        Int_t iz = Cell(local.Z(), volume.spacing.Z(), volume.nz, fz);
+
+        if (!interpolation) {
+            const size_t index = volume.NodeIndex(ix + (fx >= 0.5), iy + (fy >= 0.5), iz + (fz >= 0.5));
+            return TVector3(volume.Bx[index], volume.By[index], volume.Bz[index]);
+        }
+
+        // The 8 corners are in the brick of the cell
+        const size_t cell = volume.NodeIndex(ix, iy, iz);
+        const Double_t weights[8] = {(1 - fx) * (1 - fy) * (1 - fz), fx * (1 - fy) * (1 - fz), (1 - fx) * fy * (1 - fz),
+                                     fx * fy * (1 - fz),             (1 - fx) * (1 - fy) * fz, fx * (1 - fy) * fz,
+                                     (1 - fx) * fy * fz,             fx * fy * fz};
+
+        Double_t bx = 0, by = 0, bz = 0;
+        for (Int_t c = 0; c < 8; c++) {
+            bx += weights[c] * volume.Bx[cell + kCellCorners[c]];
+            by += weights[c] * volume.By[cell + kCellCorners[c]];
+            bz += weights[c] * volume.Bz[cell + kCellCorners[c]];
+        }
+        return TVector3(bx, by, bz);
+    }
+
+    static Int_t CellSingle(float x, float spacing, Int_t n, float& fraction) {
+        if (n < 2) {
+            fraction = 0;
+            return 0;
+        }
+        const float u = std::min(std::max(x / spacing, 0.f), (float)(n - 1));
+        const Int_t i = std::min((Int_t)u, n - 2);
+        fraction = u - i;
+        return i;
+    }
+
+    // Interpolation in float at the local coordinates (x, y, z) of the volume
+    static void InterpolateSingle(const BlockedVolume& volume, float x, float y, float z, Bool_t interpolation, float B[3]) {
+        float fx, fy, fz;
+        const Int_t ix = CellSingle(x, (float)volume.spacing.X(), volume.nx, fx);
+        const Int_t iy = CellSingle(y, (float)volume.spacing.Y(), volume.ny, fy);
+        const Int_t iz = CellSingle(z, (float)volume.spacing.Z(), volume.nz, fz);
+
+        if (!interpolation) {
+            const size_t index = volume.NodeIndex(ix + (fx >= 0.5f), iy + (fy >= 0.5f), iz + (fz >= 0.5f));
+            B[0] = volume.Bx[index];
+            B[1] = volume.By[index];
+            B[2] = volume.Bz[index];
+            return;
+        }
+
+        // The 8 corners are in the brick of the cell
+        const size_t cell = volume.NodeIndex(ix, iy, iz);
+        const float gx = 1 - fx, gy = 1 - fy, gz = 1 - fz;
+        const float weights[8] = {gx * gy * gz, fx * gy * gz, gx * fy * gz, fx * fy * gz, gx * gy * fz, fx * gy * fz, gx * fy * fz, fx * fy * fz};
+
+        float bx = 0, by = 0, bz = 0;
+        for (Int_t c = 0; c < 8; c++) {
+            bx += weights[c] * volume.Bx[cell + kCellCorners[c]];
+            by += weights[c] * volume.By[cell + kCellCorners[c]];
+            bz += weights[c] * volume.Bz[cell + kCellCorners[c]];
+        }
+        B[0] = bx;
+        B[1] = by;
+        B[2] = bz;
+    }
+
+    // |B x u| of a unit vector u, in float
+    static float PerpSingle(const float B[3], const float u[3]) {
+        const float cx = B[1] * u[2] - B[2] * u[1], cy = B[2] * u[0] - B[0] * u[2], cz = B[0] * u[1] - B[1] * u[0];
+        return std::sqrt(cx * cx + cy * cy + cz * cz);
+    }
+
+   public:
+    BlockedFieldMap() = default;
+
+    // The volumes point into the storage, so the map can be moved but not copied
+    BlockedFieldMap(const BlockedFieldMap&) = delete;
+    BlockedFieldMap& operator=(const BlockedFieldMap&) = delete;
+    BlockedFieldMap(BlockedFieldMap&&) = default;
+    BlockedFieldMap& operator=(BlockedFieldMap&&) = default;
+
+    // Samples every volume of the field at its nodes
+    explicit BlockedFieldMap(TRestAxionMagneticField* field, Bool_t interpolation = true) : fInterpolation(interpolation) {
+        for (size_t id = 0; id < field->GetNumberOfVolumes(); id++) AddVolume(field, id);
+    }
+
+    void SetInterpolation(Bool_t interpolation) { fInterpolation = interpolation; }
+    Bool_t GetInterpolation() const { return fInterpolation; }
+
+    size_t GetNumberOfVolumes() const { return fVolumes.size(); }
+    const BlockedVolume& GetVolume(size_t n) const { return fVolumes[n]; }
+
+    // Nodes of all the volumes, without the halo
+    size_t GetNumberOfNodes() const {
+        size_t nodes = 0;
+        for (const auto& volume : fVolumes) nodes += (size_t)volume.nx * volume.ny * volume.nz;
+        return nodes;
+    }
+
+    // Bytes used by the field values of all the volumes
+    size_t GetMemorySize() const {
+        size_t size = 0;
+        for (const auto& volume : fVolumes) size += 3 * volume.GetNumberOfBricks() * kBrickSize * sizeof(float);
+        return size;
+    }
+
+    // Adds a volume whose components are already brick ordered, with their halo, without copying them
+    void AddVolume(const TVector3& origin, const TVector3& spacing, Int_t nx, Int_t ny, Int_t nz, const float* Bx, const float* By,
+                   const float* Bz) {
+        BlockedVolume volume;
+        volume.origin = origin;
+        volume.spacing = spacing;
+        volume.nx = nx;
+        volume.ny = ny;
+        volume.nz = nz;
+        volume.bx = GetNumberOfBricks(nx, kBrickX);
+        volume.by = GetNumberOfBricks(ny, kBrickY);
+        volume.bz = GetNumberOfBricks(nz, kBrickZ);
+        volume.Bx = Bx;
+        volume.By = By;
+        volume.Bz = Bz;
+        fVolumes.push_back(volume);
+    }
+
+    // Adds a null volume owned by the map. It returns the brick ordered storage to fill, Bx followed by By and Bz,
+    // through NodeIndex and then FillHalo
+    float* AddOwnedVolume(const TVector3& origin, const TVector3& spacing, Int_t nx, Int_t ny, Int_t nz) {
+        const size_t nValues = GetNumberOfBlockedValues(nx, ny, nz);
+        fStorage.emplace_back(3 * nValues, 0.f);
+        float* data = fStorage.back().data();
+        AddVolume(origin, spacing, nx, ny, nz, data, data + nValues, data + 2 * nValues);
+        return data;
+    }
+
+    // Copies the nodes written at their NodeIndex to the halo slots of the other bricks, the slots past the last
+    // node of an axis taking that node
+    static void FillHalo(const BlockedVolume& volume, float* data) {
+        const size_t nValues = volume.GetNumberOfBricks() * kBrickSize;
+        for (Int_t i = 0; i < volume.bx; i++)
+            for (Int_t j = 0; j < volume.by; j++)
+                for (Int_t k = 0; k < volume.bz; k++)
+                    for (Int_t lz = 0; lz < kBrickNodesZ; lz++)
+                        for (Int_t ly = 0; ly < kBrickNodesY; ly++)
+                            for (Int_t lx = 0; lx < kBrickNodesX; lx++) {
+                                const size_t slot = volume.SlotIndex(i, j, k, lx, ly, lz);
+                                const Int_t ix = std::min(i * kBrickX + lx, volume.nx - 1), iy = std::min(j * kBrickY + ly, volume.ny - 1);
+                                const size_t node = volume.NodeIndex(ix, iy, std::min(k * kBrickZ + lz, volume.nz - 1));
+                                if (slot == node) continue;
+                                for (Int_t c = 0; c < 3; c++) data[c * nValues + slot] = data[c * nValues + node];
+                            }
+    }
+
+    // Samples the volume id of the field at the nodes of its mesh
+    void AddVolume(TRestAxionMagneticField* field, size_t id) {
+        const TVector3 spacing = field->GetMeshSize(id);
+        const TVector3 origin(field->GetXmin(id), field->GetYmin(id), field->GetZmin(id));
+        const Int_t nx = spacing.X() > 0 ? (Int_t)std::round((field->GetXmax(id) - origin.X()) / spacing.X()) + 1 : 1;
+        const Int_t ny = spacing.Y() > 0 ? (Int_t)std::round((field->GetYmax(id) - origin.Y()) / spacing.Y()) + 1 : 1;
+        const Int_t nz = spacing.Z() > 0 ? (Int_t)std::round((field->GetZmax(id) - origin.Z()) / spacing.Z()) + 1 : 1;
+
+        float* data = AddOwnedVolume(origin, spacing, nx, ny, nz);
+        const BlockedVolume& volume = fVolumes.back();
+        const size_t nValues = volume.GetNumberOfBricks() * kBrickSize;
+        for (Int_t ix = 0; ix < nx; ix++)
+            for (Int_t iy = 0; iy < ny; iy++)
+                for (Int_t iz = 0; iz < nz; iz++) {
+                    const TVector3 node = origin + TVector3(ix * spacing.X(), iy * spacing.Y(), iz * spacing.Z());
+                    const TVector3 B = field->GetMagneticField(node, false);
+                    const size_t index = volume.NodeIndex(ix, iy, iz);
+                    data[index] = B.X();
+                    data[nValues + index] = B.Y();
+                    data[2 * nValues + index] = B.Z();
+                }
+        FillHalo(volume, data);
+    }
+
+    // Field in T at a position in mm, null outside the volumes
+    TVector3 GetMagneticField(const TVector3& position) const {
+        for (const auto& volume : fVolumes)
+            if (volume.IsInside(position)) return Interpolate(volume, position, fInterpolation);
+        return TVector3(0, 0, 0);
+    }
+
+    Double_t GetTransversalComponent(const TVector3& position, const TVector3& direction) const {
+        return GetMagneticField(position).Perp(direction);
+    }
+
+    // B_T computed in single precision
+    Double_t GetTransversalComponentSingle(const TVector3& position, const TVector3& direction) const {
+        const TVector3 unit = direction.Unit();
+        const float u[3] = {(float)unit.X(), (float)unit.Y(), (float)unit.Z()};
+        for (const auto& volume : fVolumes) {
+            if (!volume.IsInside(position)) continue;
+            float B[3];
+            InterpolateSingle(volume, (float)(position.X() - volume.origin.X()), (float)(position.Y() - volume.origin.Y()),
+                              (float)(position.Z() - volume.origin.Z()), fInterpolation, B);
+            return PerpSingle(B, u);
+        }
+        return 0;
+    }
+
+    // B_T in single precision at the n points start + i dL direction, the positions being advanced in float from
+    // the local start of every volume
+    void SampleSingle(const TVector3& start, const TVector3& direction, Double_t dL, size_t n, Double_t* values) const {
+        const TVector3 unit = direction.Unit();
+        const float u[3] = {(float)unit.X(), (float)unit.Y(), (float)unit.Z()};
+        const float step[3] = {(float)(dL * unit.X()), (float)(dL * unit.Y()), (float)(dL * unit.Z())};
+        std::fill(values, values + n, 0.);
+        std::vector<bool> done(n, false);
+        for (const auto& volume : fVolumes) {
+            const float x0 = start.X() - volume.origin.X(), y0 = start.Y() - volume.origin.Y(), z0 = start.Z() - volume.origin.Z();
+            const float sx = (volume.nx - 1) * (float)volume.spacing.X(), sy = (volume.ny - 1) * (float)volume.spacing.Y(),
+                        sz = (volume.nz - 1) * (float)volume.spacing.Z();
+            for (size_t i = 0; i < n; i++) {
+                if (done[i]) continue;
+                const float x = x0 + i * step[0], y = y0 + i * step[1], z = z0 + i * step[2];
+                if (x < 0 || y < 0 || z < 0 || x > sx || y > sy || z > sz) continue;
+                float B[3];
+                InterpolateSingle(volume, x, y, z, fInterpolation, B);
+                values[i] = PerpSingle(B, u);
+                done[i] = true;
+            }
+        }
+    }
+
+    // Entry and exit points of the line through position along direction where the field of the volume n is not
+    // null, found in steps of the smallest mesh size. It returns an empty vector if the line misses the field
+    std::vector<TVector3> GetFieldBoundaries(const TVector3& position, const TVector3& direction, size_t n) const {
+        const BlockedVolume& volume = fVolumes[n];
+        const TVector3 size((volume.nx - 1) * volume.spacing.X(), (volume.ny - 1) * volume.spacing.Y(), (volume.nz - 1) * volume.spacing.Z());
+
+        // Slab intersection of the line with the box of the volume
+        Double_t tMin = -1e30, tMax = 1e30;
+        for (Int_t axis = 0; axis < 3; axis++) {
+            const Double_t lower = volume.origin[axis] - position[axis];
+            const Double_t upper = lower + size[axis];
+            if (direction[axis] == 0) {
+                if (lower > 0 || upper < 0) return {};
+                continue;
+            }
+            Double_t t0 = lower / direction[axis], t1 = upper / direction[axis];
+            if (t0 > t1) std::swap(t0, t1);
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+        }
+        if (tMin > tMax) return {};
+
+        Double_t step = 1e30;
+        for (Int_t axis = 0; axis < 3; axis++)
+            if (volume.spacing[axis] > 0) step = std::min(step, volume.spacing[axis]);
+        if (step >= 1e30) step = tMax - tMin;
+        step = std::max(step, 1e-3);
+
+        auto isNull = [&](Double_t t) { return Interpolate(volume, position + t * direction, fInterpolation).Mag2() == 0; };
+        while (tMin < tMax && isNull(tMin)) tMin = std::min(tMin + step, tMax);
+        while (tMax > tMin && isNull(tMax)) tMax = std::max(tMax - step, tMin);
+        if (tMin >= tMax) return {};
+
+        return {position + tMin * direction, position + tMax * direction};
+    }
+
+    // Transversal component every dL from `from` towards `to`, as TRestAxionMagneticField::GetTransversalComponentAlongPath
+    std::vector<Double_t> GetTransversalComponentAlongPath(const TVector3& from, const TVector3& to, Double_t dL) const {
+        std::vector<Double_t> values;
+        const Double_t length = (to - from).Mag();
+        if (length <= 0 || dL <= 0) return values;
+        const TVector3 direction = (to - from).Unit();
+        values.reserve((size_t)(length / dL) + 1);
+        for (Double_t d = 0; d < length; d += dL) values.push_back(GetTransversalComponent(from + d * direction, direction));
+        return values;
+    }
+};
+
+#endif
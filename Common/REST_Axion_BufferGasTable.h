@@ -0,0 +1,180 @@
+#ifndef REST_AXION_BUFFERGASTABLE_H
+#define REST_AXION_BUFFERGASTABLE_H
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <functional>
+
+#include <Rtypes.h>
+#include "TRestAxionBufferGas.h"
+
+//*******************************************************************************************************
+//*** Description: Dense energy-grid tabulation of the photon mass and absorption of a TRestAxionBufferGas,
+//*** for the hot loops of the integrations and of the mass sets.
+//***
+//*** The library interpolates irregular attenuation tables with a binary search at every call. The table is
+//*** built once per gas mixture and density on a uniform energy grid, so that a lookup is one multiplication,
+//*** one cell load and a branchless linear interpolation: every cell keeps a line a + b E below and another one
+//*** above its edge energy, and the line above is selected with a comparison turned into a factor 0 or 1.
+//*** The absorption edges of the gas are located at build time: a cell whose midpoint departs from the linear
+//*** interpolation of its ends is bisected down to the jump, and each side of the jump gets its own line.
+//*** Cells without an edge have it at infinity.
+//***
+//*** Outside [Emin, Emax] the table returns its values at the nearest end of the range, it does not extrapolate;
+//*** FieldWorker only queries it inside the range and asks the library otherwise. After the build, the table is
+//*** checked against the library at kValidationSamples energies inside every cell, and the largest relative
+//*** error of the mass and of the absorption is kept (GetMaxRelativeError), so a too coarse step or a missed
+//*** edge is caught before the table is used.
+//***
+//*** Usage:
+//***   BufferGasTable table;
+//***   table.Build(gas, 0.1, 20, 0.005);                 // keV
+//***   Double_t Gamma = table.GetPhotonAbsorption(Ea);    // mm-1
+//***   Double_t mg = table.GetPhotonMass(Ea);             // eV
+//***
+//*** Dependencies:
+//*** `TRestAxionBufferGas::GetPhotonMass` and `TRestAxionBufferGas::GetPhotonAbsorptionLength`, at build and
+//*** validation time.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+class BufferGasTable {
+   public:
+    // Energies per cell where the table is compared with the library
+    static constexpr Int_t kValidationSamples = 4;
+
+   private:
+    struct Cell {
+        Double_t edge;
+        Double_t a0, b0;
+        Double_t a1, b1;
+    };
+
+    Double_t fEmin = 0;
+    Double_t fEmax = 0;
+    Double_t fStep = 0;
+    Double_t fInvStep = 0;
+    std::vector<Cell> fMass;
+    std::vector<Cell> fAbsorption;
+    size_t fNumberOfEdges = 0;
+    Double_t fMaxRelativeError = 0;
+
+    static Cell Line(Double_t E0, Double_t f0, Double_t E1, Double_t f1) {
+        const Double_t b = E1 > E0 ? (f1 - f0) / (E1 - E0) : 0;
+        const Double_t a = f0 - b * E0;
+        return {std::numeric_limits<Double_t>::infinity(), a, b, a, b};
+    }
+
+    // Cells of func on the grid. With edges, the cells where the midpoint departs from the linear interpolation
+    // by more than tolerance (relative) are split at the jump
+    std::vector<Cell> Tabulate(const std::function<Double_t(Double_t)>& func, Bool_t edges, Double_t tolerance) {
+        const size_t nCells = GetNumberOfCells();
+        std::vector<Cell> cells(nCells);
+        Double_t E0 = fEmin, f0 = func(E0);
+        for (size_t i = 0; i < nCells; i++) {
+            const Double_t E1 = fEmin + (i + 1) * fStep;
+            const Double_t f1 = func(E1);
+            cells[i] = Line(E0, f0, E1, f1);
+
+            if (edges) {
+                const Double_t Em = (E0 + E1) / 2, fm = func(Em);
+                const Double_t scale = std::max({std::abs(f0), std::abs(f1), std::abs(fm)});
+                if (scale > 0 && std::abs(fm - (f0 + f1) / 2) > tolerance * scale) {
+                    // The jump is on the side of the midpoint with the largest change
+                    Double_t lo = E0, hi = E1, flo = f0, fhi = f1;
+                    for (Int_t k = 0; k < 40; k++) {
+                        const Double_t mid = (lo + hi) / 2, fmid = func(mid);
+                        if (std::abs(fmid - flo) > std::abs(fhi - fmid)) {
+                            hi = mid;
+                            fhi = fmid;
+                        } else {
+                            lo = mid;
+                            flo = fmid;
+                        }
+                    }
+                    const Cell below = Line(E0, f0, lo, flo);
+                    const Cell above = Line(hi, fhi, E1, f1);
+                    cells[i] = {(lo + hi) / 2, below.a0, below.b0, above.a0, above.b0};
+                    fNumberOfEdges++;
+                }
+            }
+            E0 = E1;
+            f0 = f1;
+        }
+        return cells;
+    }
+
+    Double_t Evaluate(const std::vector<Cell>& cells, Double_t Ea) const {
+        if (cells.empty()) return 0;
+        const Double_t E = std::min(std::max(Ea, fEmin), fEmax);
+        const Double_t u = std::min((E - fEmin) * fInvStep, (Double_t)cells.size() - 0.5);
+        const Cell& cell = cells[(size_t)u];
+        const Double_t above = E >= cell.edge;
+        return cell.a0 + cell.b0 * E + above * ((cell.a1 - cell.a0) + (cell.b1 - cell.b0) * E);
+    }
+
+    // Largest relative deviation of the cells from func, at kValidationSamples energies inside every cell
+    Double_t Validate(const std::vector<Cell>& cells, const std::function<Double_t(Double_t)>& func) const {
+        Double_t maxError = 0;
+        for (size_t i = 0; i < cells.size(); i++)
+            for (Int_t k = 0; k < kValidationSamples; k++) {
+                const Double_t E = fEmin + (i + (k + 0.5) / kValidationSamples) * fStep;
+                const Double_t reference = func(E);
+                const Double_t error = std::abs(Evaluate(cells, E) - reference);
+                maxError = std::max(maxError, reference != 0 ? error / std::abs(reference) : error);
+            }
+        return maxError;
+    }
+
+   public:
+    // Tabulates the gas between Emin and Emax (keV) every step (keV). Absorption jumps of more than tolerance
+    // (relative) of the midpoint of a cell are treated as edges
+    void Build(TRestAxionBufferGas* gas, Double_t Emin, Double_t Emax, Double_t step, Double_t tolerance = 1e-2) {
+        Clear();
+        if (gas == nullptr || Emax <= Emin || step <= 0) return;
+
+        fEmin = Emin;
+        fStep = (Emax - Emin) / std::max<size_t>(1, (size_t)std::ceil((Emax - Emin) / step));
+        fEmax = Emax;
+        fInvStep = 1 / fStep;
+        fMass = Tabulate([&](Double_t E) { return gas->GetPhotonMass(E); }, false, tolerance);
+        fAbsorption = Tabulate([&](Double_t E) { return gas->GetPhotonAbsorptionLength(E) / 10.; }, true, tolerance);
+        fMaxRelativeError = std::max(Validate(fMass, [&](Double_t E) { return gas->GetPhotonMass(E); }),
+                                     Validate(fAbsorption, [&](Double_t E) { return gas->GetPhotonAbsorptionLength(E) / 10.; }));
+    }
+
+    void Clear() {
+        fMass.clear();
+        fAbsorption.clear();
+        fEmin = fEmax = fStep = fInvStep = 0;
+        fNumberOfEdges = 0;
+        fMaxRelativeError = 0;
+    }
+
+    Bool_t IsEmpty() const { return fAbsorption.empty(); }
+    Bool_t IsInside(Double_t Ea) const { return !fAbsorption.empty() && Ea >= fEmin && Ea <= fEmax; }
+
+    size_t GetNumberOfCells() const { return fStep > 0 ? (size_t)std::llround((fEmax - fEmin) / fStep) : 0; }
+    size_t GetNumberOfEdges() const { return fNumberOfEdges; }
+    Double_t GetStep() const { return fStep; }
+    Double_t GetEmin() const { return fEmin; }
+    Double_t GetEmax() const { return fEmax; }
+
+    // Largest relative error of the photon mass and absorption against the library, over the range of the table
+    Double_t GetMaxRelativeError() const { return fMaxRelativeError; }
+
+    // Photon mass in eV, the energy clamped to the range
+    Double_t GetPhotonMass(Double_t Ea) const { return Evaluate(fMass, Ea); }
+
+    // Photon absorption in mm-1, the energy clamped to the range
+    Double_t GetPhotonAbsorption(Double_t Ea) const { return Evaluate(fAbsorption, Ea); }
+
+    // Photon absorption in cm-1, as TRestAxionBufferGas::GetPhotonAbsorptionLength
+    Double_t GetPhotonAbsorptionLength(Double_t Ea) const { return 10. * GetPhotonAbsorption(Ea); }
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef REST_AXION_COHERENCEKERNEL_H
+#define REST_AXION_COHERENCEKERNEL_H
+
+#include <cmath>
+#include <vector>
+
+#include <Rtypes.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+//*******************************************************************************************************
+//*** Description: Kernels of the standard integration, the coherent sum of the transversal field samples
+//*** B[i] taken every dL along a track of length L = (n - 1) dL:
+//***   A = sum_i B[i] exp(-Gamma (L - l_i) / 2) exp(i q l_i) dL,    returns |A|^2 in T^2 mm^2.
+//***
+//*** - CoherenceSumScalar: reference implementation, with one exp/cos/sin per sample.
+//*** - CoherenceSum: fast version. The phasor z_i = exp(-Gamma (L - l_i) / 2 + i q l_i) is advanced with a complex
+//***   rotation per step instead of sin/cos, using AVX-512, AVX2 + FMA or NEON when the macro is compiled with
+//***   them (e.g. `-march=native`), or a scalar recurrence otherwise. The phasors are reseeded exactly every
+//***   kCoherenceReseed steps, so the rounding of the recurrence does not accumulate along long tracks.
+//***   Defining REST_AXION_SCALAR_KERNEL forces the reference implementation.
+//*** - CoherenceSumBatch: same recurrence for many (q, Gamma) pairs over the same samples, in a single pass.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Number of recurrence steps between two exact evaluations of the phasors
+constexpr size_t kCoherenceReseed = 64;
+
+// Exact phasor exp(-Gamma (L - l) / 2) exp(i q l)
+inline void CoherencePhasor(Double_t l, Double_t L, Double_t q, Double_t Gamma, Double_t& re, Double_t& im) {
+    const Double_t damping = std::exp(-Gamma * (L - l) / 2.);
+    re = damping * std::cos(q * l);
+    im = damping * std::sin(q * l);
+}
+
+// Reference standard integration
+inline Double_t CoherenceSumScalar(const Double_t* B, size_t n, Double_t dL, Double_t q, Double_t Gamma) {
+    if (n == 0) return 0;
+    const Double_t L = (n - 1) * dL;
+    Double_t re = 0, im = 0;
+    for (size_t i = 0; i < n; i++) {
+        const Double_t l = i * dL;
+        const Double_t weight = B[i] * std::exp(-Gamma * (L - l) / 2.) * dL;
+        re += weight * std::cos(q * l);
+        im += weight * std::sin(q * l);
+    }
+    return re * re + im * im;
+}
+
+// Scalar recurrence, also used for the tails of the vectorised kernels from the sample first on
+inline void CoherenceAccumulateRecurrence(const Double_t* B, size_t first, size_t n, Double_t dL, Double_t q, Double_t Gamma,
+                                          Double_t& re, Double_t& im) {
+    const Double_t L = (n - 1) * dL;
+    const Double_t growth = std::exp(Gamma * dL / 2.);
+    const Double_t stepRe = growth * std::cos(q * dL), stepIm = growth * std::sin(q * dL);
+    Double_t zRe = 0, zIm = 0;
+    for (size_t i = first; i < n; i++) {
+        if ((i - first) % kCoherenceReseed == 0) CoherencePhasor(i * dL, L, q, Gamma, zRe, zIm);
+        re += B[i] * zRe;
+        im += B[i] * zIm;
+        const Double_t nextRe = zRe * stepRe - zIm * stepIm;
+        zIm = zRe * stepIm + zIm * stepRe;
+        zRe = nextRe;
+    }
+}
+
+inline Double_t CoherenceSumRecurrence(const Double_t* B, size_t n, Double_t dL, Double_t q, Double_t Gamma) {
+    if (n == 0) return 0;
+    Double_t re = 0, im = 0;
+    CoherenceAccumulateRecurrence(B, 0, n, dL, q, Gamma, re, im);
+    return dL * dL * (re * re + im * im);
+}
+
+#if defined(__AVX512F__)
+inline Double_t CoherenceSumAVX512(const Double_t* B, size_t n, Double_t dL, Double_t q, Double_t Gamma) {
+    if (n == 0) return 0;
+    constexpr size_t W = 8;
+    const Double_t L = (n - 1) * dL;
+    const Double_t growth = std::exp(Gamma * W * dL / 2.);
+    const __m512d stepRe = _mm512_set1_pd(growth * std::cos(q * W * dL));
+    const __m512d stepIm = _mm512_set1_pd(growth * std::sin(q * W * dL));
+
+    __m512d accRe = _mm512_setzero_pd(), accIm = _mm512_setzero_pd();
+    __m512d zRe = accRe, zIm = accIm;
+    alignas(64) Double_t seedRe[W], seedIm[W];
+
+    size_t i = 0;
+    for (size_t block = 0; i + W <= n; i += W, block++) {
+        if (block % kCoherenceReseed == 0) {
+            for (size_t k = 0; k < W; k++) CoherencePhasor((i + k) * dL, L, q, Gamma, seedRe[k], seedIm[k]);
+            zRe = _mm512_load_pd(seedRe);
+            zIm = _mm512_load_pd(seedIm);
+        }
+        const __m512d b = _mm512_loadu_pd(B + i);
+        accRe = _mm512_fmadd_pd(b, zRe, accRe);
+        accIm = _mm512_fmadd_pd(b, zIm, accIm);
+        const __m512d nextRe = _mm512_fmsub_pd(zRe, stepRe, _mm512_mul_pd(zIm, stepIm));
+        zIm = _mm512_fmadd_pd(zRe, stepIm, _mm512_mul_pd(zIm, stepRe));
+        zRe = nextRe;
+    }
+
+    Double_t re = _mm512_reduce_add_pd(accRe), im = _mm512_reduce_add_pd(accIm);
+    CoherenceAccumulateRecurrence(B, i, n, dL, q, Gamma, re, im);
+    return dL * dL * (re * re + im * im);
+}
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+inline Double_t CoherenceSumAVX2(const Double_t* B, size_t n, Double_t dL, Double_t q, Double_t Gamma) {
+    if (n == 0) return 0;
+    constexpr size_t W = 4;
+    const Double_t L = (n - 1) * dL;
+    const Double_t growth = std::exp(Gamma * W * dL / 2.);
+    const __m256d stepRe = _mm256_set1_pd(growth * std::cos(q * W * dL));
+    const __m256d stepIm = _mm256_set1_pd(growth * std::sin(q * W * dL));
+
+    __m256d accRe = _mm256_setzero_pd(), accIm = _mm256_setzero_pd();
+    __m256d zRe = accRe, zIm = accIm;
+    alignas(32) Double_t seedRe[W], seedIm[W];
+
+    size_t i = 0;
+    for (size_t block = 0; i + W <= n; i += W, block++) {
+        if (block % kCoherenceReseed == 0) {
+            for (size_t k = 0; k < W; k++) CoherencePhasor((i + k) * dL, L, q, Gamma, seedRe[k], seedIm[k]);
+            zRe = _mm256_load_pd(seedRe);
+            zIm = _mm256_load_pd(seedIm);
+        }
+        const __m256d b = _mm256_loadu_pd(B + i);
+        accRe = _mm256_fmadd_pd(b, zRe, accRe);
+        accIm = _mm256_fmadd_pd(b, zIm, accIm);
+        const __m256d nextRe = _mm256_fmsub_pd(zRe, stepRe, _mm256_mul_pd(zIm, stepIm));
+        zIm = _mm256_fmadd_pd(zRe, stepIm, _mm256_mul_pd(zIm, stepRe));
+        zRe = nextRe;
+    }
+
+    alignas(32) Double_t sumRe[W], sumIm[W];
+    _mm256_store_pd(sumRe, accRe);
+    _mm256_store_pd(sumIm, accIm);
+    Double_t re = sumRe[0] + sumRe[1] + sumRe[2] + sumRe[3];
+    Double_t im = sumIm[0] + sumIm[1] + sumIm[2] + sumIm[3];
+    CoherenceAccumulateRecurrence(B, i, n, dL, q, Gamma, re, im);
+    return dL * dL * (re * re + im * im);
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+inline Double_t CoherenceSumNEON(const Double_t* B, size_t n, Double_t dL, Double_t q, Double_t Gamma) {
+    if (n == 0) return 0;
+    constexpr size_t W = 2;
+    const Double_t L = (n - 1) * dL;
+    const Double_t growth = std::exp(Gamma * W * dL / 2.);
+    const float64x2_t stepRe = vdupq_n_f64(growth * std::cos(q * W * dL));
+    const float64x2_t stepIm = vdupq_n_f64(growth * std::sin(q * W * dL));
+
+    float64x2_t accRe = vdupq_n_f64(0), accIm = vdupq_n_f64(0);
+    float64x2_t zRe = accRe, zIm = accIm;
+    Double_t seedRe[W], seedIm[W];
+
+    size_t i = 0;
+    for (size_t block = 0; i + W <= n; i += W, block++) {
+        if (block % kCoherenceReseed == 0) {
+            for (size_t k = 0; k < W; k++) CoherencePhasor((i + k) * dL, L, q, Gamma, seedRe[k], seedIm[k]);
+            zRe = vld1q_f64(seedRe);
+            zIm = vld1q_f64(seedIm);
+        }
+        const float64x2_t b = vld1q_f64(B + i);
+        accRe = vfmaq_f64(accRe, b, zRe);
+        accIm = vfmaq_f64(accIm, b, zIm);
+        const float64x2_t nextRe = vfmsq_f64(vmulq_f64(zRe, stepRe), zIm, stepIm);
+        zIm = vfmaq_f64(vmulq_f64(zRe, stepIm), zIm, stepRe);
+        zRe = nextRe;
+    }
+
+    Double_t re = vaddvq_f64(accRe), im = vaddvq_f64(accIm);
+    CoherenceAccumulateRecurrence(B, i, n, dL, q, Gamma, re, im);
+    return dL * dL * (re * re + im * im);
+}
+#endif
+
+// Fastest kernel available for the compilation flags
+inline Double_t CoherenceSum(const Double_t* B, size_t n, Double_t dL, Double_t q, Double_t Gamma) {
+#if defined(REST_AXION_SCALAR_KERNEL)
+    return CoherenceSumScalar(B, n, dL, q, Gamma);
+#elif defined(__AVX512F__)
+    return CoherenceSumAVX512(B, n, dL, q, Gamma);
+#elif defined(__AVX2__) && defined(__FMA__)
+    return CoherenceSumAVX2(B, n, dL, q, Gamma);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return CoherenceSumNEON(B, n, dL, q, Gamma);
+#else
+    return CoherenceSumRecurrence(B, n, dL, q, Gamma);
+#endif
+}
+
+inline const char* CoherenceKernelName() {
+#if defined(REST_AXION_SCALAR_KERNEL)
+    return "scalar";
+#elif defined(__AVX512F__)
+    return "avx512";
+#elif defined(__AVX2__) && defined(__FMA__)
+    return "avx2";
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return "neon";
+#else
+    return "recurrence";
+#endif
+}
+
+// Batched standard integration: the samples are read once and the phasors of all the nPoints (q, Gamma) pairs
+// are advanced together, in a contiguous loop the compiler can vectorise. result[p] is |amplitude_p|^2
+inline void CoherenceSumBatch(const Double_t* B, size_t n, Double_t dL, const Double_t* q, const Double_t* Gamma, size_t nPoints,
+                              Double_t* result) {
+#if defined(REST_AXION_SCALAR_KERNEL)
+    for (size_t p = 0; p < nPoints; p++) result[p] = CoherenceSumScalar(B, n, dL, q[p], Gamma[p]);
+#else
+    std::vector<Double_t> re(nPoints, 0), im(nPoints, 0), zRe(nPoints), zIm(nPoints), stepRe(nPoints), stepIm(nPoints);
+    const Double_t L = n > 0 ? (n - 1) * dL : 0;
+    for (size_t p = 0; p < nPoints; p++) {
+        const Double_t growth = std::exp(Gamma[p] * dL / 2.);
+        stepRe[p] = growth * std::cos(q[p] * dL);
+        stepIm[p] = growth * std::sin(q[p] * dL);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (i % kCoherenceReseed == 0)
+            for (size_t p = 0; p < nPoints; p++) CoherencePhasor(i * dL, L, q[p], Gamma[p], zRe[p], zIm[p]);
+        const Double_t b = B[i];
+        for (size_t p = 0; p < nPoints; p++) {
+            re[p] += b * zRe[p];
+            im[p] += b * zIm[p];
+            const Double_t nextRe = zRe[p] * stepRe[p] - zIm[p] * stepIm[p];
+            zIm[p] = zRe[p] * stepIm[p] + zIm[p] * stepRe[p];
+            zRe[p] = nextRe;
+        }
+    }
+    for (size_t p = 0; p < nPoints; p++) result[p] = dL * dL * (re[p] * re[p] + im[p] * im[p]);
+#endif
+}
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef REST_AXION_DATASETBUILDER_H
+#define REST_AXION_DATASETBUILDER_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <regex>
+#include <ctime>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <filesystem>
+
+#include <Rtypes.h>
+#include <TROOT.h>
+#include <TChain.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RDFHelpers.hxx>
+#include "TRestRun.h"
+#include "REST_Axion_SlimOutput.h"
+#include "REST_Axion_ResultCache.h"
+
+//*******************************************************************************************************
+//*** Description: Parallel, cached building of the dataset of REST_DataSet.rml from many run files.
+//***
+//*** The run files matching the file pattern are selected by their run start and end times, as TRestDataSet
+//*** does: a file enters the dataset if its run starts after startTime and ends before endTime. Every selected
+//*** file is reduced on its own, with an RDataFrame over its AnalysisTree: the cuts are applied while reading
+//*** and only the selected observables are written to a cache file. The cache file is named after a hash
+//*** (ResultHasher, REST_Axion_ResultCache.h, stable across compilers) of the run file path, its size and
+//*** modification time, and of the observables and cuts, so on a re-run only new or modified run files are
+//*** processed, and a change of the observables or cuts rebuilds all of them. The start and end times of the runs
+//*** are kept in RunTimestamps.txt of the cache directory, by path, size and modification time, so the time
+//*** window only opens the TRestRun of the new or modified run files.
+//*** The run files without cache are reduced concurrently (ROOT::RDF::RunGraphs, with implicit
+//*** multi-threading), and the dataset is the merge of the cache files, written as the AnalysisTree of the
+//*** output file.
+//*** The friend trees of a run file, written next to it by the post-processing macros (the tree "importance" of
+//*** <run>_importance.root, RayTracing/REST_Axion_ImportanceSampledRayTracing.C, and the tree "packetOptics" of
+//*** <run>_optics.root, RayTracing/REST_Axion_WolterPacketTracing.C, by default), are added to its
+//*** AnalysisTree when present, so their columns, such as importance_weight, are observables of the dataset.
+//***
+//*** Usage:
+//***   DataSetBuilder builder;
+//***   builder.ReadDataSet("REST_DataSet.rml");       // filePattern, startTime, endTime, observables
+//***   builder.AddCut("optics_efficiency>0");
+//***   builder.Build("DataSet.root");
+//***
+//*** Dependencies:
+//*** ROOT RDataFrame. The run files are read through their AnalysisTree, the branches of the observables, and
+//*** `TRestRun::GetStartTimestamp`/`GetEndTimestamp` for the time window.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Files of the pattern, with wildcards * and ? in the file name, sorted
+inline std::vector<std::string> GetMatchingFiles(const std::string& filePattern) {
+    std::vector<std::string> files;
+    const std::filesystem::path pattern(filePattern);
+    const std::filesystem::path directory = pattern.has_parent_path() ? pattern.parent_path() : ".";
+    std::string expression;
+    for (const char c : pattern.filename().string()) {
+        if (c == '*')
+            expression += ".*";
+        else if (c == '?')
+            expression += ".";
+        else if (std::string("\\^$.|+()[]{}").find(c) != std::string::npos)
+            expression += std::string("\\") + c;
+        else
+            expression += c;
+    }
+    const std::regex match(expression);
+    if (!std::filesystem::is_directory(directory)) return files;
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+        if (entry.is_regular_file() && std::regex_match(entry.path().filename().string(), match)) files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+class DataSetBuilder {
+   private:
+    std::string fFilePattern;
+    std::vector<std::string> fObservables;
+    std::vector<std::string> fCuts;
+    // Time window of the runs in seconds since the epoch, 0 open
+    Double_t fStartTime = 0;
+    Double_t fEndTime = 0;
+    std::string fCacheDirectory = ".DataSetCache";
+    UInt_t fNumberOfThreads = 0;
+    // Suffix of the file name and name of the friend trees of every run file
+    std::vector<std::pair<std::string, std::string>> fFriends = {{"_importance", "importance"}, {"_optics", "packetOptics"}};
+
+    size_t fNumberOfFiles = 0;
+    size_t fNumberOfCachedFiles = 0;
+
+    // Start and end times of a run file, valid while its size and modification time are those of version
+    struct RunTimes {
+        std::string version;
+        Double_t start, end;
+    };
+
+    std::string GetTimestampFile() const { return (std::filesystem::path(fCacheDirectory) / "RunTimestamps.txt").string(); }
+
+    static std::string GetFileVersion(const std::string& file) {
+        std::ostringstream version;
+        version << std::filesystem::file_size(file) << "|" << std::filesystem::last_write_time(file).time_since_epoch().count();
+        return version.str();
+    }
+
+    // Times of the runs from the timestamp file of the cache, one "path version start end" line per run file
+    std::map<std::string, RunTimes> ReadTimestamps() const {
+        std::map<std::string, RunTimes> times;
+        std::ifstream file(GetTimestampFile());
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream entry(line);
+            std::string path;
+            RunTimes run;
+            if (std::getline(entry, path, '\t') && std::getline(entry, run.version, '\t') && entry >> run.start >> run.end)
+                times[path] = run;
+        }
+        return times;
+    }
+
+    void WriteTimestamps(const std::map<std::string, RunTimes>& times) const {
+        std::filesystem::create_directories(fCacheDirectory);
+        const std::string filename = GetTimestampFile();
+        {
+            std::ofstream file(filename + ".tmp");
+            file << std::setprecision(17);
+            for (const auto& [path, run] : times) file << path << "\t" << run.version << "\t" << run.start << " " << run.end << std::endl;
+        }
+        std::filesystem::rename(filename + ".tmp", filename);
+    }
+
+    // Run files of the pattern whose run lies inside the time window, as the file selection of TRestDataSet.
+    // Only the runs not in the timestamp file, or modified since, are opened
+    std::vector<std::string> GetFiles() const {
+        std::vector<std::string> files = GetMatchingFiles(fFilePattern);
+        if (fStartTime <= 0 && fEndTime <= 0) return files;
+        std::map<std::string, RunTimes> times = ReadTimestamps();
+        Bool_t updated = false;
+        std::vector<std::string> selected;
+        for (const auto& file : files) {
+            const std::string path = std::filesystem::absolute(file).string(), version = GetFileVersion(file);
+            auto it = times.find(path);
+            if (it == times.end() || it->second.version != version) {
+                TRestRun run(file);
+                it = times.insert_or_assign(path, RunTimes{version, run.GetStartTimestamp(), run.GetEndTimestamp()}).first;
+                updated = true;
+            }
+            if (fStartTime > 0 && it->second.start < fStartTime) continue;
+            if (fEndTime > 0 && it->second.end > fEndTime) continue;
+            selected.push_back(file);
+        }
+        if (updated) WriteTimestamps(times);
+        return selected;
+    }
+
+    std::string GetSelection() const {
+        std::string selection;
+        for (const auto& observable : fObservables) selection += observable + ",";
+        for (const auto& cut : fCuts) selection += "(" + cut + ")";
+        return selection;
+    }
+
+    // Friend file of a run file, next to it
+    static std::string GetFriendFile(const std::string& file, const std::string& suffix) {
+        const std::filesystem::path path(file);
+        return (path.parent_path() / (path.stem().string() + suffix + ".root")).string();
+    }
+
+    std::string GetCacheFile(const std::string& file) const {
+        const auto time = std::filesystem::last_write_time(file).time_since_epoch().count();
+        std::ostringstream key;
+        key << std::filesystem::absolute(file).string() << "|" << std::filesystem::file_size(file) << "|" << time << "|" << GetSelection();
+        for (const auto& entry : fFriends) {
+            const std::string friendFile = GetFriendFile(file, entry.first);
+            if (std::filesystem::exists(friendFile))
+                key << "|" << entry.second << "|" << std::filesystem::last_write_time(friendFile).time_since_epoch().count();
+        }
+        std::ostringstream name;
+        name << std::filesystem::path(file).stem().string() << "_" << std::hex << std::setw(16) << std::setfill('0')
+             << ResultHasher().Add(key.str()).GetHash() << ".root";
+        return (std::filesystem::path(fCacheDirectory) / name.str()).string();
+    }
+
+    std::string GetFilter() const {
+        std::string filter;
+        for (const auto& cut : fCuts) filter += (filter.empty() ? "(" : " && (") + cut + ")";
+        return filter;
+    }
+
+   public:
+    // Time as in the TRestDataSet parameters, "YYYY/MM/DD HH:MM", in UTC
+    static Double_t StringToTime(const std::string& text) {
+        std::tm time = {};
+        std::istringstream stream(text);
+        stream >> std::get_time(&time, "%Y/%m/%d %H:%M");
+        if (stream.fail()) {
+            std::cerr << "Warning: time " << text << " not understood" << std::endl;
+            return 0;
+        }
+        return timegm(&time);
+    }
+
+    // filePattern, startTime, endTime and observables of a TRestDataSet rml
+    Bool_t ReadDataSet(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error: Unable to open " << filename << std::endl;
+            return false;
+        }
+        std::stringstream content;
+        content << file.rdbuf();
+        const std::string text = content.str();
+        std::smatch match;
+        auto parameter = [&](const std::string& name) {
+            const std::regex entry("<parameter\\s+name\\s*=\\s*\"" + name + "\"\\s+value\\s*=\\s*\"\\s*([^\"]*?)\\s*\"");
+            return std::regex_search(text, match, entry) ? match[1].str() : std::string();
+        };
+        fFilePattern = parameter("filePattern");
+        const std::string start = parameter("startTime"), end = parameter("endTime");
+        fStartTime = start.empty() ? 0 : StringToTime(start);
+        fEndTime = end.empty() ? 0 : StringToTime(end);
+
+        fObservables = ReadDataSetObservables(filename);
+        return !fFilePattern.empty() && !fObservables.empty();
+    }
+
+    void SetFilePattern(const std::string& pattern) { fFilePattern = pattern; }
+    void SetObservables(const std::vector<std::string>& observables) { fObservables = observables; }
+    void SetTimeRange(Double_t start, Double_t end) {
+        fStartTime = start;
+        fEndTime = end;
+    }
+    // Cut expression on the observables, as the TRestCut conditions ("optics_efficiency>0")
+    void AddCut(const std::string& cut) { fCuts.push_back(cut); }
+    void SetCacheDirectory(const std::string& directory) { fCacheDirectory = directory; }
+    void SetNumberOfThreads(UInt_t n) { fNumberOfThreads = n; }
+    // Friend tree treeName of the file <run><suffix>.root of every run file
+    void AddFriend(const std::string& suffix, const std::string& treeName) { fFriends.push_back({suffix, treeName}); }
+
+    size_t GetNumberOfFiles() const { return fNumberOfFiles; }
+    // Files taken from the cache in the last build
+    size_t GetNumberOfCachedFiles() const { return fNumberOfCachedFiles; }
+
+    // Reduces the new run files and merges all of them into the AnalysisTree of outputFileName. Returns the
+    // number of entries of the dataset
+    ULong64_t Build(const std::string& outputFileName) {
+        const std::vector<std::string> files = GetFiles();
+        fNumberOfFiles = files.size();
+        fNumberOfCachedFiles = 0;
+        if (files.empty()) {
+            std::cerr << "Error: no run files match " << fFilePattern << std::endl;
+            return 0;
+        }
+        std::filesystem::create_directories(fCacheDirectory);
+        ROOT::EnableImplicitMT(fNumberOfThreads);
+
+        const std::string filter = GetFilter();
+        ROOT::RDF::RSnapshotOptions options;
+        options.fLazy = true;
+        std::vector<ROOT::RDF::RResultHandle> snapshots;
+        std::vector<std::unique_ptr<ROOT::RDataFrame>> frames;
+        std::vector<std::unique_ptr<TFile>> inputs;
+        std::vector<std::string> cacheFiles, newFiles;
+        for (const auto& file : files) {
+            const std::string cacheFile = GetCacheFile(file);
+            cacheFiles.push_back(cacheFile);
+            if (std::filesystem::exists(cacheFile)) {
+                fNumberOfCachedFiles++;
+                continue;
+            }
+            inputs.push_back(std::make_unique<TFile>(file.c_str()));
+            TTree* tree = inputs.back()->Get<TTree>("AnalysisTree");
+            if (tree == nullptr) {
+                std::cerr << "Error: no AnalysisTree in " << file << std::endl;
+                return 0;
+            }
+            for (const auto& entry : fFriends) {
+                const std::string friendFile = GetFriendFile(file, entry.first);
+                if (std::filesystem::exists(friendFile)) tree->AddFriend(entry.second.c_str(), friendFile.c_str());
+            }
+            frames.push_back(std::make_unique<ROOT::RDataFrame>(*tree));
+            ROOT::RDF::RNode node = *frames.back();
+            if (!filter.empty()) node = node.Filter(filter);
+            snapshots.push_back(node.Snapshot("AnalysisTree", cacheFile + ".tmp", fObservables, options));
+            newFiles.push_back(cacheFile);
+        }
+        ROOT::RDF::RunGraphs(snapshots);
+        // The cache files only appear once complete
+        for (const auto& cacheFile : newFiles) std::filesystem::rename(cacheFile + ".tmp", cacheFile);
+
+        TChain chain("AnalysisTree");
+        for (const auto& cacheFile : cacheFiles) chain.Add(cacheFile.c_str());
+        ROOT::RDataFrame dataset(chain);
+        auto entries = dataset.Count();
+        dataset.Snapshot("AnalysisTree", outputFileName, fObservables);
+        return *entries;
+    }
+
+    // Removes the cache files that do not belong to the current run files and selection
+    size_t PruneCache() const {
+        std::vector<std::string> keep = {GetTimestampFile()};
+        for (const auto& file : GetFiles()) keep.push_back(GetCacheFile(file));
+        size_t removed = 0;
+        if (!std::filesystem::is_directory(fCacheDirectory)) return removed;
+        for (const auto& entry : std::filesystem::directory_iterator(fCacheDirectory)) {
+            if (std::find(keep.begin(), keep.end(), entry.path().string()) != keep.end()) continue;
+            std::filesystem::remove(entry.path());
+            removed++;
+        }
+        return removed;
+    }
+};
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef REST_AXION_DENSITYSCAN_H
+#define REST_AXION_DENSITYSCAN_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+#include "TRestAxionBufferGas.h"
+#include "REST_Axion_FieldWorker.h"
+
+//*******************************************************************************************************
+//*** Description: Mass scan over a schedule of buffer-gas density steps, as the data taking of IAXO.
+//***
+//*** Only the gas depends on the density, and it does so in closed form: the photon mass is the plasma
+//*** frequency, mg^2 proportional to the electron density, and the absorption is linear in the density. The
+//*** buffer gas is therefore set once at a reference density, its photon mass and absorption are kept per
+//*** energy, and every step of the schedule scales them:
+//***   mg(rho) = mg(rho0) sqrt(rho / rho0),   Gamma(rho) = Gamma(rho0) rho / rho0.
+//*** The field along the track of the worker is sampled once for the whole schedule, and P(ma, rho) of all
+//*** the steps is evaluated in one batch: a single pass of CoherenceSumBatch for the standard integration, or
+//*** one GSL batch sharing the integration nodes of all the points.
+//***
+//*** Usage:
+//***   DensityScan scan(&worker, "He");
+//***   DensityScanMatrix P = scan.Scan(Ea, masses, densities, dL);
+//***   DensityScanMatrix P = scan.ScanOnResonance(Ea, densities, dL);  // masses mg(rho) of the steps
+//***   Double_t value = P(density, mass);
+//***
+//*** Dependencies:
+//*** `TRestAxionBufferGas::GetPhotonMass` and `TRestAxionBufferGas::GetPhotonAbsorptionLength`, evaluated only at
+//*** the reference density.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// P(ma, density) of a scan, one row per density step
+struct DensityScanMatrix {
+    std::vector<Double_t> densities;
+    std::vector<Double_t> masses;
+    std::vector<Double_t> values;
+    std::vector<Double_t> errors;
+
+    size_t GetNumberOfDensities() const { return densities.size(); }
+    size_t GetNumberOfMasses() const { return masses.size(); }
+
+    Double_t& operator()(size_t density, size_t mass) { return values[density * masses.size() + mass]; }
+    Double_t operator()(size_t density, size_t mass) const { return values[density * masses.size() + mass]; }
+
+    // Values (d, d) of a square matrix, the on-resonance probabilities of DensityScan::ScanOnResonance
+    std::vector<Double_t> GetDiagonal() const {
+        std::vector<Double_t> diagonal;
+        for (size_t d = 0; d < std::min(densities.size(), masses.size()); d++) diagonal.push_back((*this)(d, d));
+        return diagonal;
+    }
+
+    // Writes the matrix as a tab-separated table, one row per density and one column per mass
+    Bool_t Write(const std::string& filename) const {
+        std::ofstream outputFile(filename);
+        if (!outputFile.is_open()) {
+            std::cerr << "Error: Unable to open the file for writing!" << std::endl;
+            return false;
+        }
+        outputFile << "Density";
+        for (const auto& mass : masses) outputFile << "\t" << mass;
+        outputFile << "\n";
+        for (size_t d = 0; d < densities.size(); d++) {
+            outputFile << densities[d];
+            for (size_t m = 0; m < masses.size(); m++) outputFile << "\t" << (*this)(d, m);
+            outputFile << "\n";
+        }
+        return true;
+    }
+};
+
+class DensityScan {
+   private:
+    const FieldWorker* fWorker = nullptr;
+    std::string fGasName;
+    Double_t fReferenceDensity = 1e-10;
+    std::unique_ptr<TRestAxionBufferGas> fGas;
+
+    // Photon mass (eV) and absorption (mm-1) at the reference density, per energy
+    mutable std::map<Double_t, std::pair<Double_t, Double_t>> fReference;
+
+    const std::pair<Double_t, Double_t>& GetReference(Double_t Ea) const {
+        auto it = fReference.find(Ea);
+        if (it == fReference.end()) {
+            std::pair<Double_t, Double_t> values = {0, 0};
+            if (fGas) values = {fGas->GetPhotonMass(Ea), fGas->GetPhotonAbsorptionLength(Ea) / 10.};
+            it = fReference.emplace(Ea, values).first;
+        }
+        return it->second;
+    }
+
+    DensityScanMatrix Evaluate(const std::vector<ConversionPoint>& points, const std::vector<Double_t>& densities,
+                               const std::vector<Double_t>& masses, Double_t dL) const {
+        DensityScanMatrix matrix;
+        matrix.densities = densities;
+        matrix.masses = masses;
+        matrix.values.assign(points.size(), 0);
+        matrix.errors.assign(points.size(), 0);
+        if (fWorker->GetTrackLength() <= 0) return matrix;
+
+        if (dL > 0) {
+            matrix.values = fWorker->GammaTransmissionProbabilities(points, dL);
+        } else {
+            std::vector<std::pair<Double_t, Double_t>> probabilities = fWorker->GammaTransmissionFieldMapProbabilities(points);
+            for (size_t i = 0; i < points.size(); i++) {
+                matrix.values[i] = probabilities[i].first;
+                matrix.errors[i] = probabilities[i].second;
+            }
+        }
+        return matrix;
+    }
+
+   public:
+    // The track and the integration settings are those of the worker, its own buffer gas is not used
+    DensityScan(const FieldWorker* worker, const std::string& gasName, Double_t referenceDensity = 1e-10)
+        : fWorker(worker), fGasName(gasName) {
+        SetReferenceDensity(referenceDensity);
+    }
+
+    void SetReferenceDensity(Double_t density) {
+        fReferenceDensity = density;
+        fReference.clear();
+        fGas = nullptr;
+        if (fGasName.empty() || density <= 0) return;
+        fGas = std::make_unique<TRestAxionBufferGas>();
+        fGas->SetGasDensity(fGasName, density);
+    }
+
+    Double_t GetReferenceDensity() const { return fReferenceDensity; }
+
+    // Photon mass in eV at a density step
+    Double_t GetPhotonMass(Double_t Ea, Double_t density) const {
+        if (!fGas || density <= 0) return 0;
+        return GetReference(Ea).first * std::sqrt(density / fReferenceDensity);
+    }
+
+    // Photon absorption in mm-1 at a density step
+    Double_t GetPhotonAbsorption(Double_t Ea, Double_t density) const {
+        if (!fGas || density <= 0) return 0;
+        return GetReference(Ea).second * density / fReferenceDensity;
+    }
+
+    ConversionPoint GetConversionPoint(Double_t Ea, Double_t ma, Double_t density) const {
+        return {Ea, ma, GetPhotonMass(Ea, density), GetPhotonAbsorption(Ea, density)};
+    }
+
+    // P(ma, density) for every mass at every density of the schedule. dL > 0 uses the standard integration with
+    // the field sampled every dL (mm), 0 the GSL integration of the worker
+    DensityScanMatrix Scan(Double_t Ea, const std::vector<Double_t>& masses, const std::vector<Double_t>& densities, Double_t dL) const {
+        std::vector<ConversionPoint> points;
+        points.reserve(masses.size() * densities.size());
+        for (const auto& density : densities)
+            for (const auto& ma : masses) points.push_back(GetConversionPoint(Ea, ma, density));
+        return Evaluate(points, densities, masses, dL);
+    }
+
+    // P over the resonant masses mg(rho) of all the steps of the schedule, at every density. The diagonal
+    // (d, d) is the on-resonance probability of every step
+    DensityScanMatrix ScanOnResonance(Double_t Ea, const std::vector<Double_t>& densities, Double_t dL) const {
+        std::vector<Double_t> masses;
+        for (const auto& density : densities) masses.push_back(GetPhotonMass(Ea, density));
+        return Scan(Ea, masses, densities, dL);
+    }
+};
+
+#endif
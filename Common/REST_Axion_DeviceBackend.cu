@@ -0,0 +1,265 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <cuda_runtime.h>
+#include "REST_Axion_DeviceInterface.h"
+
+//*******************************************************************************************************
+//*** Description: CUDA backend of the batched standard integration (REST_Axion_DeviceBackend.h).
+//***
+//*** Every volume of the field map is a float4 3D texture of (Bx, By, Bz), read without filtering. The hardware
+//*** trilinear filter keeps only 8 fractional bits of the weights, so the interpolation is done here instead, as
+//*** BlockedFieldMap::Interpolate does: the cell and its fractions are found in double, clamped to the volume, and
+//*** the eight corner texels are weighted in float (or the nearest node is taken without interpolation). B_T
+//*** then agrees with the CPU interpolation of the same float values to float rounding.
+//***
+//*** One block evaluates one track for up to kThreads points: the threads sample B_T along the track into shared
+//*** memory, kChunk samples at a time, and then every thread accumulates the amplitude of its (q, Gamma) over the
+//*** chunk, in double, with the phasor recurrence of CoherenceSum reseeded exactly every kCoherenceReseed
+//*** samples. Points beyond kThreads use more blocks along y.
+//***
+//*** Build (HIP: hipify-perl first, then hipcc with the same options):
+//***   nvcc -O3 -shared -Xcompiler -fPIC -o libRestAxionDevice.so Common/REST_Axion_DeviceBackend.cu
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+namespace {
+
+constexpr int kThreads = 128;
+constexpr int kChunk = 1024;
+constexpr unsigned long long kCoherenceReseed = 64;
+// Largest number of probabilities of one launch, the tracks being split in batches above it
+constexpr size_t kMaxBatchResults = 1 << 24;
+
+#define REST_AXION_CUDA_CHECK(call)                                                                         \
+    do {                                                                                                    \
+        const cudaError_t status = (call);                                                                  \
+        if (status != cudaSuccess) {                                                                        \
+            std::cerr << "Error: " << #call << ": " << cudaGetErrorString(status) << std::endl;             \
+            return 1;                                                                                       \
+        }                                                                                                   \
+    } while (0)
+
+struct DeviceVolume {
+    double origin[3];
+    double spacing[3];
+    int n[3];
+    cudaTextureObject_t texture;
+};
+
+struct DeviceContext {
+    int device = 0;
+    int interpolation = 1;
+    std::vector<cudaArray_t> arrays;
+    std::vector<cudaTextureObject_t> textures;
+    DeviceVolume* volumes = nullptr;
+    int nVolumes = 0;
+};
+
+// Texel of the node (ix, iy, iz), the texel centres sitting at half-integer coordinates
+__device__ float4 Node(const DeviceVolume& volume, int ix, int iy, int iz) {
+    return tex3D<float4>(volume.texture, ix + 0.5f, iy + 0.5f, iz + 0.5f);
+}
+
+// B_T at a position, from the first volume containing it, 0 outside the field
+__device__ float TransversalField(const DeviceVolume* volumes, int nVolumes, int interpolation, double x, double y, double z, float ux,
+                                  float uy, float uz) {
+    for (int v = 0; v < nVolumes; v++) {
+        const DeviceVolume& volume = volumes[v];
+        const double local[3] = {x - volume.origin[0], y - volume.origin[1], z - volume.origin[2]};
+        int cell[3], next[3];
+        float fraction[3];
+        bool inside = true;
+        for (int a = 0; a < 3; a++) {
+            const int n = volume.n[a];
+            inside = inside && local[a] >= 0 && local[a] <= (n - 1) * volume.spacing[a];
+            // Cell and fraction of BlockedFieldMap::Cell
+            const double u = n > 1 ? fmin(fmax(local[a] / volume.spacing[a], 0.), (double)(n - 1)) : 0.;
+            cell[a] = n > 1 ? min((int)u, n - 2) : 0;
+            fraction[a] = n > 1 ? (float)(u - cell[a]) : 0.f;
+            next[a] = min(cell[a] + 1, n - 1);
+        }
+        if (!inside) continue;
+
+        float4 B;
+        if (!interpolation) {
+            B = Node(volume, cell[0] + (fraction[0] >= 0.5f), cell[1] + (fraction[1] >= 0.5f), cell[2] + (fraction[2] >= 0.5f));
+        } else {
+            const float fx = fraction[0], fy = fraction[1], fz = fraction[2], gx = 1 - fx, gy = 1 - fy, gz = 1 - fz;
+            const float4 B000 = Node(volume, cell[0], cell[1], cell[2]), B100 = Node(volume, next[0], cell[1], cell[2]);
+            const float4 B010 = Node(volume, cell[0], next[1], cell[2]), B110 = Node(volume, next[0], next[1], cell[2]);
+            const float4 B001 = Node(volume, cell[0], cell[1], next[2]), B101 = Node(volume, next[0], cell[1], next[2]);
+            const float4 B011 = Node(volume, cell[0], next[1], next[2]), B111 = Node(volume, next[0], next[1], next[2]);
+            const float w[8] = {gx * gy * gz, fx * gy * gz, gx * fy * gz, fx * fy * gz, gx * gy * fz, fx * gy * fz, gx * fy * fz, fx * fy * fz};
+            B.x = w[0] * B000.x + w[1] * B100.x + w[2] * B010.x + w[3] * B110.x + w[4] * B001.x + w[5] * B101.x + w[6] * B011.x + w[7] * B111.x;
+            B.y = w[0] * B000.y + w[1] * B100.y + w[2] * B010.y + w[3] * B110.y + w[4] * B001.y + w[5] * B101.y + w[6] * B011.y + w[7] * B111.y;
+            B.z = w[0] * B000.z + w[1] * B100.z + w[2] * B010.z + w[3] * B110.z + w[4] * B001.z + w[5] * B101.z + w[6] * B011.z + w[7] * B111.z;
+        }
+        const float cx = B.y * uz - B.z * uy, cy = B.z * ux - B.x * uz, cz = B.x * uy - B.y * ux;
+        return sqrtf(cx * cx + cy * cy + cz * cz);
+    }
+    return 0.f;
+}
+
+__global__ void CoherenceKernel(const DeviceVolume* volumes, int nVolumes, int interpolation, const DeviceTrackData* tracks,
+                                const DevicePointData* points, size_t nPoints, double dL, double* probabilities) {
+    __shared__ float field[kChunk];
+    const DeviceTrackData track = tracks[blockIdx.x];
+    const size_t p = (size_t)blockIdx.y * blockDim.x + threadIdx.x;
+    const bool active = p < nPoints;
+    const unsigned long long n = track.nSamples;
+    const double L = n > 0 ? (n - 1) * dL : 0;
+    const float ux = track.direction[0], uy = track.direction[1], uz = track.direction[2];
+
+    double q = 0, Gamma = 0, stepRe = 0, stepIm = 0;
+    if (active) {
+        q = points[p].q;
+        Gamma = points[p].Gamma;
+        const double growth = exp(Gamma * dL / 2.);
+        double s, c;
+        sincos(q * dL, &s, &c);
+        stepRe = growth * c;
+        stepIm = growth * s;
+    }
+
+    double re = 0, im = 0, zRe = 0, zIm = 0;
+    for (unsigned long long first = 0; first < n; first += kChunk) {
+        const int count = (int)min((unsigned long long)kChunk, n - first);
+        for (int i = threadIdx.x; i < count; i += blockDim.x) {
+            const double l = (first + i) * dL;
+            field[i] = TransversalField(volumes, nVolumes, interpolation, track.origin[0] + l * track.direction[0],
+                                        track.origin[1] + l * track.direction[1], track.origin[2] + l * track.direction[2], ux, uy, uz);
+        }
+        __syncthreads();
+        if (active) {
+            for (int i = 0; i < count; i++) {
+                const unsigned long long k = first + i;
+                if (k % kCoherenceReseed == 0) {
+                    const double damping = exp(-Gamma * (L - k * dL) / 2.);
+                    double s, c;
+                    sincos(q * k * dL, &s, &c);
+                    zRe = damping * c;
+                    zIm = damping * s;
+                }
+                re += field[i] * zRe;
+                im += field[i] * zIm;
+                const double nextRe = zRe * stepRe - zIm * stepIm;
+                zIm = zRe * stepIm + zIm * stepRe;
+                zRe = nextRe;
+            }
+        }
+        __syncthreads();
+    }
+    if (active) probabilities[blockIdx.x * nPoints + p] = dL * dL * (re * re + im * im);
+}
+
+int Upload(DeviceContext* context, const DeviceVolumeData* volumes, int nVolumes, int interpolation) {
+    REST_AXION_CUDA_CHECK(cudaSetDevice(context->device));
+    std::vector<DeviceVolume> deviceVolumes(nVolumes);
+    const cudaChannelFormatDesc channel = cudaCreateChannelDesc<float4>();
+    for (int v = 0; v < nVolumes; v++) {
+        const DeviceVolumeData& volume = volumes[v];
+        const cudaExtent extent = make_cudaExtent(volume.n[0], volume.n[1], volume.n[2]);
+        cudaArray_t array;
+        REST_AXION_CUDA_CHECK(cudaMalloc3DArray(&array, &channel, extent));
+        context->arrays.push_back(array);
+
+        cudaMemcpy3DParms copy = {};
+        copy.srcPtr = make_cudaPitchedPtr((void*)volume.B, volume.n[0] * sizeof(float4), volume.n[0], volume.n[1]);
+        copy.dstArray = array;
+        copy.extent = extent;
+        copy.kind = cudaMemcpyHostToDevice;
+        REST_AXION_CUDA_CHECK(cudaMemcpy3D(&copy));
+
+        cudaResourceDesc resource = {};
+        resource.resType = cudaResourceTypeArray;
+        resource.res.array.array = array;
+        cudaTextureDesc texture = {};
+        texture.addressMode[0] = texture.addressMode[1] = texture.addressMode[2] = cudaAddressModeClamp;
+        texture.filterMode = cudaFilterModePoint;
+        texture.readMode = cudaReadModeElementType;
+        texture.normalizedCoords = 0;
+        cudaTextureObject_t object;
+        REST_AXION_CUDA_CHECK(cudaCreateTextureObject(&object, &resource, &texture, nullptr));
+        context->textures.push_back(object);
+
+        std::copy(volume.origin, volume.origin + 3, deviceVolumes[v].origin);
+        std::copy(volume.spacing, volume.spacing + 3, deviceVolumes[v].spacing);
+        std::copy(volume.n, volume.n + 3, deviceVolumes[v].n);
+        deviceVolumes[v].texture = object;
+    }
+    REST_AXION_CUDA_CHECK(cudaMalloc(&context->volumes, nVolumes * sizeof(DeviceVolume)));
+    REST_AXION_CUDA_CHECK(cudaMemcpy(context->volumes, deviceVolumes.data(), nVolumes * sizeof(DeviceVolume), cudaMemcpyHostToDevice));
+    context->nVolumes = nVolumes;
+    context->interpolation = interpolation;
+    return 0;
+}
+
+}  // namespace
+
+extern "C" {
+
+int RestAxionDeviceCount() {
+    int count = 0;
+    if (cudaGetDeviceCount(&count) != cudaSuccess) return 0;
+    return count;
+}
+
+void* RestAxionDeviceCreate(const DeviceVolumeData* volumes, int nVolumes, int interpolation, int device) {
+    DeviceContext* context = new DeviceContext();
+    context->device = device;
+    if (nVolumes <= 0 || Upload(context, volumes, nVolumes, interpolation) != 0) {
+        RestAxionDeviceDestroy(context);
+        return nullptr;
+    }
+    return context;
+}
+
+int RestAxionDeviceEvaluate(void* handle, const DeviceTrackData* tracks, size_t nTracks, const DevicePointData* points, size_t nPoints,
+                            double dL, double* probabilities) {
+    DeviceContext* context = static_cast<DeviceContext*>(handle);
+    if (context == nullptr || nTracks == 0 || nPoints == 0) return context == nullptr;
+    REST_AXION_CUDA_CHECK(cudaSetDevice(context->device));
+
+    const size_t batch = std::max<size_t>(1, std::min<size_t>(nTracks, kMaxBatchResults / nPoints));
+    DeviceTrackData* deviceTracks = nullptr;
+    DevicePointData* devicePoints = nullptr;
+    double* deviceProbabilities = nullptr;
+    int status = 0;
+    // Every step of the evaluation, releasing the buffers on the first error
+    auto run = [&]() -> int {
+        REST_AXION_CUDA_CHECK(cudaMalloc(&deviceTracks, batch * sizeof(DeviceTrackData)));
+        REST_AXION_CUDA_CHECK(cudaMalloc(&devicePoints, nPoints * sizeof(DevicePointData)));
+        REST_AXION_CUDA_CHECK(cudaMalloc(&deviceProbabilities, batch * nPoints * sizeof(double)));
+        REST_AXION_CUDA_CHECK(cudaMemcpy(devicePoints, points, nPoints * sizeof(DevicePointData), cudaMemcpyHostToDevice));
+        for (size_t first = 0; first < nTracks; first += batch) {
+            const size_t count = std::min(batch, nTracks - first);
+            REST_AXION_CUDA_CHECK(cudaMemcpy(deviceTracks, tracks + first, count * sizeof(DeviceTrackData), cudaMemcpyHostToDevice));
+            const dim3 grid((unsigned int)count, (unsigned int)((nPoints + kThreads - 1) / kThreads));
+            CoherenceKernel<<<grid, kThreads>>>(context->volumes, context->nVolumes, context->interpolation, deviceTracks, devicePoints, nPoints,
+                                                dL, deviceProbabilities);
+            REST_AXION_CUDA_CHECK(cudaGetLastError());
+            REST_AXION_CUDA_CHECK(cudaMemcpy(probabilities + first * nPoints, deviceProbabilities, count * nPoints * sizeof(double),
+                                             cudaMemcpyDeviceToHost));
+        }
+        return 0;
+    };
+    status = run();
+    cudaFree(deviceTracks);
+    cudaFree(devicePoints);
+    cudaFree(deviceProbabilities);
+    return status;
+}
+
+void RestAxionDeviceDestroy(void* handle) {
+    DeviceContext* context = static_cast<DeviceContext*>(handle);
+    if (context == nullptr) return;
+    cudaSetDevice(context->device);
+    for (const auto& texture : context->textures) cudaDestroyTextureObject(texture);
+    for (const auto& array : context->arrays) cudaFreeArray(array);
+    cudaFree(context->volumes);
+    delete context;
+}
+}
@@ -0,0 +1,163 @@
+#ifndef REST_AXION_DEVICEBACKEND_H
+#define REST_AXION_DEVICEBACKEND_H
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include <Rtypes.h>
+#include <TVector3.h>
+#include "REST_Axion_FieldWorker.h"
+#include "REST_Axion_TrackSet.h"
+#include "REST_Axion_DeviceInterface.h"
+
+//*******************************************************************************************************
+//*** Description: Optional GPU offload of the batched standard integration of many (track, Ea, ma) points,
+//*** for the track grids and mass scans that are out of reach on the CPU.
+//***
+//*** A DeviceFieldMap uploads the volumes of a SharedFieldMap once, as 3D textures of the float values of the
+//*** blocked storage, and evaluates the probabilities of all the conversion points for all the tracks of a
+//*** TrackSet on the device: probabilities[t][p], as TrackSet::GammaTransmissionProbabilities. The field is
+//*** sampled every dL from the sample origin of every track of the TrackSet, and interpolated in the kernel
+//*** as the CPU blocked map does (REST_Axion_DeviceBackend.cu), not with the 8-bit weights of the hardware
+//*** filter. The result is not bitwise the one of the CPU batch path: the field values are floats and B_T is
+//*** interpolated in float, which bounds the relative difference by kDeviceTolerance, checked by
+//*** REST_Axion_AnalysisTracksTime.C against the CPU standard integration. The volumes are uploaded again
+//*** when the generation of the map changes.
+//***
+//*** The backend is only used when the macro is compiled with REST_AXION_WITH_CUDA and the library of the
+//*** backend is loaded; otherwise, or without a device, the same calls sample the TrackSet and integrate it
+//*** on the CPU threads, so the macros run unchanged on any node:
+//***   nvcc -O3 -shared -Xcompiler -fPIC -o libRestAxionDevice.so Common/REST_Axion_DeviceBackend.cu
+//***   root -l -e 'gSystem->Load("libRestAxionDevice.so"); gSystem->AddIncludePath("-DREST_AXION_WITH_CUDA");' macro.C+
+//***
+//*** Usage:
+//***   DeviceFieldMap device(&map);
+//***   std::vector<std::vector<Double_t>> probabilities = device.GammaTransmissionProbabilities(tracks, points, dL);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Largest relative difference of the device probabilities from the CPU standard integration on the same map
+constexpr Double_t kDeviceTolerance = 1e-4;
+
+class DeviceFieldMap {
+   private:
+    const SharedFieldMap* fMap = nullptr;
+    Int_t fDevice = 0;
+    // Context of the backend, null when the CPU path is used
+    void* fContext = nullptr;
+    size_t fGeneration = 0;
+    // Time of the last evaluation (ms), the upload excluded
+    Double_t fEvaluationTime = 0;
+
+    void Release() {
+#if defined(REST_AXION_WITH_CUDA)
+        if (fContext) RestAxionDeviceDestroy(fContext);
+#endif
+        fContext = nullptr;
+    }
+
+    // Uploads the volumes of the map, in the linear (Bx, By, Bz, 0) layout of the textures
+    void Upload() {
+        Release();
+        fGeneration = fMap->GetGeneration();
+#if defined(REST_AXION_WITH_CUDA)
+        if (RestAxionDeviceCount() <= fDevice) {
+            std::cerr << "Warning: no CUDA device " << fDevice << ", the probabilities are computed on the CPU" << std::endl;
+            return;
+        }
+        std::unique_ptr<BlockedFieldMap> sampled;
+        const BlockedFieldMap* blocked = fMap->GetBlockedStorage();
+        if (!blocked) {
+            sampled = std::make_unique<BlockedFieldMap>(fMap->GetField(), fMap->GetInterpolation());
+            blocked = sampled.get();
+        }
+        std::vector<std::vector<float>> values(blocked->GetNumberOfVolumes());
+        std::vector<DeviceVolumeData> volumes(blocked->GetNumberOfVolumes());
+        for (size_t v = 0; v < volumes.size(); v++) {
+            const BlockedVolume& volume = blocked->GetVolume(v);
+            values[v].resize(4 * (size_t)volume.nx * volume.ny * volume.nz);
+            float* B = values[v].data();
+            for (Int_t iz = 0; iz < volume.nz; iz++)
+                for (Int_t iy = 0; iy < volume.ny; iy++)
+                    for (Int_t ix = 0; ix < volume.nx; ix++, B += 4) {
+                        const size_t index = volume.NodeIndex(ix, iy, iz);
+                        B[0] = volume.Bx[index];
+                        B[1] = volume.By[index];
+                        B[2] = volume.Bz[index];
+                        B[3] = 0;
+                    }
+            volumes[v] = {{volume.origin.X(), volume.origin.Y(), volume.origin.Z()},
+                          {volume.spacing.X(), volume.spacing.Y(), volume.spacing.Z()},
+                          {volume.nx, volume.ny, volume.nz},
+                          values[v].data()};
+        }
+        fContext = RestAxionDeviceCreate(volumes.data(), volumes.size(), blocked->GetInterpolation(), fDevice);
+        if (!fContext) std::cerr << "Warning: the field map cannot be uploaded to the device, the probabilities are computed on the CPU" << std::endl;
+#endif
+    }
+
+   public:
+    explicit DeviceFieldMap(const SharedFieldMap* map, Int_t device = 0) : fMap(map), fDevice(device) { Upload(); }
+    ~DeviceFieldMap() { Release(); }
+
+    DeviceFieldMap(const DeviceFieldMap&) = delete;
+    DeviceFieldMap& operator=(const DeviceFieldMap&) = delete;
+
+    static Int_t GetNumberOfDevices() {
+#if defined(REST_AXION_WITH_CUDA)
+        return RestAxionDeviceCount();
+#else
+        return 0;
+#endif
+    }
+
+    // Whether the probabilities are computed on the device
+    Bool_t IsAvailable() const { return fContext != nullptr; }
+    Double_t GetEvaluationTime() const { return fEvaluationTime; }
+
+    // Standard integration of every conversion point over every track, sampled every dL (mm). The CPU path
+    // samples the tracks first if they are not sampled every dL for the current field
+    std::vector<std::vector<Double_t>> GammaTransmissionProbabilities(TrackSet& tracks, const std::vector<ConversionPoint>& points, Double_t dL,
+                                                                       UInt_t nThreads = 1) {
+        if (fGeneration != fMap->GetGeneration()) Upload();
+        const auto start_time = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<Double_t>> probabilities;
+        Bool_t evaluated = false;
+#if defined(REST_AXION_WITH_CUDA)
+        if (IsAvailable()) {
+            std::vector<DeviceTrackData> deviceTracks(tracks.GetNumberOfTracks());
+            for (size_t t = 0; t < deviceTracks.size(); t++) {
+                const TVector3& origin = tracks.GetSampleOrigin(t);
+                const TVector3& direction = tracks.GetDirection(t);
+                deviceTracks[t] = {{origin.X(), origin.Y(), origin.Z()},
+                                   {direction.X(), direction.Y(), direction.Z()},
+                                   tracks.GetNumberOfSamples(t, dL)};
+            }
+            std::vector<DevicePointData> devicePoints;
+            for (const auto& point : points) devicePoints.push_back({MomentumTransfer(point.Ea, point.ma, point.mg), point.Gamma});
+
+            std::vector<Double_t> values(deviceTracks.size() * points.size(), 0);
+            evaluated = RestAxionDeviceEvaluate(fContext, deviceTracks.data(), deviceTracks.size(), devicePoints.data(), devicePoints.size(),
+                                                dL, values.data()) == 0;
+            if (evaluated) {
+                probabilities.assign(deviceTracks.size(), std::vector<Double_t>(points.size(), 0));
+                for (size_t t = 0; t < deviceTracks.size(); t++)
+                    for (size_t p = 0; p < points.size(); p++) probabilities[t][p] = fMap->GetBLFactor() * values[t * points.size() + p];
+            } else {
+                std::cerr << "Warning: the evaluation on the device failed, the probabilities are computed on the CPU" << std::endl;
+            }
+        }
+#endif
+        if (!evaluated) {
+            if (!tracks.IsSampled() || tracks.GetStep() != dL) tracks.Sample(dL, nThreads);
+            probabilities = tracks.GammaTransmissionProbabilities(points, nThreads);
+        }
+        fEvaluationTime = std::chrono::duration<Double_t, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+        return probabilities;
+    }
+};
+
+#endif
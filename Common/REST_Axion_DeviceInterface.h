@@ -0,0 +1,51 @@
+#ifndef REST_AXION_DEVICEINTERFACE_H
+#define REST_AXION_DEVICEINTERFACE_H
+
+#include <cstddef>
+
+//*******************************************************************************************************
+//*** Description: Plain-data interface between the macros and the CUDA backend (REST_Axion_DeviceBackend.cu),
+//*** kept free of ROOT so that nvcc compiles the backend without the ROOT headers. Only
+//*** REST_Axion_DeviceBackend.h uses it directly.
+//***
+//*** A context owns the field volumes uploaded as 3D textures on one device. RestAxionDeviceEvaluate computes,
+//*** for every track t and every point p, dL^2 |sum_i B_T(origin + i dL direction) exp(-Gamma (L - l_i) / 2)
+//*** exp(i q l_i)|^2 into probabilities[t * nPoints + p], the standard integration of REST_Axion_CoherenceKernel.h
+//*** without the (g B L / 2)^2 factor. The functions return 0 on success, and print the CUDA error otherwise.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// One volume of the field map, its node (ix, iy, iz) at origin + (ix, iy, iz) * spacing. B holds the
+// (Bx, By, Bz, 0) of every node, x fastest, in T
+struct DeviceVolumeData {
+    double origin[3];
+    double spacing[3];
+    int n[3];
+    const float* B;
+};
+
+// Track from its first sample (its entry into the field, or its start point) along its unit direction, sampled
+// nSamples times
+struct DeviceTrackData {
+    double origin[3];
+    double direction[3];
+    unsigned long long nSamples;
+};
+
+// Momentum transfer q and photon absorption Gamma, in mm-1
+struct DevicePointData {
+    double q;
+    double Gamma;
+};
+
+extern "C" {
+int RestAxionDeviceCount();
+// Null if the volumes cannot be uploaded to the device
+void* RestAxionDeviceCreate(const DeviceVolumeData* volumes, int nVolumes, int interpolation, int device);
+int RestAxionDeviceEvaluate(void* context, const DeviceTrackData* tracks, size_t nTracks, const DevicePointData* points, size_t nPoints,
+                            double dL, double* probabilities);
+void RestAxionDeviceDestroy(void* context);
+}
+
+#endif
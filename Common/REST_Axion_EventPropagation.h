@@ -0,0 +1,227 @@
+#ifndef REST_AXION_EVENTPROPAGATION_H
+#define REST_AXION_EVENTPROPAGATION_H
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+#include <TVector3.h>
+#include "REST_Axion_ThreadPool.h"
+#include "REST_Axion_FieldWorker.h"
+#include "REST_Axion_ProbabilityTable.h"
+#include "REST_Axion_GeometricAcceptance.h"
+
+//*******************************************************************************************************
+//*** Description: Batched propagation of ray-tracing axion events through a field map, the stage done
+//*** event by event by `TRestAxionFieldPropagationProcess` in RayTracing_BabyIAXO.rml.
+//***
+//*** The events are grouped in batches of batchSize. Within a batch they are ordered by the cell of their
+//*** entrance position (x, y), since the tracks run almost parallel to z and neighbouring entrances query the
+//*** same bricks of the map, and the batch is evaluated on a pool of threads with one FieldWorker per thread
+//*** on the same SharedFieldMap. The result of an event only depends on its own track, energy and mass, and the
+//*** results are returned in the order of the input, so the output is the same as the per-event processing
+//*** for any batch size and number of threads.
+//***
+//*** The probability is the standard integration of B_T sampled every integrationStep (mm) from the entrance to
+//*** the exit of the field, or the GSL integration with the settings of the propagation if integrationStep is 0.
+//*** As bufferGasAdditionalLength in the process, SetBufferGasAdditionalLength attenuates the probability by the
+//*** transmission exp(-Gamma length) of the photon through that length of buffer gas after the field.
+//*** With SetProbabilityTable the events inside the table are interpolated instead. With SetAcceptance the
+//*** events whose straight trajectory misses the bore mask or the optics (REST_Axion_GeometricAcceptance.h) are
+//*** not integrated: they are marked as skipped, with probability 0, as their weight is zero anyway.
+//*** With REST_AXION_INSTRUMENTATION every result carries the field evaluations and GSL subintervals of its event.
+//***
+//*** Usage:
+//***   EventPropagation propagation(map, "He", 2.9836e-10);
+//***   propagation.SetIntegrationStep(50);
+//***   std::vector<PropagationResult> results = propagation.Propagate(events);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Axion of a ray-tracing event: position and direction (mm), energy (keV) and mass (eV)
+struct PropagationEvent {
+    TVector3 position;
+    TVector3 direction = TVector3(0, 0, 1);
+    Double_t Ea = 4.2;
+    Double_t ma = 0;
+};
+
+struct PropagationResult {
+    Double_t probability = 0;
+    Double_t error = 0;
+    // Mean B_T (T) and length (mm) of the track inside the field
+    Double_t fieldAverage = 0;
+    Double_t length = 0;
+    // True if the probability was interpolated from the probability table, without the field values
+    Bool_t interpolated = false;
+    // True if the event has zero geometric acceptance and the probability was not computed
+    Bool_t skipped = false;
+    // Cost of the event with REST_AXION_INSTRUMENTATION (REST_Axion_Instrumentation.h), 0 otherwise
+    UInt_t fieldEvaluations = 0;
+    UInt_t gslSubintervals = 0;
+};
+
+class EventPropagation {
+   private:
+    std::shared_ptr<SharedFieldMap> fMap;
+    std::string fGasName;
+    Double_t fGasDensity = 0;
+
+    Double_t fIntegrationStep = 50;
+    IntegrationSettings fSettings;
+    size_t fBatchSize = 10000;
+    UInt_t fNumberOfThreads = 0;
+    // Size (mm) of the entrance cells used to order the events of a batch
+    Double_t fCellSize = 10;
+    // Buffer gas crossed by the photon after the field (mm), bufferGasAdditionalLength of the process
+    Double_t fBufferGasAdditionalLength = 0;
+    // Step (keV) of the opt-in buffer gas table of the workers between 0.1 and 20 keV, 0 queries the gas at every
+    // event (TRestAxionBufferGas)
+    Double_t fGasTableStep = 0;
+
+    // Optional lookup table, used for the events inside it
+    const ProbabilityTable* fTable = nullptr;
+
+    // Optional geometric pre-check, the events rejected by it are skipped
+    const GeometricAcceptance* fAcceptance = nullptr;
+
+    std::vector<std::unique_ptr<FieldWorker>> fWorkers;
+
+    void BuildWorkers(UInt_t nThreads) {
+        if (fWorkers.size() >= nThreads) return;
+        while (fWorkers.size() < nThreads) {
+            auto worker = std::make_unique<FieldWorker>(fMap.get());
+            worker->SetBufferGasTable(0.1, 20, fGasTableStep);
+            worker->SetBufferGas(fGasName, fGasDensity);
+            fWorkers.push_back(std::move(worker));
+        }
+    }
+
+    PropagationResult IntegrateEvent(FieldWorker& worker, const PropagationEvent& event) const {
+        PropagationResult result;
+        if (fAcceptance != nullptr && !fAcceptance->IsAccepted(event.position, event.direction)) {
+            result.skipped = true;
+            return result;
+        }
+        if (fTable != nullptr && fTable->IsInside(event.position, event.direction, event.Ea, event.ma)) {
+            result.probability = fTable->GetProbability(event.position, event.direction, event.Ea);
+            result.interpolated = true;
+            return result;
+        }
+
+        worker.SetTrack(event.position, event.direction);
+        result.length = worker.GetTrackLength();
+        if (result.length <= 0) return result;
+
+        if (fIntegrationStep > 0) {
+            const std::vector<Double_t> values = worker.GetTransversalComponentAlongTrack(fIntegrationStep);
+            if (values.empty()) return result;
+            result.fieldAverage = std::accumulate(values.begin(), values.end(), 0.) / values.size();
+            result.probability = worker.GammaTransmissionProbability(values, fIntegrationStep, event.Ea, event.ma);
+        } else {
+            worker.SetIntegrationSettings(fSettings);
+            const std::pair<Double_t, Double_t> probability = worker.GammaTransmissionFieldMapProbability(event.Ea, event.ma);
+            result.probability = probability.first;
+            result.error = probability.second;
+        }
+        return result;
+    }
+
+    // Transmission of the photon through the additional length of buffer gas
+    void Attenuate(FieldWorker& worker, const PropagationEvent& event, PropagationResult& result) const {
+        if (fBufferGasAdditionalLength <= 0 || result.skipped || result.probability == 0) return;
+        const Double_t transmission = std::exp(-worker.GetPhotonAbsorption(event.Ea) * fBufferGasAdditionalLength);
+        result.probability *= transmission;
+        result.error *= transmission;
+    }
+
+    PropagationResult PropagateEvent(FieldWorker& worker, const PropagationEvent& event) const {
+#if defined(REST_AXION_INSTRUMENTATION)
+        const InstrumentationCounters before = Instrumentation::Local();
+        PropagationResult result = IntegrateEvent(worker, event);
+        Attenuate(worker, event, result);
+        const InstrumentationCounters cost = Instrumentation::Local() - before;
+        result.fieldEvaluations = cost.GetFieldEvaluations();
+        result.gslSubintervals = cost.gslSubintervals;
+        return result;
+#else
+        PropagationResult result = IntegrateEvent(worker, event);
+        Attenuate(worker, event, result);
+        return result;
+#endif
+    }
+
+   public:
+    EventPropagation(std::shared_ptr<SharedFieldMap> map, const std::string& gasName = "", Double_t gasDensity = 0)
+        : fMap(std::move(map)), fGasName(gasName), fGasDensity(gasDensity) {}
+
+    // Step of the standard integration in mm, 0 uses the GSL integration
+    void SetIntegrationStep(Double_t step) { fIntegrationStep = step; }
+    void SetIntegrationSettings(const IntegrationSettings& settings) { fSettings = settings; }
+    void SetBatchSize(size_t batchSize) { fBatchSize = std::max<size_t>(1, batchSize); }
+    void SetNumberOfThreads(UInt_t nThreads) { fNumberOfThreads = nThreads; }
+    void SetCellSize(Double_t cellSize) { fCellSize = cellSize; }
+    // Length (mm) of buffer gas after the field, 0 disables the attenuation
+    void SetBufferGasAdditionalLength(Double_t length) { fBufferGasAdditionalLength = length; }
+    // Must be set before the first propagation
+    void SetBufferGasTableStep(Double_t step) { fGasTableStep = step; }
+    // Interpolates the events inside the table (REST_Axion_ProbabilityTable.h) instead of integrating them,
+    // null disables it
+    void SetProbabilityTable(const ProbabilityTable* table) { fTable = table; }
+    // Skips the integral of the events rejected by the acceptance, null disables it
+    void SetAcceptance(const GeometricAcceptance* acceptance) { fAcceptance = acceptance; }
+
+    Double_t GetIntegrationStep() const { return fIntegrationStep; }
+    Double_t GetBufferGasAdditionalLength() const { return fBufferGasAdditionalLength; }
+    size_t GetBatchSize() const { return fBatchSize; }
+    const SharedFieldMap* GetMap() const { return fMap.get(); }
+
+    // Order of evaluation of the events [first, last): by entrance cell in y, then in x, then by index
+    std::vector<size_t> GetBatchOrder(const std::vector<PropagationEvent>& events, size_t first, size_t last) const {
+        std::vector<size_t> order(last - first);
+        std::iota(order.begin(), order.end(), first);
+        auto cell = [&](size_t i, Int_t axis) { return (Long64_t)std::floor(events[i].position[axis] / fCellSize); };
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            const Long64_t ya = cell(a, 1), yb = cell(b, 1);
+            if (ya != yb) return ya < yb;
+            const Long64_t xa = cell(a, 0), xb = cell(b, 0);
+            if (xa != xb) return xa < xb;
+            return a < b;
+        });
+        return order;
+    }
+
+    // Propagates all the events, the results are in the order of the events
+    std::vector<PropagationResult> Propagate(const std::vector<PropagationEvent>& events) {
+        std::vector<PropagationResult> results(events.size());
+        if (events.empty()) return results;
+
+        const UInt_t nThreads = GetNumberOfThreads(fNumberOfThreads, std::min(fBatchSize, events.size()));
+        BuildWorkers(nThreads);
+
+        for (size_t first = 0; first < events.size(); first += fBatchSize) {
+            const size_t last = std::min(first + fBatchSize, events.size());
+            const std::vector<size_t> order = GetBatchOrder(events, first, last);
+            ParallelFor(order.size(), nThreads, [&](size_t k, UInt_t w) {
+                const size_t i = order[k];
+                results[i] = PropagateEvent(*fWorkers[w], events[i]);
+            });
+        }
+        return results;
+    }
+
+    // Per-event reference, evaluated serially in the order of the events
+    std::vector<PropagationResult> PropagateSerial(const std::vector<PropagationEvent>& events) {
+        BuildWorkers(1);
+        std::vector<PropagationResult> results;
+        results.reserve(events.size());
+        for (const auto& event : events) results.push_back(PropagateEvent(*fWorkers[0], event));
+        return results;
+    }
+};
+
+#endif
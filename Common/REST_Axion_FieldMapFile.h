@@ -0,0 +1,241 @@
+#ifndef REST_AXION_FIELDMAPFILE_H
+#define REST_AXION_FIELDMAPFILE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "REST_Axion_BlockedFieldMap.h"
+
+//*******************************************************************************************************
+//*** Description: Preprocessed binary format of the field maps, so that short jobs do not parse the text
+//*** maps of fields.rml at startup.
+//***
+//*** A file holds the blocked float32 volumes of a BlockedFieldMap (REST_Axion_BlockedFieldMap.h):
+//*** - FieldMapFileHeader: magic, format version, byte order mark, field name, interpolation flag, brick
+//***   dimensions in cells, number of volumes and total file size.
+//*** - One FieldMapFileVolume per volume: origin, mesh size, number of nodes and offset of its data.
+//*** - The Bx, By, Bz arrays of every volume, brick ordered with the halo, each one starting on a page boundary.
+//***
+//*** MappedFieldMap maps the file read-only with MAP_SHARED, and its BlockedFieldMap reads the values
+//*** directly from the mapping: nothing is copied, and all the processes of a node using the same file share
+//*** the same pages of the page cache. The files are written with `MagneticField/REST_Axion_ExportFieldMap.C`
+//*** (POSIX only).
+//***
+//*** Usage:
+//***   WriteFieldMapFile(BlockedFieldMap(&field), "babyIAXO_2024_cutoff", "babyIAXO_2024_cutoff.axmap");
+//***   MappedFieldMap mapped;
+//***   if (mapped.Open("babyIAXO_2024_cutoff.axmap")) Bt = mapped.GetMap()->GetTransversalComponent(pos, dir);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+constexpr char kFieldMapFileMagic[8] = {'R', 'E', 'S', 'T', 'A', 'X', 'M', 'P'};
+// Version 2 stores the bricks with their one-node halo
+constexpr uint32_t kFieldMapFileVersion = 2;
+constexpr uint32_t kFieldMapFileByteOrder = 0x01020304;
+constexpr uint64_t kFieldMapFilePage = 4096;
+
+struct FieldMapFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    char fieldName[64];
+    uint32_t interpolation;
+    uint32_t brick[3];
+    uint32_t nVolumes;
+    uint32_t reserved;
+    uint64_t fileSize;
+};
+
+struct FieldMapFileVolume {
+    double origin[3];
+    double spacing[3];
+    int32_t nodes[3];
+    int32_t reserved;
+    // Offset of Bx from the start of the file, By and Bz follow at multiples of the padded component size
+    uint64_t offset;
+    // Floats per component, and the padded size in bytes of each component
+    uint64_t nValues;
+    uint64_t componentSize;
+};
+
+inline uint64_t FieldMapFilePad(uint64_t size) { return (size + kFieldMapFilePage - 1) / kFieldMapFilePage * kFieldMapFilePage; }
+
+// Writes the volumes of the map, returns false if the file cannot be written
+inline Bool_t WriteFieldMapFile(const BlockedFieldMap& map, const std::string& fieldName, const std::string& filename) {
+    FieldMapFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kFieldMapFileMagic, sizeof(header.magic));
+    header.version = kFieldMapFileVersion;
+    header.byteOrder = kFieldMapFileByteOrder;
+    std::strncpy(header.fieldName, fieldName.c_str(), sizeof(header.fieldName) - 1);
+    header.interpolation = map.GetInterpolation();
+    header.brick[0] = kBrickX;
+    header.brick[1] = kBrickY;
+    header.brick[2] = kBrickZ;
+    header.nVolumes = map.GetNumberOfVolumes();
+
+    std::vector<FieldMapFileVolume> volumes(map.GetNumberOfVolumes());
+    uint64_t offset = FieldMapFilePad(sizeof(FieldMapFileHeader) + volumes.size() * sizeof(FieldMapFileVolume));
+    for (size_t n = 0; n < volumes.size(); n++) {
+        const BlockedVolume& volume = map.GetVolume(n);
+        FieldMapFileVolume& entry = volumes[n];
+        std::memset(&entry, 0, sizeof(entry));
+        for (Int_t axis = 0; axis < 3; axis++) {
+            entry.origin[axis] = volume.origin[axis];
+            entry.spacing[axis] = volume.spacing[axis];
+        }
+        entry.nodes[0] = volume.nx;
+        entry.nodes[1] = volume.ny;
+        entry.nodes[2] = volume.nz;
+        entry.offset = offset;
+        entry.nValues = volume.GetNumberOfBricks() * kBrickSize;
+        entry.componentSize = FieldMapFilePad(entry.nValues * sizeof(float));
+        offset += 3 * entry.componentSize;
+    }
+    header.fileSize = offset;
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: unable to write the field map file " << filename << std::endl;
+        return false;
+    }
+
+    const std::vector<char> padding(kFieldMapFilePage, 0);
+    auto padTo = [&](uint64_t position) {
+        const uint64_t current = file.tellp();
+        if (position > current) file.write(padding.data(), position - current);
+    };
+
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)volumes.data(), volumes.size() * sizeof(FieldMapFileVolume));
+    for (size_t n = 0; n < volumes.size(); n++) {
+        const BlockedVolume& volume = map.GetVolume(n);
+        const float* components[3] = {volume.Bx, volume.By, volume.Bz};
+        for (Int_t c = 0; c < 3; c++) {
+            padTo(volumes[n].offset + c * volumes[n].componentSize);
+            file.write((const char*)components[c], volumes[n].nValues * sizeof(float));
+        }
+    }
+    padTo(header.fileSize);
+
+    return file.good();
+}
+
+// Read-only shared mapping of a field map file
+class MappedFieldMap {
+   private:
+    void* fData = nullptr;
+    size_t fSize = 0;
+    std::string fFieldName;
+    BlockedFieldMap fMap;
+
+    void Close() {
+        if (fData != nullptr) munmap(fData, fSize);
+        fData = nullptr;
+        fSize = 0;
+        fMap = BlockedFieldMap();
+    }
+
+   public:
+    MappedFieldMap() = default;
+    MappedFieldMap(const MappedFieldMap&) = delete;
+    MappedFieldMap& operator=(const MappedFieldMap&) = delete;
+    ~MappedFieldMap() { Close(); }
+
+    // Maps the file and checks its header, returns false if it is missing, truncated or of another version, or
+    // if its layout does not match its grids: every volume has to hold exactly the bricks of its nodes, at the
+    // offsets WriteFieldMapFile gives them, and the file has to end after the last one
+    Bool_t Open(const std::string& filename) {
+        Close();
+
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error: unable to open the field map file " << filename << std::endl;
+            return false;
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(FieldMapFileHeader)) {
+            std::cerr << "Error: " << filename << " is not a field map file" << std::endl;
+            close(fd);
+            return false;
+        }
+        fSize = status.st_size;
+        fData = mmap(nullptr, fSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (fData == MAP_FAILED) {
+            fData = nullptr;
+            std::cerr << "Error: unable to map the field map file " << filename << std::endl;
+            return false;
+        }
+
+        const char* data = (const char*)fData;
+        const FieldMapFileHeader* header = (const FieldMapFileHeader*)data;
+        if (std::memcmp(header->magic, kFieldMapFileMagic, sizeof(header->magic)) != 0 || header->byteOrder != kFieldMapFileByteOrder ||
+            header->version != kFieldMapFileVersion || header->brick[0] != kBrickX || header->brick[1] != kBrickY ||
+            header->brick[2] != kBrickZ || header->fileSize != fSize ||
+            sizeof(FieldMapFileHeader) + header->nVolumes * sizeof(FieldMapFileVolume) > fSize) {
+            std::cerr << "Error: " << filename << " is not a field map file of version " << kFieldMapFileVersion
+                      << ", export it again with REST_Axion_ExportFieldMap.C" << std::endl;
+            Close();
+            return false;
+        }
+
+        fFieldName = std::string(header->fieldName, strnlen(header->fieldName, sizeof(header->fieldName)));
+        fMap.SetInterpolation(header->interpolation);
+
+        const FieldMapFileVolume* volumes = (const FieldMapFileVolume*)(data + sizeof(FieldMapFileHeader));
+        uint64_t offset = FieldMapFilePad(sizeof(FieldMapFileHeader) + header->nVolumes * sizeof(FieldMapFileVolume));
+        for (uint32_t n = 0; n < header->nVolumes; n++) {
+            const FieldMapFileVolume& entry = volumes[n];
+            if (entry.nodes[0] <= 0 || entry.nodes[1] <= 0 || entry.nodes[2] <= 0) {
+                std::cerr << "Error: volume " << n << " of " << filename << " has no nodes" << std::endl;
+                Close();
+                return false;
+            }
+            const uint64_t nValues = GetNumberOfBlockedValues(entry.nodes[0], entry.nodes[1], entry.nodes[2]);
+            if (entry.nValues != nValues || entry.componentSize != FieldMapFilePad(nValues * sizeof(float)) || entry.offset != offset) {
+                std::cerr << "Error: volume " << n << " of " << filename << " holds " << entry.nValues << " values, its grid of " << entry.nodes[0]
+                          << "x" << entry.nodes[1] << "x" << entry.nodes[2] << " nodes needs " << nValues << std::endl;
+                Close();
+                return false;
+            }
+            offset += 3 * entry.componentSize;
+            if (offset > fSize) {
+                std::cerr << "Error: " << filename << " is truncated" << std::endl;
+                Close();
+                return false;
+            }
+            const float* Bx = (const float*)(data + entry.offset);
+            const float* By = (const float*)(data + entry.offset + entry.componentSize);
+            const float* Bz = (const float*)(data + entry.offset + 2 * entry.componentSize);
+            fMap.AddVolume(TVector3(entry.origin[0], entry.origin[1], entry.origin[2]),
+                           TVector3(entry.spacing[0], entry.spacing[1], entry.spacing[2]), entry.nodes[0], entry.nodes[1], entry.nodes[2],
+                           Bx, By, Bz);
+        }
+        if (offset != fSize) {
+            std::cerr << "Error: " << filename << " has " << fSize << " bytes, its volumes take " << offset << std::endl;
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    Bool_t IsOpen() const { return fData != nullptr; }
+    const std::string& GetFieldName() const { return fFieldName; }
+    size_t GetFileSize() const { return fSize; }
+
+    BlockedFieldMap* GetMap() { return &fMap; }
+    const BlockedFieldMap* GetMap() const { return &fMap; }
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef REST_AXION_FIELDPYRAMID_H
+#define REST_AXION_FIELDPYRAMID_H
+
+#include <iostream>
+#include <vector>
+#include <array>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+
+#include <TVector3.h>
+#include "REST_Axion_BlockedFieldMap.h"
+
+//*******************************************************************************************************
+//*** Description: Multi-resolution representation of a field map, in the style of a mipmap pyramid.
+//***
+//*** Level 0 is the finest BlockedFieldMap (REST_Axion_BlockedFieldMap.h). Every coarser level is generated
+//*** once from it by keeping one node out of (fx, fy, fz) along each axis, the integer decimation factors that
+//*** turn the native mesh of every volume into the requested mesh size, so a level is the same grid that
+//*** `ReMap` produces, without loading the map again. When the number of cells is not a multiple of the factor,
+//*** the last nodes of the finest level are dropped from the coarse level, and the finest level is used there.
+//***
+//*** For every level, an error map stores per coarse cell the maximum |B_level - B_finest| (T) over the finest
+//*** nodes of the cell. SelectLevel picks the coarsest level whose error at a position is within a tolerance,
+//*** so a track can be evaluated coarse in the fringe and fine in the bore. The error maps are computed again
+//*** when the interpolation changes (SetInterpolation).
+//***
+//*** Usage:
+//***   FieldPyramid pyramid(&blocked);
+//***   Int_t level = pyramid.AddLevel(TVector3(30, 30, 150));
+//***   TVector3 B = pyramid.GetMagneticField(position, level);        // fixed level
+//***   TVector3 B = pyramid.GetAdaptiveMagneticField(position, 1e-3); // coarsest level within 1 mT
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+class FieldPyramid {
+   private:
+    struct Level {
+        // Decimation factors of every volume, level 0 has all of them 1
+        std::vector<std::array<Int_t, 3>> factors;
+        // Maximum deviation from the finest level per cell of every volume, empty for level 0
+        std::vector<std::vector<float>> errors;
+        const BlockedFieldMap* map = nullptr;
+        std::unique_ptr<BlockedFieldMap> storage;
+        // Finest nodes per coarse node of the first volume, used to order the levels
+        Int_t coarseness = 1;
+    };
+
+    std::vector<Level> fLevels;
+
+    static size_t CellIndex(const BlockedVolume& volume, Int_t cx, Int_t cy, Int_t cz) {
+        return ((size_t)cx * std::max(1, volume.ny - 1) + cy) * std::max(1, volume.nz - 1) + cz;
+    }
+
+    static Int_t ClampCell(Double_t u, Int_t n) { return std::min(std::max((Int_t)u, 0), std::max(0, n - 2)); }
+
+    // Volume of the level containing the position, -1 outside
+    static Int_t FindVolume(const BlockedFieldMap* map, const TVector3& position) {
+        for (size_t n = 0; n < map->GetNumberOfVolumes(); n++)
+            if (map->GetVolume(n).IsInside(position)) return n;
+        return -1;
+    }
+
+    // Error map: deviation of the coarse interpolation at every finest node, kept per coarse cell
+    void ComputeErrors(Level& level) const {
+        const BlockedFieldMap* finest = fLevels[0].map;
+        level.errors.clear();
+        for (size_t n = 0; n < finest->GetNumberOfVolumes(); n++) {
+            const BlockedVolume& fine = finest->GetVolume(n);
+            const BlockedVolume& coarse = level.map->GetVolume(n);
+            std::vector<float> errors((size_t)std::max(1, coarse.nx - 1) * std::max(1, coarse.ny - 1) * std::max(1, coarse.nz - 1), 0.f);
+            for (Int_t ix = 0; ix < fine.nx; ix++)
+                for (Int_t iy = 0; iy < fine.ny; iy++)
+                    for (Int_t iz = 0; iz < fine.nz; iz++) {
+                        const TVector3 node = fine.origin + TVector3(ix * fine.spacing.X(), iy * fine.spacing.Y(), iz * fine.spacing.Z());
+                        const size_t index = fine.NodeIndex(ix, iy, iz);
+                        const TVector3 B(fine.Bx[index], fine.By[index], fine.Bz[index]);
+                        const Double_t error = coarse.IsInside(node) ? (level.map->GetMagneticField(node) - B).Mag() : 1e30;
+                        const size_t cell = CellIndex(coarse, ClampCell(ix / level.factors[n][0], coarse.nx),
+                                                      ClampCell(iy / level.factors[n][1], coarse.ny), ClampCell(iz / level.factors[n][2], coarse.nz));
+                        errors[cell] = std::max(errors[cell], (float)std::min(error, 1e30));
+                    }
+            level.errors.push_back(std::move(errors));
+        }
+    }
+
+   public:
+    explicit FieldPyramid(const BlockedFieldMap* finest) {
+        Level level;
+        level.map = finest;
+        level.factors.assign(finest->GetNumberOfVolumes(), {1, 1, 1});
+        fLevels.push_back(std::move(level));
+    }
+
+    size_t GetNumberOfLevels() const { return fLevels.size(); }
+    const BlockedFieldMap* GetLevel(size_t level) const { return fLevels[level].map; }
+    const std::array<Int_t, 3>& GetFactors(size_t level, size_t volume) const { return fLevels[level].factors[volume]; }
+
+    // Adds the level with the given mesh size in mm, or returns it if it already exists. A null mesh size is
+    // the finest level
+    Int_t AddLevel(const TVector3& meshSize) {
+        if (meshSize.Mag() == 0) return 0;
+        const BlockedFieldMap* finest = fLevels[0].map;
+        std::vector<std::array<Int_t, 3>> factors;
+        for (size_t n = 0; n < finest->GetNumberOfVolumes(); n++) {
+            const BlockedVolume& volume = finest->GetVolume(n);
+            std::array<Int_t, 3> factor;
+            for (Int_t axis = 0; axis < 3; axis++) {
+                const Double_t ratio = volume.spacing[axis] > 0 ? meshSize[axis] / volume.spacing[axis] : 1;
+                factor[axis] = std::max(1, (Int_t)std::round(ratio));
+                if (std::abs(ratio - factor[axis]) > 1e-6)
+                    std::cerr << "Warning: mesh size " << meshSize[axis] << " mm is not a multiple of the native mesh " << volume.spacing[axis]
+                              << " mm, using a decimation factor of " << factor[axis] << std::endl;
+            }
+            factors.push_back(factor);
+        }
+        return AddLevel(factors);
+    }
+
+    // Adds the level with the given decimation factors of every volume
+    Int_t AddLevel(const std::vector<std::array<Int_t, 3>>& factors) {
+        for (size_t l = 0; l < fLevels.size(); l++)
+            if (fLevels[l].factors == factors) return l;
+
+        const BlockedFieldMap* finest = fLevels[0].map;
+        Level level;
+        level.factors = factors;
+        if (!factors.empty()) level.coarseness = factors[0][0] * factors[0][1] * factors[0][2];
+        level.storage = std::make_unique<BlockedFieldMap>();
+        level.storage->SetInterpolation(finest->GetInterpolation());
+
+        for (size_t n = 0; n < finest->GetNumberOfVolumes(); n++) {
+            const BlockedVolume& fine = finest->GetVolume(n);
+            const Int_t fx = factors[n][0], fy = factors[n][1], fz = factors[n][2];
+            const Int_t nx = (fine.nx - 1) / fx + 1, ny = (fine.ny - 1) / fy + 1, nz = (fine.nz - 1) / fz + 1;
+            const TVector3 spacing(fine.spacing.X() * fx, fine.spacing.Y() * fy, fine.spacing.Z() * fz);
+
+            float* data = level.storage->AddOwnedVolume(fine.origin, spacing, nx, ny, nz);
+            const BlockedVolume& coarse = level.storage->GetVolume(n);
+            const size_t nValues = coarse.GetNumberOfBricks() * kBrickSize;
+            for (Int_t ix = 0; ix < nx; ix++)
+                for (Int_t iy = 0; iy < ny; iy++)
+                    for (Int_t iz = 0; iz < nz; iz++) {
+                        const size_t from = fine.NodeIndex(ix * fx, iy * fy, iz * fz);
+                        const size_t to = coarse.NodeIndex(ix, iy, iz);
+                        data[to] = fine.Bx[from];
+                        data[nValues + to] = fine.By[from];
+                        data[2 * nValues + to] = fine.Bz[from];
+                    }
+            BlockedFieldMap::FillHalo(coarse, data);
+        }
+        level.map = level.storage.get();
+        ComputeErrors(level);
+
+        fLevels.push_back(std::move(level));
+        return fLevels.size() - 1;
+    }
+
+    // Level with the given mesh size, -1 if it has not been added
+    Int_t FindLevel(const TVector3& meshSize) const {
+        if (meshSize.Mag() == 0) return 0;
+        const BlockedFieldMap* finest = fLevels[0].map;
+        for (size_t l = 0; l < fLevels.size(); l++) {
+            Bool_t match = true;
+            for (size_t n = 0; n < finest->GetNumberOfVolumes() && match; n++)
+                for (Int_t axis = 0; axis < 3; axis++)
+                    if (std::abs(fLevels[l].map->GetVolume(n).spacing[axis] - meshSize[axis]) > 1e-6) match = false;
+            if (match) return l;
+        }
+        return -1;
+    }
+
+    // Maximum deviation (T) from the finest level in the cell of the level containing the position
+    Double_t GetLevelError(size_t level, const TVector3& position) const {
+        if (level == 0) return 0;
+        const Int_t n = FindVolume(fLevels[level].map, position);
+        if (n < 0) return FindVolume(fLevels[0].map, position) < 0 ? 0 : 1e30;
+        const BlockedVolume& coarse = fLevels[level].map->GetVolume(n);
+        const TVector3 local = position - coarse.origin;
+        const size_t cell = CellIndex(coarse, ClampCell(local.X() / coarse.spacing.X(), coarse.nx), ClampCell(local.Y() / coarse.spacing.Y(), coarse.ny),
+                                      ClampCell(local.Z() / coarse.spacing.Z(), coarse.nz));
+        return fLevels[level].errors[n][cell];
+    }
+
+    // Coarsest level whose error at the position is within the tolerance (T)
+    size_t SelectLevel(const TVector3& position, Double_t tolerance) const {
+        size_t selected = 0;
+        for (size_t l = 1; l < fLevels.size(); l++)
+            if (fLevels[l].coarseness > fLevels[selected].coarseness && GetLevelError(l, position) <= tolerance) selected = l;
+        return selected;
+    }
+
+    // Sets the interpolation of the coarse levels, the finest level being set by its owner first, and computes
+    // their error maps again, since the deviation from the finest level depends on both interpolations
+    void SetInterpolation(Bool_t interpolation) {
+        for (auto& level : fLevels)
+            if (level.storage) {
+                level.storage->SetInterpolation(interpolation);
+                ComputeErrors(level);
+            }
+    }
+
+    // Field of a fixed level, the finest level is used where the coarse level does not reach
+    TVector3 GetMagneticField(const TVector3& position, size_t level) const {
+        if (level > 0 && FindVolume(fLevels[level].map, position) < 0) return fLevels[0].map->GetMagneticField(position);
+        return fLevels[level].map->GetMagneticField(position);
+    }
+
+    TVector3 GetAdaptiveMagneticField(const TVector3& position, Double_t tolerance) const {
+        return fLevels[SelectLevel(position, tolerance)].map->GetMagneticField(position);
+    }
+};
+
+#endif
@@ -0,0 +1,1089 @@
+#ifndef REST_AXION_FIELDWORKER_H
+#define REST_AXION_FIELDWORKER_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cmath>
+#include <utility>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+
+#include <TVector3.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_machine.h>
+#include "TRestPhysics.h"
+#include "TRestAxionMagneticField.h"
+#include "TRestAxionBufferGas.h"
+#include "TRestAxionField.h"
+#include "REST_Axion_CoherenceKernel.h"
+#include "REST_Axion_BlockedFieldMap.h"
+#include "REST_Axion_FieldMapFile.h"
+#include "REST_Axion_FieldPyramid.h"
+#include "REST_Axion_TrackProfile.h"
+#include "REST_Axion_GSLWorkspacePool.h"
+#include "REST_Axion_BufferGasTable.h"
+#include "REST_Axion_HybridIntegrator.h"
+#include "REST_Axion_ResultCache.h"
+#include "REST_Axion_Instrumentation.h"
+
+//*******************************************************************************************************
+//*** Description: Worker-context facility for parallel track evaluation.
+//***
+//*** - SharedFieldMap: loads one TRestAxionMagneticField (and applies ReMap/SetInterpolation) once, and
+//***   afterwards it is only accessed read-only, through GetMagneticField/GetTransversalComponent. It can be
+//***   shared by any number of threads. SharedFieldMap::Load reads the preprocessed binary map instead when
+//***   it exists (REST_Axion_FieldMapFile.h), sharing its pages with the other processes of the node.
+//*** - FieldWorker: lightweight per-thread handle on a SharedFieldMap. It carries its own track, buffer gas
+//***   and integration settings, and evaluates the Standard and GSL (QAWO) transmission probabilities without
+//***   touching the track stored inside TRestAxionMagneticField.
+//***
+//*** The conversion probability of a track of length L is
+//***   P = (g B L / 2)^2|_{B = 1 T, L = 1 mm} * | int_0^L B_T(l) exp(i q l) exp(-Gamma (L - l) / 2) dl |^2,
+//*** with q = (ma^2 - mg^2) / (2 Ea) and Gamma the photon absorption of the buffer gas, both in mm-1.
+//*** The normalisation is taken from `TRestAxionField::BLHalfSquared`.
+//***
+//*** The standard integration uses the kernels of REST_Axion_CoherenceKernel.h.
+//*** With SetProfileCache(step) the GSL integrations evaluate a cubic spline of B_T along the track
+//*** (REST_Axion_TrackProfile.h), built once per track and rebuilt after SetTrack, ReMap or SetInterpolation.
+//*** SetFieldLevel/SetFieldTolerance evaluate the field on the multi-resolution pyramid of the map
+//*** (SharedFieldMap::AddResolution, REST_Axion_FieldPyramid.h). SetBufferGasTable replaces the buffer gas
+//*** queries by a dense energy table (REST_Axion_BufferGasTable.h).
+//*** GammaTransmissionHybridProbability integrates the near-constant segments of the track analytically and the
+//*** fringe pieces with a piecewise-linear Filon rule (REST_Axion_HybridIntegrator.h); the segmentation is built
+//*** once per track and every later mass only costs a sum over the pieces.
+//*** SharedFieldMap::SetSinglePrecision evaluates B_T in float on the blocked volumes (BlockedFieldMap::
+//*** GetTransversalComponentSingle); the phase integrals keep accumulating in double, and the results are
+//*** validated against the spread of the maps by MagneticField/REST_Axion_PrecisionValidation.C.
+//*** With REST_AXION_INSTRUMENTATION the field evaluations, integrations, caches and gas queries are counted
+//*** (REST_Axion_Instrumentation.h).
+//***
+//*** Mass scans are evaluated in batches of ConversionPoint (Ea, ma, mg, Gamma): the Standard batch samples
+//*** the field along the track once and accumulates all the amplitudes in a single pass, and the GSL batch
+//*** memoises the field values at the integration nodes, which are shared between the masses of the batch.
+//***
+//*** The GSL integration either uses the fixed IntegrationSettings of the worker, or meets an IntegrationTarget
+//*** (absolute/relative error of the probability), growing the number of intervals and QAWO levels on demand
+//*** and reporting the settings it used (IntegrationReport). The GSL workspaces and QAWO tables are taken from
+//*** the pool of the calling thread (REST_Axion_GSLWorkspacePool.h), shared by all the workers of the thread.
+//***
+//*** Usage:
+//***   SharedFieldMap map("fields.rml", "babyIAXO_2024_cutoff");
+//***   FieldWorker worker(&map);            // one per thread
+//***   worker.SetBufferGas("He", 2.9836e-10);
+//***   worker.SetTrack(position, direction);
+//***   std::pair<Double_t, Double_t> prob = worker.GammaTransmissionFieldMapProbability(Ea, ma);
+//***   std::vector<Double_t> probs = worker.GammaTransmissionProbabilities(worker.GetConversionPoints(Ea, masses), dL);
+//***
+//*** Dependencies:
+//*** `TRestAxionMagneticField::GetTransversalComponent`, `TRestAxionMagneticField::GetFieldBoundaries`,
+//*** `TRestAxionField::BLHalfSquared`, `TRestAxionBufferGas::GetPhotonMass` and
+//*** `TRestAxionBufferGas::GetPhotonAbsorptionLength`.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Settings of the GSL QAWO integration
+struct IntegrationSettings {
+    Double_t accuracy = 0.1;
+    Int_t numIntervals = 100;
+    Int_t qawoLevels = 20;
+};
+
+// Error target of the adaptive GSL integration, on the probability. The integration meets
+// error <= max(absoluteError, relativeError * P), growing the workspace and the QAWO table up to the limits
+struct IntegrationTarget {
+    Double_t absoluteError = 0;
+    Double_t relativeError = 1e-3;
+    Int_t maxIntervals = 10000;
+    Int_t maxLevels = 320;
+    Int_t maxAttempts = 16;
+};
+
+// Settings actually used by the last GSL integration of a worker
+struct IntegrationReport {
+    // Absolute tolerance of the amplitudes, 0 when only the relative target was needed
+    Double_t accuracy = 0;
+    Int_t numIntervals = 0;
+    Int_t qawoLevels = 0;
+    Int_t attempts = 0;
+    Int_t status = GSL_SUCCESS;
+    Bool_t converged = true;
+};
+
+// Momentum transfer in mm-1 for Ea in keV and masses in eV
+inline Double_t MomentumTransfer(Double_t Ea, Double_t ma, Double_t mg) {
+    Double_t qIneV = (ma * ma - mg * mg) / 2. / (Ea * 1000.);
+    return qIneV * REST_Physics::PhMeterIneV / 1000.;
+}
+
+// Automatic step of the standard integration. The step resolves the oscillation, samplesPerOscillation samples
+// per 2 pi / q, and the variation of the field, the linear interpolation error h^2 |B_T''| / 8 staying below
+// fieldTolerance (T), within [minStep, maxStep] (mm). With a relative error target the step is halved until the
+// Richardson estimate meets it
+struct StepSettings {
+    Double_t samplesPerOscillation = 20;
+    Double_t fieldTolerance = 1e-3;
+    Double_t minStep = 0.1;
+    Double_t maxStep = 100;
+    // Step of the probe of the field curvature along the track (mm)
+    Double_t probeStep = 20;
+    Double_t relativeError = 0;
+    Int_t maxRefinements = 6;
+};
+
+// Step and convergence of an automatic standard integration
+struct StepReport {
+    // Step of the samples of the result (mm), half the selected step
+    Double_t step = 0;
+    // Richardson estimate |P(h / 2) - P(h)| of the error of P(h / 2)
+    Double_t error = 0;
+    Int_t refinements = 0;
+    size_t samples = 0;
+};
+
+// One evaluation of a batch: axion energy (keV), axion and photon masses (eV) and photon absorption (mm-1)
+struct ConversionPoint {
+    Double_t Ea = 4.2;
+    Double_t ma = 0;
+    Double_t mg = 0;
+    Double_t Gamma = 0;
+};
+
+class SharedFieldMap {
+   private:
+    // Library instance, null when the map is read from a binary field map file
+    std::unique_ptr<TRestAxionMagneticField> fField;
+    std::string fFieldName;
+    Double_t fBLFactor = 0;
+    Bool_t fInterpolation = true;
+    // B_T evaluated in float on the blocked volumes
+    Bool_t fSinglePrecision = false;
+
+    // Incremented every time the field changes (ReMap, SetInterpolation, SetSinglePrecision), it invalidates the track profiles
+    size_t fGeneration = 0;
+
+    // Optional float32 blocked copy of the volumes, used for the field queries when it is present
+    std::unique_ptr<BlockedFieldMap> fBlocked;
+    // Binary field map file mapped in memory, its volumes are used for all the queries
+    std::unique_ptr<MappedFieldMap> fMapped;
+    // Coarser resolutions generated from the blocked volumes, used by the workers with a level or a tolerance
+    std::unique_ptr<FieldPyramid> fPyramid;
+
+    // GetFieldBoundaries is the only non trivial query, it is kept serialised
+    mutable std::mutex fMutex;
+
+    // Hash of the field values, computed once per generation
+    mutable ULong64_t fContentHash = 0;
+    mutable size_t fContentHashGeneration = 0;
+    mutable Bool_t fHasContentHash = false;
+
+    SharedFieldMap() { Initialize(); }
+
+    void Initialize() {
+        TRestAxionField axionField;
+        fBLFactor = axionField.BLHalfSquared(1, 1);
+
+        // Failed integrations are reported through the status code instead of aborting the worker threads
+        gsl_set_error_handler_off();
+    }
+
+    BlockedFieldMap* GetBlocked() const {
+        if (fMapped) return fMapped->GetMap();
+        return fBlocked.get();
+    }
+
+    void CountFieldEvaluations(size_t n) const {
+#if defined(REST_AXION_INSTRUMENTATION)
+        (fInterpolation ? Instrumentation::Local().fieldInterpolated : Instrumentation::Local().fieldNearest) += n;
+#else
+        (void)n;
+#endif
+    }
+
+   public:
+    // A null mesh size keeps the native mesh, and interpolation -1 keeps the default of the map
+    SharedFieldMap(const std::string& cfgFileName, const std::string& fieldName, const TVector3& meshSize = TVector3(0, 0, 0),
+                   Int_t interpolation = -1)
+        : fFieldName(fieldName) {
+        fField = std::make_unique<TRestAxionMagneticField>(cfgFileName.c_str(), fieldName);
+        if (meshSize.Mag() > 0) {
+            for (size_t n = 0; n < fField->GetNumberOfVolumes(); n++) fField->ReMap(n, meshSize);
+        }
+        if (interpolation >= 0) {
+            fInterpolation = interpolation;
+            fField->SetInterpolation(fInterpolation);
+        }
+        Initialize();
+    }
+
+    // Map read from a binary field map file (REST_Axion_FieldMapFile.h), without parsing fields.rml. It returns
+    // null if the file cannot be mapped
+    static std::unique_ptr<SharedFieldMap> FromFieldMapFile(const std::string& filename, Int_t interpolation = -1) {
+        std::unique_ptr<SharedFieldMap> map(new SharedFieldMap());
+        map->fMapped = std::make_unique<MappedFieldMap>();
+        if (!map->fMapped->Open(filename)) return nullptr;
+        map->fFieldName = map->fMapped->GetFieldName();
+        map->fInterpolation = map->fMapped->GetMap()->GetInterpolation();
+        if (interpolation >= 0) map->SetInterpolation(interpolation);
+        return map;
+    }
+
+    // Map read from the binary file if it exists, and from fields.rml otherwise
+    static std::unique_ptr<SharedFieldMap> Load(const std::string& cfgFileName, const std::string& fieldName, const std::string& mapFileName,
+                                                const TVector3& meshSize = TVector3(0, 0, 0), Int_t interpolation = -1) {
+        if (!mapFileName.empty() && meshSize.Mag() == 0 && access(mapFileName.c_str(), R_OK) == 0) {
+            std::unique_ptr<SharedFieldMap> map = FromFieldMapFile(mapFileName, interpolation);
+            if (map) return map;
+        }
+        return std::make_unique<SharedFieldMap>(cfgFileName, fieldName, meshSize, interpolation);
+    }
+
+    const std::string& GetFieldName() const { return fFieldName; }
+
+    // (g B L / 2)^2 for B = 1 T and L = 1 mm
+    Double_t GetBLFactor() const { return fBLFactor; }
+
+    // Direct access to the underlying field, only for read-only or serial use (drawing, profiles). It is null
+    // for maps read from a binary file and after ReleaseField
+    TRestAxionMagneticField* GetField() const { return fField.get(); }
+
+    Bool_t IsMapped() const { return fMapped != nullptr; }
+
+    // Field modifications, only for serial use while no worker is integrating
+    void ReMap(const TVector3& meshSize) {
+        if (!fField) {
+            std::cerr << "Warning: " << fFieldName << " is read from a binary field map file and cannot be remapped" << std::endl;
+            return;
+        }
+        for (size_t n = 0; n < fField->GetNumberOfVolumes(); n++) fField->ReMap(n, meshSize);
+        if (fBlocked) UseBlockedStorage();
+        fPyramid.reset();
+        fGeneration++;
+    }
+
+    void SetInterpolation(Bool_t interpolation) {
+        fInterpolation = interpolation;
+        if (fField) fField->SetInterpolation(fInterpolation);
+        if (GetBlocked()) GetBlocked()->SetInterpolation(fInterpolation);
+        if (fPyramid) fPyramid->SetInterpolation(fInterpolation);
+        fGeneration++;
+    }
+
+    // Single precision evaluation of B_T, on the blocked storage, which is built if the map has none. The
+    // pyramid levels keep their double evaluation. Only for serial use, before the map is shared between threads
+    void SetSinglePrecision(Bool_t singlePrecision) {
+        if (singlePrecision && !GetBlocked()) UseBlockedStorage();
+        fSinglePrecision = singlePrecision && GetBlocked();
+        fGeneration++;
+    }
+
+    Bool_t GetSinglePrecision() const { return fSinglePrecision; }
+
+    Bool_t GetInterpolation() const { return fInterpolation; }
+
+    size_t GetGeneration() const { return fGeneration; }
+
+    // Hash of the geometry and the field values of all the volumes, of the interpolation and of the storage the
+    // queries are evaluated on, the field part of the keys of the result cache (REST_Axion_ResultCache.h). A map
+    // without blocked storage is sampled at its nodes once to compute it
+    ULong64_t GetContentHash() const {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (fHasContentHash && fContentHashGeneration == fGeneration) return fContentHash;
+        std::unique_ptr<BlockedFieldMap> sampled;
+        const BlockedFieldMap* blocked = GetBlocked();
+        if (!blocked) {
+            sampled = std::make_unique<BlockedFieldMap>(fField.get(), fInterpolation);
+            blocked = sampled.get();
+        }
+        ResultHasher hasher;
+        // The library (double), blocked and mapped (float32) evaluations of the same values give different results
+        hasher.Add(GetStorageName()).Add((Int_t)fInterpolation).Add((Int_t)blocked->GetNumberOfVolumes());
+        if (fSinglePrecision) hasher.Add(std::string("SinglePrecision"));
+        for (size_t n = 0; n < blocked->GetNumberOfVolumes(); n++) {
+            const BlockedVolume& volume = blocked->GetVolume(n);
+            hasher.Add(volume.origin.X()).Add(volume.origin.Y()).Add(volume.origin.Z());
+            hasher.Add(volume.spacing.X()).Add(volume.spacing.Y()).Add(volume.spacing.Z());
+            hasher.Add(volume.nx).Add(volume.ny).Add(volume.nz);
+            const size_t bytes = volume.GetNumberOfBricks() * kBrickSize * sizeof(float);
+            hasher.Add(volume.Bx, bytes).Add(volume.By, bytes).Add(volume.Bz, bytes);
+        }
+        fContentHash = hasher.GetHash();
+        fContentHashGeneration = fGeneration;
+        fHasContentHash = true;
+        return fContentHash;
+    }
+
+    // Builds the blocked float32 copy of the volumes (REST_Axion_BlockedFieldMap.h) and uses it for all the
+    // field queries from now on. It must be called before the map is shared between threads
+    void UseBlockedStorage() {
+        if (!fField) return;
+        fPyramid.reset();
+        fBlocked = std::make_unique<BlockedFieldMap>(fField.get(), fInterpolation);
+        fGeneration++;
+    }
+
+    // Frees the library map once the blocked copy holds the field and nothing needs the library anymore: the
+    // queries and the field boundaries are taken from the blocked volumes from then on, as for the maps read from
+    // a binary file, and the map can no longer be remapped. Only for serial use, before the map is shared
+    void ReleaseField() {
+        if (fBlocked) fField.reset();
+    }
+
+    // Storage the field queries are evaluated on: the library map, the blocked float32 copy or the binary file
+    std::string GetStorageName() const { return fMapped ? "Mapped" : (fBlocked ? "Blocked" : "Library"); }
+
+    const BlockedFieldMap* GetBlockedStorage() const { return GetBlocked(); }
+
+    // Adds a coarser resolution with the given mesh size, generated once from the finest blocked volumes
+    // (REST_Axion_FieldPyramid.h) instead of loading and remapping another instance. It returns its level, 0
+    // being the native mesh. Only for serial use, before the map is shared between threads
+    Int_t AddResolution(const TVector3& meshSize) {
+        if (!GetBlocked()) UseBlockedStorage();
+        if (!fPyramid) fPyramid = std::make_unique<FieldPyramid>(GetBlocked());
+        return fPyramid->AddLevel(meshSize);
+    }
+
+    const FieldPyramid* GetPyramid() const { return fPyramid.get(); }
+
+    TVector3 GetMagneticField(const TVector3& position) const {
+        CountFieldEvaluations(1);
+        if (GetBlocked()) return GetBlocked()->GetMagneticField(position);
+        return fField->GetMagneticField(position, false);
+    }
+
+    Double_t GetTransversalComponent(const TVector3& position, const TVector3& direction) const {
+        CountFieldEvaluations(1);
+        if (fSinglePrecision) return GetBlocked()->GetTransversalComponentSingle(position, direction);
+        if (GetBlocked()) return GetBlocked()->GetTransversalComponent(position, direction);
+        return fField->GetTransversalComponent(position, direction);
+    }
+
+    // B_T at the n points start + i dL direction
+    void SampleTransversalComponent(const TVector3& start, const TVector3& direction, Double_t dL, size_t n, Double_t* values) const {
+        if (fSinglePrecision) {
+            CountFieldEvaluations(n);
+            GetBlocked()->SampleSingle(start, direction, dL, n, values);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) values[i] = GetTransversalComponent(start + (i * dL) * direction, direction);
+    }
+
+    // Transversal component at a resolution level, or at the coarsest level within a tolerance (T) if it is positive
+    Double_t GetTransversalComponent(const TVector3& position, const TVector3& direction, Int_t level, Double_t tolerance) const {
+        if (!fPyramid || (level <= 0 && tolerance <= 0)) return GetTransversalComponent(position, direction);
+        CountFieldEvaluations(1);
+        if (tolerance > 0) return fPyramid->GetAdaptiveMagneticField(position, tolerance).Perp(direction);
+        return fPyramid->GetMagneticField(position, level).Perp(direction);
+    }
+
+    std::vector<Double_t> GetTransversalComponentAlongPath(const TVector3& from, const TVector3& to, Double_t dL) const {
+        if (fSinglePrecision) {
+            std::vector<Double_t> values;
+            const Double_t length = (to - from).Mag();
+            if (length <= 0 || dL <= 0) return values;
+            values.resize((size_t)std::ceil(length / dL));
+            SampleTransversalComponent(from, (to - from).Unit(), dL, values.size(), values.data());
+            return values;
+        }
+        std::vector<Double_t> values =
+            GetBlocked() ? GetBlocked()->GetTransversalComponentAlongPath(from, to, dL) : fField->GetTransversalComponentAlongPath(from, to, dL);
+        CountFieldEvaluations(values.size());
+        return values;
+    }
+
+    // Entry and exit points of the line through position along direction, over all the volumes of the map.
+    // It returns an empty vector if the line does not cross the field
+    std::vector<TVector3> GetFieldBoundaries(const TVector3& position, const TVector3& direction) const {
+        std::lock_guard<std::mutex> lock(fMutex);
+        std::vector<TVector3> boundaries;
+        Double_t lMin = 0, lMax = 0;
+        const size_t nVolumes = fField ? fField->GetNumberOfVolumes() : GetBlocked()->GetNumberOfVolumes();
+        for (size_t n = 0; n < nVolumes; n++) {
+            std::vector<TVector3> bounds =
+                fField ? fField->GetFieldBoundaries(position, direction, 0, n) : GetBlocked()->GetFieldBoundaries(position, direction, n);
+            if (bounds.size() != 2) continue;
+            for (const auto& bound : bounds) {
+                Double_t l = (bound - position).Dot(direction);
+                if (boundaries.empty()) {
+                    boundaries = {bound, bound};
+                    lMin = lMax = l;
+                } else if (l < lMin) {
+                    boundaries[0] = bound;
+                    lMin = l;
+                } else if (l > lMax) {
+                    boundaries[1] = bound;
+                    lMax = l;
+                }
+            }
+        }
+        return boundaries;
+    }
+};
+
+class FieldWorker {
+   private:
+    const SharedFieldMap* fMap = nullptr;
+
+    // Track, starting at the entrance of the field
+    TVector3 fTrackStart;
+    TVector3 fTrackDirection = TVector3(0, 0, 1);
+    Double_t fTrackLength = 0;
+
+    std::unique_ptr<TRestAxionBufferGas> fBufferGas;
+    IntegrationSettings fSettings;
+
+    // Opt-in tabulation of the buffer gas, on [Emin, Emax] keV every step keV
+    BufferGasTable fGasTable;
+    Double_t fGasTableRange[3] = {0, 0, 0};
+    Double_t fGasTableMaxError = 1e-3;
+
+    void BuildBufferGasTable() {
+        fGasTable.Clear();
+        if (fGasTableRange[2] <= 0 || !fBufferGas) return;
+        fGasTable.Build(fBufferGas.get(), fGasTableRange[0], fGasTableRange[1], fGasTableRange[2]);
+        if (fGasTable.GetMaxRelativeError() > fGasTableMaxError) {
+            std::cerr << "Warning: the buffer gas table deviates by " << fGasTable.GetMaxRelativeError() << " (relative) from the library, above "
+                      << fGasTableMaxError << ", the library is queried instead" << std::endl;
+            fGasTable.Clear();
+        }
+    }
+
+    // Resolution of the field queries: level of the pyramid of the map, or tolerance (T) for the adaptive level
+    Int_t fFieldLevel = 0;
+    Double_t fFieldTolerance = 0;
+
+    struct IntegrandParams {
+        const FieldWorker* worker;
+        Double_t Gamma;
+    };
+
+    // Field values at the integration nodes of the current GSL batch, null outside a batch
+    mutable std::unordered_map<Double_t, Double_t>* fNodeCache = nullptr;
+
+    mutable IntegrationReport fLastReport;
+
+    // Opt-in spline of B_T along the track, built at the first GSL integration of the track. It is valid while
+    // the track and the generation of the map do not change
+    Double_t fProfileStep = 0;
+    mutable TrackProfile fProfile;
+    mutable size_t fProfileGeneration = 0;
+
+    // Maximum |B_T''| along the track (T mm-2), probed at the first automatic step, negative until then
+    mutable Double_t fFieldCurvature = -1;
+    mutable Double_t fCurvatureProbe = 0;
+    mutable size_t fCurvatureGeneration = 0;
+
+    // Segmentation of the track of the hybrid integration, built at its first use on the track
+    HybridSettings fHybridSettings;
+    mutable HybridProfile fHybrid;
+    mutable size_t fHybridGeneration = 0;
+
+    const TrackProfile* GetProfile() const {
+        if (fProfileStep <= 0) return nullptr;
+        if (!fProfile.IsEmpty() && fProfileGeneration == fMap->GetGeneration()) return &fProfile;
+        REST_AXION_SCOPED_TIMER(profileTime);
+        REST_AXION_COUNT(profileBuilds, 1);
+        fProfile.Build(fTrackLength, fProfileStep, [this](Double_t l) { return GetTransversalComponentInParametricTrack(l); });
+        fProfileGeneration = fMap->GetGeneration();
+        return &fProfile;
+    }
+
+    Double_t GetNodeField(Double_t l) const {
+        if (fProfileStep > 0) {
+            REST_AXION_COUNT(profileHits, 1);
+            return fProfile.Evaluate(l);
+        }
+        if (fNodeCache == nullptr) return GetTransversalComponentInParametricTrack(l);
+        auto it = fNodeCache->find(l);
+        if (it != fNodeCache->end()) {
+            REST_AXION_COUNT(nodeCacheHits, 1);
+            return it->second;
+        }
+        REST_AXION_COUNT(nodeCacheMisses, 1);
+        const Double_t value = GetTransversalComponentInParametricTrack(l);
+        fNodeCache->emplace(l, value);
+        return value;
+    }
+
+    static double DampedIntegrand(double l, void* params) {
+        const IntegrandParams* p = (const IntegrandParams*)params;
+        const FieldWorker* worker = p->worker;
+        return worker->GetNodeField(l) * std::exp(-p->Gamma * (worker->fTrackLength - l) / 2.);
+    }
+
+    // One GSL integration of the real and imaginary amplitudes with the given tolerances, returns the GSL status
+    Int_t IntegrateAmplitude(const ConversionPoint& point, Double_t epsabs, Double_t epsrel, Int_t numIntervals, Int_t qawoLevels,
+                             Double_t amplitude[2], Double_t error[2]) const {
+        const Double_t q = MomentumTransfer(point.Ea, point.ma, point.mg);
+        IntegrandParams params = {this, point.Gamma};
+
+        gsl_function F;
+        F.function = &FieldWorker::DampedIntegrand;
+        F.params = &params;
+
+        amplitude[0] = amplitude[1] = error[0] = error[1] = 0;
+        REST_AXION_SCOPED_TIMER(gslTime);
+        REST_AXION_COUNT(gslIntegrals, 1);
+        GSLWorkspacePool& pool = GSLWorkspacePool::Local();
+        gsl_integration_workspace* workspace = pool.GetWorkspace(numIntervals);
+        if (q == 0) {
+            const Int_t status = gsl_integration_qag(&F, 0, fTrackLength, epsabs, epsrel, numIntervals, GSL_INTEG_GAUSS61, workspace,
+                                                     &amplitude[0], &error[0]);
+            REST_AXION_COUNT(gslSubintervals, workspace->size);
+            return status;
+        }
+
+        gsl_integration_qawo_table* table = pool.GetTable(q, fTrackLength, GSL_INTEG_COSINE, qawoLevels);
+        Int_t status = gsl_integration_qawo(&F, 0, epsabs, epsrel, numIntervals, workspace, table, &amplitude[0], &error[0]);
+        REST_AXION_COUNT(gslSubintervals, workspace->size);
+        table = pool.GetTable(q, fTrackLength, GSL_INTEG_SINE, qawoLevels);
+        Int_t statusSine = gsl_integration_qawo(&F, 0, epsabs, epsrel, numIntervals, workspace, table, &amplitude[1], &error[1]);
+        REST_AXION_COUNT(gslSubintervals, workspace->size);
+        return status == GSL_SUCCESS ? statusSine : status;
+    }
+
+    // Transversal field on a uniform grid of nCells cells spanning the whole track
+    std::vector<Double_t> SampleTrack(size_t nCells) const {
+        std::vector<Double_t> values(nCells + 1);
+        const Double_t h = fTrackLength / nCells;
+        for (size_t i = 0; i <= nCells; i++) values[i] = GetTransversalComponentInParametricTrack(i * h);
+        return values;
+    }
+
+    Double_t GetFieldCurvature(Double_t probeStep) const {
+        if (fFieldCurvature >= 0 && fCurvatureProbe == probeStep && fCurvatureGeneration == fMap->GetGeneration()) return fFieldCurvature;
+        fFieldCurvature = 0;
+        fCurvatureProbe = probeStep;
+        fCurvatureGeneration = fMap->GetGeneration();
+        if (fTrackLength <= 0 || probeStep <= 0) return fFieldCurvature;
+        const size_t nCells = std::max<size_t>(2, (size_t)std::ceil(fTrackLength / probeStep));
+        const std::vector<Double_t> values = SampleTrack(nCells);
+        const Double_t h = fTrackLength / nCells;
+        for (size_t i = 1; i + 1 < values.size(); i++)
+            fFieldCurvature = std::max(fFieldCurvature, std::abs(values[i + 1] - 2 * values[i] + values[i - 1]) / (h * h));
+        return fFieldCurvature;
+    }
+
+    // Coarse (every other sample) and fine standard probabilities of the samples of a grid of even cells
+    std::pair<Double_t, Double_t> RichardsonPair(const std::vector<Double_t>& fine, Double_t h, Double_t q, Double_t Gamma) const {
+        std::vector<Double_t> coarse((fine.size() + 1) / 2);
+        for (size_t i = 0; i < coarse.size(); i++) coarse[i] = fine[2 * i];
+        return {fMap->GetBLFactor() * CoherenceSum(coarse.data(), coarse.size(), 2 * h, q, Gamma),
+                fMap->GetBLFactor() * CoherenceSum(fine.data(), fine.size(), h, q, Gamma)};
+    }
+
+    std::pair<Double_t, Double_t> ToProbability(const Double_t amplitude[2], const Double_t error[2]) const {
+        const Double_t probability = fMap->GetBLFactor() * (amplitude[0] * amplitude[0] + amplitude[1] * amplitude[1]);
+        const Double_t probabilityError = fMap->GetBLFactor() * 2 * (std::abs(amplitude[0]) * error[0] + std::abs(amplitude[1]) * error[1]);
+        return {probability, probabilityError};
+    }
+
+   public:
+    explicit FieldWorker(const SharedFieldMap* map) : fMap(map) {}
+
+    const SharedFieldMap* GetMap() const { return fMap; }
+
+    // Sets the track and places its start at the entrance of the field
+    void SetTrack(const TVector3& position, const TVector3& direction) {
+        fProfile.Clear();
+        fHybrid.Clear();
+        fFieldCurvature = -1;
+        fTrackDirection = direction.Unit();
+        std::vector<TVector3> boundaries = fMap->GetFieldBoundaries(position, fTrackDirection);
+        if (boundaries.size() != 2) {
+            fTrackStart = position;
+            fTrackLength = 0;
+            return;
+        }
+        fTrackStart = boundaries[0];
+        fTrackLength = (boundaries[1] - boundaries[0]).Mag();
+    }
+
+    // Sets a track whose entrance and length in the field are already known (REST_Axion_TrackSet.h)
+    void SetTrack(const TVector3& entry, const TVector3& direction, Double_t length) {
+        fProfile.Clear();
+        fHybrid.Clear();
+        fFieldCurvature = -1;
+        fTrackDirection = direction.Unit();
+        fTrackStart = entry;
+        fTrackLength = std::max(length, 0.);
+    }
+
+    const TVector3& GetTrackStart() const { return fTrackStart; }
+    const TVector3& GetTrackDirection() const { return fTrackDirection; }
+    Double_t GetTrackLength() const { return fTrackLength; }
+
+    Double_t GetTransversalComponentInParametricTrack(Double_t l) const {
+        return fMap->GetTransversalComponent(fTrackStart + l * fTrackDirection, fTrackDirection, fFieldLevel, fFieldTolerance);
+    }
+
+    // Evaluates the field at a level of SharedFieldMap::AddResolution (0 is the native mesh)
+    void SetFieldLevel(Int_t level) {
+        fFieldLevel = level;
+        fFieldTolerance = 0;
+        fProfile.Clear();
+        fHybrid.Clear();
+        fFieldCurvature = -1;
+    }
+
+    // Evaluates every point at the coarsest level whose error is within the tolerance in T, 0 disables it
+    void SetFieldTolerance(Double_t tolerance) {
+        fFieldTolerance = tolerance;
+        fProfile.Clear();
+        fHybrid.Clear();
+        fFieldCurvature = -1;
+    }
+
+    Int_t GetFieldLevel() const { return fFieldLevel; }
+    Double_t GetFieldTolerance() const { return fFieldTolerance; }
+
+    // Samples the transversal field every dL (mm) from the entrance to the exit of the track
+    std::vector<Double_t> GetTransversalComponentAlongTrack(Double_t dL) const {
+        std::vector<Double_t> values;
+        if (fTrackLength <= 0 || dL <= 0) return values;
+        const size_t n = (size_t)(fTrackLength / dL) + 1;
+        if (fFieldLevel <= 0 && fFieldTolerance <= 0) {
+            values.resize(n);
+            fMap->SampleTransversalComponent(fTrackStart, fTrackDirection, dL, n, values.data());
+            return values;
+        }
+        values.reserve(n);
+        for (size_t i = 0; i < n; i++) values.push_back(GetTransversalComponentInParametricTrack(i * dL));
+        return values;
+    }
+
+    // An empty name or a null density stands for vacuum
+    void SetBufferGas(const std::string& gasName, Double_t density) {
+        fGasTable.Clear();
+        if (gasName.empty() || density <= 0) {
+            fBufferGas = nullptr;
+            return;
+        }
+        fBufferGas = std::make_unique<TRestAxionBufferGas>();
+        fBufferGas->SetGasDensity(gasName, density);
+        BuildBufferGasTable();
+    }
+
+    // Tabulates the photon mass and absorption of the buffer gas between Emin and Emax (keV) every step (keV),
+    // for this gas and every later one (REST_Axion_BufferGasTable.h). A null step disables it, which is the
+    // default. A table whose relative error against the library exceeds maxError is not used, and the library
+    // is queried instead. Outside [Emin, Emax] the library is always queried
+    void SetBufferGasTable(Double_t Emin, Double_t Emax, Double_t step, Double_t maxError = 1e-3) {
+        fGasTableRange[0] = Emin;
+        fGasTableRange[1] = Emax;
+        fGasTableRange[2] = step;
+        fGasTableMaxError = maxError;
+        BuildBufferGasTable();
+    }
+
+    const BufferGasTable& GetBufferGasTable() const { return fGasTable; }
+
+    TRestAxionBufferGas* GetBufferGas() const { return fBufferGas.get(); }
+
+    // Enables the track-profile cache with nodes every step (mm), 0 disables it. The GSL integrations then
+    // evaluate a cubic spline of B_T instead of the 3D map
+    void SetProfileCache(Double_t step) {
+        fProfileStep = step;
+        fProfile.Clear();
+    }
+
+    Double_t GetProfileCacheStep() const { return fProfileStep; }
+
+    // Sampling step, tolerance and minimum segment length of the hybrid integration
+    void SetHybridSettings(const HybridSettings& settings) {
+        fHybridSettings = settings;
+        fHybrid.Clear();
+    }
+    const HybridSettings& GetHybridSettings() const { return fHybridSettings; }
+
+    // Segmentation of the current track, built at the first call on the track
+    const HybridProfile& GetHybridProfile() const {
+        if (!fHybrid.IsEmpty() && fHybridGeneration == fMap->GetGeneration()) return fHybrid;
+        fHybrid.Build(fTrackLength, fHybridSettings, [this](Double_t l) { return GetTransversalComponentInParametricTrack(l); });
+        fHybridGeneration = fMap->GetGeneration();
+        return fHybrid;
+    }
+
+    void SetIntegrationSettings(const IntegrationSettings& settings) { fSettings = settings; }
+    const IntegrationSettings& GetIntegrationSettings() const { return fSettings; }
+
+    // Photon mass in eV
+    Double_t GetPhotonMass(Double_t Ea) const {
+        if (fGasTable.IsInside(Ea)) {
+            REST_AXION_COUNT(gasTableQueries, 1);
+            return fGasTable.GetPhotonMass(Ea);
+        }
+        if (!fBufferGas) return 0;
+        REST_AXION_COUNT(gasQueries, 1);
+        return fBufferGas->GetPhotonMass(Ea);
+    }
+
+    // Photon absorption in mm-1 (TRestAxionBufferGas returns it in cm-1)
+    Double_t GetPhotonAbsorption(Double_t Ea) const {
+        if (fGasTable.IsInside(Ea)) {
+            REST_AXION_COUNT(gasTableQueries, 1);
+            return fGasTable.GetPhotonAbsorption(Ea);
+        }
+        if (!fBufferGas) return 0;
+        REST_AXION_COUNT(gasQueries, 1);
+        return fBufferGas->GetPhotonAbsorptionLength(Ea) / 10.;
+    }
+
+    // Conversion point with the photon mass and absorption of the buffer gas of the worker
+    ConversionPoint GetConversionPoint(Double_t Ea, Double_t ma) const { return {Ea, ma, GetPhotonMass(Ea), GetPhotonAbsorption(Ea)}; }
+
+    // Conversion points of a mass scan, the buffer gas is only queried once per energy
+    std::vector<ConversionPoint> GetConversionPoints(const std::vector<std::pair<Double_t, Double_t>>& energyMassPairs) const {
+        std::vector<ConversionPoint> points;
+        points.reserve(energyMassPairs.size());
+        std::map<Double_t, std::pair<Double_t, Double_t>> gasValues;
+        for (const auto& pair : energyMassPairs) {
+            auto it = gasValues.find(pair.first);
+            if (it == gasValues.end())
+                it = gasValues.emplace(pair.first, std::make_pair(GetPhotonMass(pair.first), GetPhotonAbsorption(pair.first))).first;
+            points.push_back({pair.first, pair.second, it->second.first, it->second.second});
+        }
+        return points;
+    }
+
+    std::vector<ConversionPoint> GetConversionPoints(Double_t Ea, const std::vector<Double_t>& masses) const {
+        std::vector<std::pair<Double_t, Double_t>> energyMassPairs;
+        for (const auto& ma : masses) energyMassPairs.push_back({Ea, ma});
+        return GetConversionPoints(energyMassPairs);
+    }
+
+    // Standard integration over field values sampled every dL (mm), as TRestAxionField::GammaTransmissionProbability
+    Double_t GammaTransmissionProbability(const std::vector<Double_t>& magneticValues, Double_t dL, Double_t Ea, Double_t ma) const {
+        return GammaTransmissionProbability(magneticValues, dL, GetConversionPoint(Ea, ma));
+    }
+
+    // Standard integration of a conversion point, with its own photon mass and absorption
+    Double_t GammaTransmissionProbability(const std::vector<Double_t>& magneticValues, Double_t dL, const ConversionPoint& point) const {
+        REST_AXION_SCOPED_TIMER(standardTime);
+        REST_AXION_COUNT(standardIntegrals, 1);
+        return fMap->GetBLFactor() *
+               CoherenceSum(magneticValues.data(), magneticValues.size(), dL, MomentumTransfer(point.Ea, point.ma, point.mg), point.Gamma);
+    }
+
+    // Batched standard integration of all the points over the same field values, sampled every dL (mm)
+    std::vector<Double_t> GammaTransmissionProbabilities(const std::vector<Double_t>& magneticValues, Double_t dL,
+                                                         const std::vector<ConversionPoint>& points) const {
+        std::vector<Double_t> q, Gamma, probabilities(points.size());
+        q.reserve(points.size());
+        Gamma.reserve(points.size());
+        for (const auto& point : points) {
+            q.push_back(MomentumTransfer(point.Ea, point.ma, point.mg));
+            Gamma.push_back(point.Gamma);
+        }
+        REST_AXION_SCOPED_TIMER(standardTime);
+        REST_AXION_COUNT(standardIntegrals, points.size());
+        CoherenceSumBatch(magneticValues.data(), magneticValues.size(), dL, q.data(), Gamma.data(), points.size(), probabilities.data());
+        for (auto& probability : probabilities) probability *= fMap->GetBLFactor();
+        return probabilities;
+    }
+
+    // Batched standard integration along the track of the worker, which is sampled only once
+    std::vector<Double_t> GammaTransmissionProbabilities(const std::vector<ConversionPoint>& points, Double_t dL) const {
+        return GammaTransmissionProbabilities(GetTransversalComponentAlongTrack(dL), dL, points);
+    }
+
+    // Standard integration along the track of the worker
+    Double_t GammaTransmissionProbability(Double_t Ea, Double_t ma, Double_t dL) const {
+        return GammaTransmissionProbability(GetTransversalComponentAlongTrack(dL), dL, Ea, ma);
+    }
+
+    // Step (mm) of the automatic standard integration of a point, from its coherence length and the curvature of
+    // the field along the track
+    Double_t GetCoherenceStep(const ConversionPoint& point, const StepSettings& settings) const {
+        Double_t step = settings.maxStep;
+        const Double_t q = std::abs(MomentumTransfer(point.Ea, point.ma, point.mg));
+        if (q > 0 && settings.samplesPerOscillation > 0) step = std::min(step, 2 * M_PI / q / settings.samplesPerOscillation);
+        const Double_t curvature = GetFieldCurvature(std::min(settings.probeStep, settings.maxStep));
+        if (curvature > 0 && settings.fieldTolerance > 0) step = std::min(step, std::sqrt(8 * settings.fieldTolerance / curvature));
+        return std::max(step, settings.minStep);
+    }
+
+    // Standard integration along the track with the automatic step. The field is sampled every h / 2, h being
+    // the selected step, and the probability with h / 2 is returned with the Richardson estimate of its error,
+    // |P(h / 2) - P(h)|, the sum being first order when the field is not null at the ends of the track (second
+    // order, and the estimate three times the error, when it is). With a relative error target the step is
+    // halved until the estimate meets it
+    std::pair<Double_t, Double_t> GammaTransmissionProbability(const ConversionPoint& point, const StepSettings& settings,
+                                                               StepReport* report = nullptr) const {
+        StepReport result;
+        std::pair<Double_t, Double_t> probability = {0, 0};
+        if (fTrackLength > 0) {
+            const Double_t q = MomentumTransfer(point.Ea, point.ma, point.mg);
+            REST_AXION_SCOPED_TIMER(standardTime);
+            size_t nCells = std::max<size_t>(1, (size_t)std::ceil(fTrackLength / GetCoherenceStep(point, settings)));
+            while (true) {
+                const Double_t h = fTrackLength / (2 * nCells);
+                const std::pair<Double_t, Double_t> pair = RichardsonPair(SampleTrack(2 * nCells), h, q, point.Gamma);
+                REST_AXION_COUNT(standardIntegrals, 2);
+                probability = {pair.second, std::abs(pair.second - pair.first)};
+                result.step = h;
+                result.samples = 2 * nCells + 1;
+                if (settings.relativeError <= 0 || probability.second <= settings.relativeError * probability.first ||
+                    result.refinements >= settings.maxRefinements || h / 2 < settings.minStep)
+                    break;
+                nCells *= 2;
+                result.refinements++;
+            }
+            result.error = probability.second;
+        }
+        if (report != nullptr) *report = result;
+        return probability;
+    }
+
+    // Batched automatic standard integration. The track is sampled once at the finest step of the batch and
+    // every point uses the power-of-two subsampling of it closest below its own step; the points that still
+    // miss the relative error target are refined on their own
+    std::vector<std::pair<Double_t, Double_t>> GammaTransmissionProbabilities(const std::vector<ConversionPoint>& points,
+                                                                              const StepSettings& settings,
+                                                                              std::vector<StepReport>* reports = nullptr) const {
+        std::vector<std::pair<Double_t, Double_t>> probabilities(points.size(), {0, 0});
+        std::vector<StepReport> results(points.size());
+        if (fTrackLength > 0 && !points.empty()) {
+            std::vector<Double_t> steps;
+            for (const auto& point : points) steps.push_back(GetCoherenceStep(point, settings));
+            // Finest grid: cells of half the smallest step, their number a power of two multiple of the coarsest
+            const Double_t minStep = *std::min_element(steps.begin(), steps.end());
+            const size_t nCoarse = std::max<size_t>(1, (size_t)std::ceil(fTrackLength / *std::max_element(steps.begin(), steps.end())));
+            size_t nFine = 2 * nCoarse;
+            while (fTrackLength / nFine > minStep / 2) nFine *= 2;
+            const std::vector<Double_t> fine = SampleTrack(nFine);
+            const Double_t h0 = fTrackLength / nFine;
+
+            REST_AXION_SCOPED_TIMER(standardTime);
+            for (size_t p = 0; p < points.size(); p++) {
+                // Stride of the samples every h / 2 for the step of the point, keeping an even number of cells
+                size_t stride = 1;
+                while (2 * stride * h0 <= steps[p] / 2 && nFine % (4 * stride) == 0) stride *= 2;
+                std::vector<Double_t> samples;
+                for (size_t i = 0; i <= nFine; i += stride) samples.push_back(fine[i]);
+                const Double_t q = MomentumTransfer(points[p].Ea, points[p].ma, points[p].mg);
+                const std::pair<Double_t, Double_t> pair = RichardsonPair(samples, stride * h0, q, points[p].Gamma);
+                REST_AXION_COUNT(standardIntegrals, 2);
+                probabilities[p] = {pair.second, std::abs(pair.second - pair.first)};
+                results[p] = {stride * h0, probabilities[p].second, 0, samples.size()};
+            }
+        }
+        for (size_t p = 0; p < points.size(); p++) {
+            if (settings.relativeError <= 0 || probabilities[p].second <= settings.relativeError * probabilities[p].first) continue;
+            probabilities[p] = GammaTransmissionProbability(points[p], settings, &results[p]);
+        }
+        if (reports != nullptr) *reports = results;
+        return probabilities;
+    }
+
+    // GSL integration along the track of the worker, as TRestAxionField::GammaTransmissionFieldMapProbability.
+    // Returns the probability and its error
+    std::pair<Double_t, Double_t> GammaTransmissionFieldMapProbability(Double_t Ea, Double_t ma) const {
+        return GammaTransmissionFieldMapProbability(GetConversionPoint(Ea, ma));
+    }
+
+    std::pair<Double_t, Double_t> GammaTransmissionFieldMapProbability(const ConversionPoint& point) const {
+        fLastReport = {fSettings.accuracy, fSettings.numIntervals, fSettings.qawoLevels, 0, GSL_SUCCESS, true};
+        if (fTrackLength <= 0) return {0, 0};
+
+        if (fProfileStep > 0) GetProfile();
+
+        Double_t amplitude[2], error[2];
+        const Int_t status = IntegrateAmplitude(point, fSettings.accuracy, 0, fSettings.numIntervals, fSettings.qawoLevels, amplitude, error);
+        fLastReport.attempts = 1;
+        fLastReport.status = status;
+        fLastReport.converged = status == GSL_SUCCESS;
+
+        if (status != GSL_SUCCESS)
+            std::cerr << "Warning: GSL integration returned '" << gsl_strerror(status) << "' for ma: " << point.ma << std::endl;
+
+        return ToProbability(amplitude, error);
+    }
+
+    // Key of the GSL integration of a point in the result cache: the content of the map, the track, the point
+    // (Ea, ma and the photon mass and absorption of the gas) and the integration settings, field level and
+    // tolerance and profile cache of the worker, with the decimation of the pyramid levels when it reads them
+    ULong64_t GetResultKey(const ConversionPoint& point) const {
+        ResultHasher hasher;
+        hasher.Add(std::string("GammaTransmissionFieldMapProbability")).Add(fMap->GetContentHash());
+        hasher.Add(fTrackStart.X()).Add(fTrackStart.Y()).Add(fTrackStart.Z());
+        hasher.Add(fTrackDirection.X()).Add(fTrackDirection.Y()).Add(fTrackDirection.Z()).Add(fTrackLength);
+        hasher.Add(point.Ea).Add(point.ma).Add(point.mg).Add(point.Gamma);
+        hasher.Add(fSettings.accuracy).Add(fSettings.numIntervals).Add(fSettings.qawoLevels);
+        hasher.Add(fFieldLevel).Add(fFieldTolerance).Add(fProfileStep);
+        const FieldPyramid* pyramid = fMap->GetPyramid();
+        if (pyramid && (fFieldLevel > 0 || fFieldTolerance > 0)) {
+            hasher.Add(std::string("Pyramid")).Add((Int_t)pyramid->GetNumberOfLevels());
+            for (size_t l = 0; l < pyramid->GetNumberOfLevels(); l++)
+                for (size_t n = 0; n < pyramid->GetLevel(0)->GetNumberOfVolumes(); n++)
+                    for (const auto& factor : pyramid->GetFactors(l, n)) hasher.Add(factor);
+        }
+        return hasher.GetHash();
+    }
+
+    // GSL integration of a point read from the result cache, or computed and stored in it. If cached is given it
+    // tells whether the result was found, and runtime receives the stored or the measured runtime in ms
+    std::pair<Double_t, Double_t> GammaTransmissionFieldMapProbability(const ConversionPoint& point, ResultCache& cache,
+                                                                       Bool_t* cached = nullptr,
+                                                                       Double_t* runtime = nullptr) const {
+        const ULong64_t key = GetResultKey(point);
+        CachedResult result;
+        const Bool_t found = cache.Find(key, result);
+        if (cached != nullptr) *cached = found;
+        if (found) {
+            if (runtime != nullptr) *runtime = result.runtime;
+            return {result.probability, result.error};
+        }
+        auto start = std::chrono::steady_clock::now();
+        const std::pair<Double_t, Double_t> probability = GammaTransmissionFieldMapProbability(point);
+        result = {probability.first, probability.second,
+                  std::chrono::duration<Double_t, std::milli>(std::chrono::steady_clock::now() - start).count()};
+        cache.Store(key, result);
+        return probability;
+    }
+
+    // Adaptive GSL integration. It starts from the settings of the worker and doubles the number of intervals
+    // when the workspace is exhausted (GSL_EMAXITER), the QAWO levels when the table is (GSL_ETABLE), and
+    // tightens the absolute tolerance of the amplitudes until the error of the probability is within the target.
+    // The settings used are reported, and kept in GetLastIntegrationReport
+    std::pair<Double_t, Double_t> GammaTransmissionFieldMapProbability(const ConversionPoint& point, const IntegrationTarget& target,
+                                                                       IntegrationReport* report = nullptr) const {
+        fLastReport = {0, fSettings.numIntervals, fSettings.qawoLevels, 0, GSL_SUCCESS, true};
+        std::pair<Double_t, Double_t> result = {0, 0};
+        if (fTrackLength <= 0 || (target.absoluteError <= 0 && target.relativeError <= 0)) {
+            if (fTrackLength > 0) std::cerr << "Error: the integration target needs an absolute or a relative error" << std::endl;
+            if (report != nullptr) *report = fLastReport;
+            return result;
+        }
+
+        if (fProfileStep > 0) GetProfile();
+
+        // P = BL |A|^2, so a relative error e on the amplitudes is 2e on the probability, and an absolute error dA
+        // is 2 BL |A| dA. The absolute tolerance of the amplitudes is derived from the running estimate of |A|,
+        // which the first attempt gives at the relative tolerance alone (kEstimateRelative without relative target)
+        const Double_t kMinRelative = 50 * GSL_DBL_EPSILON;
+        const Double_t kEstimateRelative = 1e-3;
+        Double_t epsrel = target.relativeError > 0 ? std::max(target.relativeError / 2, kMinRelative) : kEstimateRelative;
+        Double_t epsabs = 0;
+        Int_t numIntervals = fSettings.numIntervals, qawoLevels = fSettings.qawoLevels;
+
+        Int_t status = GSL_SUCCESS;
+        Bool_t converged = false;
+        Int_t attempts = 0;
+        while (attempts < target.maxAttempts) {
+            Double_t amplitude[2], error[2];
+            status = IntegrateAmplitude(point, epsabs, epsrel, numIntervals, qawoLevels, amplitude, error);
+            attempts++;
+            result = ToProbability(amplitude, error);
+
+            if (status == GSL_EMAXITER && numIntervals < target.maxIntervals) {
+                numIntervals = std::min(2 * numIntervals, target.maxIntervals);
+                continue;
+            }
+            if (status == GSL_ETABLE && qawoLevels < target.maxLevels) {
+                qawoLevels = std::min(2 * qawoLevels, target.maxLevels);
+                continue;
+            }
+            if (status != GSL_SUCCESS) break;
+
+            const Double_t goal = std::max(target.absoluteError, target.relativeError * result.first);
+            if (result.second <= goal) {
+                converged = true;
+                break;
+            }
+            // The amplitude errors enter the probability error weighted by 2 BL |A|, with the current |A|. If the
+            // tolerance from it was not enough, it is halved
+            const Double_t weight = 2 * fMap->GetBLFactor() * std::hypot(amplitude[0], amplitude[1]);
+            Double_t tighter = weight > 0 ? goal / weight : epsabs / 4;
+            if (epsabs > 0 && tighter >= epsabs) tighter = epsabs / 2;
+            if (tighter <= 0) break;
+            epsabs = tighter;
+            epsrel = kMinRelative;
+        }
+
+        fLastReport = {epsabs, numIntervals, qawoLevels, attempts, status, converged};
+        if (!converged)
+            std::cerr << "Warning: adaptive GSL integration did not meet the target for ma: " << point.ma << " ('" << gsl_strerror(status)
+                      << "', intervals: " << numIntervals << ", levels: " << qawoLevels << ")" << std::endl;
+        if (report != nullptr) *report = fLastReport;
+        return result;
+    }
+
+    const IntegrationReport& GetLastIntegrationReport() const { return fLastReport; }
+
+    // Hybrid integration along the track of the worker: analytic on the near-constant segments and exact for
+    // the piecewise-linear fringe. Returns the probability and the estimate of its error
+    std::pair<Double_t, Double_t> GammaTransmissionHybridProbability(Double_t Ea, Double_t ma) const {
+        return GammaTransmissionHybridProbability(GetConversionPoint(Ea, ma));
+    }
+
+    std::pair<Double_t, Double_t> GammaTransmissionHybridProbability(const ConversionPoint& point) const {
+        if (fTrackLength <= 0) return {0, 0};
+        Double_t estimate = 0;
+        const std::complex<Double_t> amplitude =
+            GetHybridProfile().GetAmplitude(MomentumTransfer(point.Ea, point.ma, point.mg), point.Gamma, &estimate);
+        const Double_t modulus = std::abs(amplitude);
+        return {fMap->GetBLFactor() * modulus * modulus, fMap->GetBLFactor() * (2 * modulus + estimate) * estimate};
+    }
+
+    // Batched hybrid integration, the track is segmented once for all the points
+    std::vector<std::pair<Double_t, Double_t>> GammaTransmissionHybridProbabilities(const std::vector<ConversionPoint>& points) const {
+        std::vector<std::pair<Double_t, Double_t>> probabilities;
+        probabilities.reserve(points.size());
+        for (const auto& point : points) probabilities.push_back(GammaTransmissionHybridProbability(point));
+        return probabilities;
+    }
+
+    // Batched GSL integration. QAWO bisects dyadically, so most of the integration nodes are the same for all the
+    // masses and the field is only evaluated once per node. If runTimes is given it is filled with the runtime
+    // of every point in ms
+    std::vector<std::pair<Double_t, Double_t>> GammaTransmissionFieldMapProbabilities(const std::vector<ConversionPoint>& points,
+                                                                                      std::vector<Double_t>* runTimes = nullptr) const {
+        std::vector<std::pair<Double_t, Double_t>> probabilities;
+        probabilities.reserve(points.size());
+        if (runTimes != nullptr) runTimes->clear();
+
+        std::unordered_map<Double_t, Double_t> nodeCache;
+        fNodeCache = &nodeCache;
+        for (const auto& point : points) {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            probabilities.push_back(GammaTransmissionFieldMapProbability(point));
+            auto end_time = std::chrono::high_resolution_clock::now();
+            if (runTimes != nullptr) runTimes->push_back(std::chrono::duration<Double_t, std::milli>(end_time - start_time).count());
+        }
+        fNodeCache = nullptr;
+
+        return probabilities;
+    }
+
+    // Batched adaptive GSL integration, with the settings used for every point in reports if it is given
+    std::vector<std::pair<Double_t, Double_t>> GammaTransmissionFieldMapProbabilities(const std::vector<ConversionPoint>& points,
+                                                                                      const IntegrationTarget& target,
+                                                                                      std::vector<IntegrationReport>* reports = nullptr,
+                                                                                      std::vector<Double_t>* runTimes = nullptr) const {
+        std::vector<std::pair<Double_t, Double_t>> probabilities;
+        probabilities.reserve(points.size());
+        if (reports != nullptr) reports->clear();
+        if (runTimes != nullptr) runTimes->clear();
+
+        std::unordered_map<Double_t, Double_t> nodeCache;
+        fNodeCache = &nodeCache;
+        for (const auto& point : points) {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            probabilities.push_back(GammaTransmissionFieldMapProbability(point, target));
+            auto end_time = std::chrono::high_resolution_clock::now();
+            if (reports != nullptr) reports->push_back(fLastReport);
+            if (runTimes != nullptr) runTimes->push_back(std::chrono::duration<Double_t, std::milli>(end_time - start_time).count());
+        }
+        fNodeCache = nullptr;
+
+        return probabilities;
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef REST_AXION_GSLWORKSPACEPOOL_H
+#define REST_AXION_GSLWORKSPACEPOOL_H
+
+#include <map>
+#include <memory>
+
+#include <Rtypes.h>
+#include <gsl/gsl_integration.h>
+#include "REST_Axion_Instrumentation.h"
+
+//*******************************************************************************************************
+//*** Description: Per-thread pool of GSL integration workspaces and QAWO tables, so that the light
+//*** integrations of the sweeps do not allocate and free them at every call.
+//***
+//*** - Workspaces are kept by size: GetWorkspace(n) returns the smallest pooled workspace of at least n
+//***   intervals, and allocates one of n intervals only when there is none.
+//*** - QAWO tables are kept by number of levels. When only the frequency or the length change the table is
+//***   refreshed with `gsl_integration_qawo_table_set`, and switching between the cosine and the sine
+//***   integrals of the same frequency only flips the weight, since the Chebyshev moments of the table only
+//***   depend on omega L.
+//***
+//*** GSLWorkspacePool::Local() is the pool of the calling thread, it is released when the thread exits. The
+//*** pointers it returns stay valid until the next call of the same thread for the same size.
+//***
+//*** Usage:
+//***   GSLWorkspacePool& pool = GSLWorkspacePool::Local();
+//***   gsl_integration_workspace* workspace = pool.GetWorkspace(100);
+//***   gsl_integration_qawo_table* table = pool.GetTable(q, L, GSL_INTEG_COSINE, 20);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+class GSLWorkspacePool {
+   private:
+    struct WorkspaceDeleter {
+        void operator()(gsl_integration_workspace* workspace) const { gsl_integration_workspace_free(workspace); }
+    };
+    struct TableDeleter {
+        void operator()(gsl_integration_qawo_table* table) const { gsl_integration_qawo_table_free(table); }
+    };
+
+    std::map<size_t, std::unique_ptr<gsl_integration_workspace, WorkspaceDeleter>> fWorkspaces;
+    std::map<size_t, std::unique_ptr<gsl_integration_qawo_table, TableDeleter>> fTables;
+
+    size_t fAllocations = 0;
+    size_t fTableUpdates = 0;
+
+   public:
+    GSLWorkspacePool() = default;
+    GSLWorkspacePool(const GSLWorkspacePool&) = delete;
+    GSLWorkspacePool& operator=(const GSLWorkspacePool&) = delete;
+
+    static GSLWorkspacePool& Local() {
+        thread_local GSLWorkspacePool pool;
+        return pool;
+    }
+
+    gsl_integration_workspace* GetWorkspace(size_t numIntervals) {
+        auto it = fWorkspaces.lower_bound(numIntervals);
+        if (it != fWorkspaces.end()) return it->second.get();
+        fAllocations++;
+        auto& workspace = fWorkspaces[numIntervals];
+        workspace.reset(gsl_integration_workspace_alloc(numIntervals));
+        return workspace.get();
+    }
+
+    gsl_integration_qawo_table* GetTable(Double_t omega, Double_t L, enum gsl_integration_qawo_enum sine, size_t qawoLevels) {
+        auto& table = fTables[qawoLevels];
+        if (!table) {
+            fAllocations++;
+            REST_AXION_COUNT(qawoTableBuilds, 1);
+            table.reset(gsl_integration_qawo_table_alloc(omega, L, sine, qawoLevels));
+        } else if (table->omega != omega || table->L != L) {
+            fTableUpdates++;
+            REST_AXION_COUNT(qawoTableBuilds, 1);
+            gsl_integration_qawo_table_set(table.get(), omega, L, sine);
+        } else {
+            REST_AXION_COUNT(qawoTableReuses, 1);
+            table->sine = sine;
+        }
+        return table.get();
+    }
+
+    // Number of workspaces and tables allocated, and of tables recomputed for a new frequency or length
+    size_t GetNumberOfAllocations() const { return fAllocations; }
+    size_t GetNumberOfTableUpdates() const { return fTableUpdates; }
+
+    void Clear() {
+        fWorkspaces.clear();
+        fTables.clear();
+    }
+};
+
+#endif
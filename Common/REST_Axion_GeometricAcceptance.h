@@ -0,0 +1,108 @@
+#ifndef REST_AXION_GEOMETRICACCEPTANCE_H
+#define REST_AXION_GEOMETRICACCEPTANCE_H
+
+#include <vector>
+#include <cmath>
+
+#include <TVector3.h>
+#include "REST_Axion_WolterPacketTracer.h"
+
+//*******************************************************************************************************
+//*** Description: Cheap geometric pre-check of the ray-tracing events, to skip the field integral of the
+//*** axions that cannot reach the detector.
+//***
+//*** In RayTracing_BabyIAXO.rml the conversion probability is computed before the bore mask (boreExitGate)
+//*** and the optics, so every axion pays the full integral even if its weight optics_efficiency *
+//*** window_transmission * axionPhoton_probability is zero. The straight-line trajectory of the event is
+//*** projected through a list of circular apertures, the 35 cm mask of magnetBoreWindow, and the entrance
+//*** plane of the optics, where it has to fall into the opening of a shell (WolterPacketTracer). The check is
+//*** conservative: every aperture is widened by a margin, so a rejected event has zero acceptance and its
+//*** weight is zero whatever its probability.
+//***
+//*** The optics of the rml can be rotated by its yaw (REST_YAW) and pitch around its centre, as
+//*** TRestAxionOpticsProcess does: the trajectory is then transformed into the frame of the optics before it
+//*** is projected onto the entrance plane. The entrance and spider masks of the optics are not modelled: they
+//*** only block rays inside the openings of the shells, so leaving them out accepts more events and keeps the
+//*** check conservative. The margin is validated by REST_Axion_BatchedFieldPropagation.C, which fails if any
+//*** rejected event has a non-zero optics_efficiency in the run of the chain.
+//***
+//*** Usage:
+//***   GeometricAcceptance acceptance;
+//***   acceptance.AddAperture(0, 350);           // z, radius (mm)
+//***   acceptance.SetOptics(&tracer);           // entrance plane of the optics
+//***   acceptance.SetOpticsRotation(yaw, 0);    // rad
+//***   Bool_t accepted = acceptance.IsAccepted(position, direction);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+class GeometricAcceptance {
+   private:
+    struct Aperture {
+        Double_t z;
+        Double_t radius;
+    };
+
+    std::vector<Aperture> fApertures;
+    const WolterPacketTracer* fOptics = nullptr;
+    // Rotation of the optics around its centre (rad), yaw around the y axis and pitch around the x axis
+    Double_t fYaw = 0;
+    Double_t fPitch = 0;
+    Double_t fMargin = 1;
+
+    // Trajectory in the frame of the optics, centred on its axis at the centre of the optics
+    void ToOpticsFrame(const TVector3& position, const TVector3& direction, TVector3& localPosition, TVector3& localDirection) const {
+        const TVector3 center(0, 0, fOptics->GetCenter());
+        localPosition = position - center;
+        localDirection = direction;
+        localPosition.RotateY(-fYaw);
+        localDirection.RotateY(-fYaw);
+        localPosition.RotateX(-fPitch);
+        localDirection.RotateX(-fPitch);
+        localPosition += center;
+    }
+
+    static Bool_t Project(const TVector3& position, const TVector3& direction, Double_t z, Double_t& x, Double_t& y) {
+        if (direction.Z() <= 0) return false;
+        const Double_t t = (z - position.Z()) / direction.Z();
+        x = position.X() + t * direction.X();
+        y = position.Y() + t * direction.Y();
+        return true;
+    }
+
+   public:
+    // Circular aperture of radius (mm) centered on the axis at z (mm)
+    void AddAperture(Double_t z, Double_t radius) { fApertures.push_back({z, radius}); }
+
+    // The event has to enter a shell of the optics, null disables the check
+    void SetOptics(const WolterPacketTracer* optics) { fOptics = optics; }
+
+    // Yaw and pitch of the optics (rad), the yaw and pitch parameters of TRestAxionOpticsProcess
+    void SetOpticsRotation(Double_t yaw, Double_t pitch = 0) {
+        fYaw = yaw;
+        fPitch = pitch;
+    }
+
+    // Widening (mm) of the apertures and of the openings of the shells, for the differences with the library
+    // geometry
+    void SetMargin(Double_t margin) { fMargin = margin; }
+
+    Bool_t IsEmpty() const { return fApertures.empty() && fOptics == nullptr; }
+
+    Bool_t IsAccepted(const TVector3& position, const TVector3& direction) const {
+        Double_t x, y;
+        for (const auto& aperture : fApertures) {
+            if (!Project(position, direction, aperture.z, x, y)) return false;
+            if (x * x + y * y > (aperture.radius + fMargin) * (aperture.radius + fMargin)) return false;
+        }
+        if (fOptics != nullptr) {
+            TVector3 localPosition, localDirection;
+            ToOpticsFrame(position, direction, localPosition, localDirection);
+            if (!Project(localPosition, localDirection, fOptics->GetEntranceZ(), x, y)) return false;
+            if (fOptics->GetEntranceShell(std::sqrt(x * x + y * y), fMargin) < 0) return false;
+        }
+        return true;
+    }
+};
+
+#endif
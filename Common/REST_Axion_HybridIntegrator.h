@@ -0,0 +1,160 @@
+#ifndef REST_AXION_HYBRIDINTEGRATOR_H
+#define REST_AXION_HYBRIDINTEGRATOR_H
+
+#include <vector>
+#include <cmath>
+#include <complex>
+#include <algorithm>
+#include <functional>
+
+#include <Rtypes.h>
+
+//*******************************************************************************************************
+//*** Description: Hybrid evaluation of the conversion amplitude
+//***   A = int_0^L B_T(l) exp(i q l) exp(-Gamma (L - l) / 2) dl
+//*** over a track split into pieces where B_T is linear in l. On a piece [a, b] the integral of
+//*** (B_a + s (l - a)) exp(c l), c = Gamma / 2 + i q, has a closed form, so the amplitude of any (q, Gamma) is a sum
+//*** over the pieces, without evaluating the field again.
+//***
+//*** The field is sampled every step along the track. The runs of samples within the tolerance of their mean
+//*** (T), at least minSegmentLength long, are the near-constant segments of the bore, and are integrated
+//*** analytically with the sinc-like coherence term of a constant field. The rest, the fringe tails, is split
+//*** into linear pieces, bisected until the midpoint is within the tolerance of the chord, the piecewise-linear
+//*** field being integrated exactly against the oscillation (Filon rule). The error estimate of the amplitude
+//*** is the sum over the pieces of their deviation times their length. The deviations are taken at the samples
+//*** and midpoints only, so it is an estimate and not a bound: a field varying between the samples exceeds it.
+//***
+//*** Usage:
+//***   HybridProfile profile;
+//***   profile.Build(length, settings, [&](Double_t l) { return worker.GetTransversalComponentInParametricTrack(l); });
+//***   std::complex<Double_t> amplitude = profile.GetAmplitude(q, Gamma, &error);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+struct HybridSettings {
+    // Sampling step of the track (mm)
+    Double_t step = 10;
+    // Maximum deviation of B_T from its constant or linear approximation (T)
+    Double_t tolerance = 1e-3;
+    // Minimum length of a near-constant segment (mm)
+    Double_t minSegmentLength = 100;
+    // Maximum bisections of a fringe piece
+    Int_t maxDepth = 8;
+};
+
+class HybridProfile {
+   private:
+    // B_T linear from value at start to value at end; deviation is the estimate of |B_T - line| on the piece
+    struct Piece {
+        Double_t start, end;
+        Double_t startValue, endValue;
+        Double_t deviation;
+    };
+
+    std::vector<Piece> fPieces;
+    Double_t fLength = 0;
+    size_t fConstantSegments = 0;
+    Double_t fConstantLength = 0;
+    size_t fEvaluations = 0;
+
+    void Refine(Double_t a, Double_t b, Double_t Ba, Double_t Bb, Int_t depth, const HybridSettings& settings,
+                const std::function<Double_t(Double_t)>& func) {
+        const Double_t m = (a + b) / 2;
+        const Double_t Bm = func(m);
+        fEvaluations++;
+        const Double_t deviation = std::abs(Bm - (Ba + Bb) / 2);
+        if (deviation > settings.tolerance && depth < settings.maxDepth) {
+            Refine(a, m, Ba, Bm, depth + 1, settings, func);
+            Refine(m, b, Bm, Bb, depth + 1, settings, func);
+            return;
+        }
+        // The two halves through the midpoint deviate about a quarter of the chord
+        fPieces.push_back({a, m, Ba, Bm, deviation / 4});
+        fPieces.push_back({m, b, Bm, Bb, deviation / 4});
+    }
+
+   public:
+    Bool_t IsEmpty() const { return fPieces.empty(); }
+    Double_t GetLength() const { return fLength; }
+    size_t GetNumberOfPieces() const { return fPieces.size(); }
+    size_t GetNumberOfConstantSegments() const { return fConstantSegments; }
+    // Fraction of the track integrated as near-constant segments
+    Double_t GetConstantFraction() const { return fLength > 0 ? fConstantLength / fLength : 0; }
+    // Field evaluations used to build the profile
+    size_t GetNumberOfEvaluations() const { return fEvaluations; }
+
+    void Clear() {
+        fPieces.clear();
+        fLength = fConstantLength = 0;
+        fConstantSegments = fEvaluations = 0;
+    }
+
+    void Build(Double_t length, const HybridSettings& settings, const std::function<Double_t(Double_t)>& func) {
+        Clear();
+        if (length <= 0 || settings.step <= 0) return;
+
+        const size_t nCells = std::max<size_t>(1, (size_t)std::ceil(length / settings.step));
+        const Double_t h = length / nCells;
+        fLength = length;
+        std::vector<Double_t> values(nCells + 1);
+        for (size_t i = 0; i <= nCells; i++) values[i] = func(i * h);
+        fEvaluations = values.size();
+
+        const size_t minCells = std::max<size_t>(1, (size_t)std::ceil(settings.minSegmentLength / h));
+        size_t i = 0;
+        while (i < nCells) {
+            // Longest run from i within 2 tolerance between its extremes
+            Double_t low = values[i], high = values[i];
+            size_t j = i;
+            while (j < nCells) {
+                const Double_t next = values[j + 1];
+                if (std::max(high, next) - std::min(low, next) > 2 * settings.tolerance) break;
+                low = std::min(low, next);
+                high = std::max(high, next);
+                j++;
+            }
+            if (j - i >= minCells) {
+                const Double_t value = (low + high) / 2;
+                fPieces.push_back({i * h, j * h, value, value, (high - low) / 2});
+                fConstantSegments++;
+                fConstantLength += (j - i) * h;
+                i = j;
+            } else {
+                Refine(i * h, (i + 1) * h, values[i], values[i + 1], 0, settings, func);
+                i++;
+            }
+        }
+    }
+
+    // Amplitude in T mm for the momentum transfer q and the absorption Gamma (mm-1). If error is given it
+    // is set to the estimate of the amplitude error
+    std::complex<Double_t> GetAmplitude(Double_t q, Double_t Gamma, Double_t* error = nullptr) const {
+        const std::complex<Double_t> c(Gamma / 2, q);
+        std::complex<Double_t> amplitude = 0;
+        Double_t estimate = 0;
+        for (const auto& piece : fPieces) {
+            const Double_t h = piece.end - piece.start;
+            const std::complex<Double_t> z = c * h;
+            // E1 = int_0^h exp(c u) du, E2 = int_0^h u exp(c u) du, by their series when c h is small
+            std::complex<Double_t> E1, E2;
+            if (std::abs(z) < 1e-3) {
+                E1 = h * (1. + z * (1. / 2 + z * (1. / 6 + z / 24.)));
+                E2 = h * h * (1. / 2 + z * (1. / 3 + z * (1. / 8 + z / 30.)));
+            } else {
+                const std::complex<Double_t> e = std::exp(z);
+                E1 = (e - 1.) / c;
+                E2 = (h * e - E1) / c;
+            }
+            const Double_t slope = (piece.endValue - piece.startValue) / h;
+            // exp(c a) exp(-Gamma L / 2), kept bounded by writing it from the end of the track
+            const std::complex<Double_t> phase = std::exp(-Gamma * (fLength - piece.start) / 2) * std::polar(1., q * piece.start);
+            amplitude += phase * (piece.startValue * E1 + slope * E2);
+            estimate += piece.deviation * h;
+        }
+        if (error != nullptr) *error = estimate;
+        return amplitude;
+    }
+};
+
+#endif
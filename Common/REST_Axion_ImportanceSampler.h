@@ -0,0 +1,177 @@
+#ifndef REST_AXION_IMPORTANCESAMPLER_H
+#define REST_AXION_IMPORTANCESAMPLER_H
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <functional>
+
+#include <Rtypes.h>
+
+//*******************************************************************************************************
+//*** Description: Importance sampling of the solar axion flux in energy and solar-disk radius, as the
+//*** `TRestAxionGeneratorProcess` solarFlux generator of RayTracing_BabyIAXO.rml with a biased proposal.
+//***
+//*** The flux p(E, r) is tabulated on a grid of cells of energy (keV) and radius (fraction of the solar
+//*** radius). The proposal is
+//***   q(E, r) = p(E, r) [lambda + (1 - lambda) a(E) b(r)] / normalisation,
+//*** with a(E) and b(r) the relative acceptance of the chain (optics efficiency times window transmission),
+//*** scaled to a maximum of 1, and lambda the fraction of the natural flux kept in the proposal, which bounds
+//*** the weights by 1 / lambda. A cell is chosen from the cumulative distribution of q and the point is uniform
+//*** inside it, as the generator does within the bins of the flux table, so the importance weight
+//***   w = p(E, r) / q(E, r)
+//*** is constant in every cell and has mean 1 over the proposal. A histogram filled with
+//*** weight="importance_weight*optics_efficiency*window_transmission" estimates the same spectrum as the
+//*** natural flux with weight="optics_efficiency*window_transmission".
+//***
+//*** Usage:
+//***   ImportanceSampler sampler;
+//***   sampler.SetFlux(energies, radii, flux);     // edges and nE x nR values
+//***   sampler.SetAcceptance(aE, bR, 0.1);          // one value per energy and per radius cell, lambda
+//***   ImportanceSample s = sampler.Sample(generator);
+//***   Double_t w = sampler.GetWeight(energy, radius);   // weight of an event generated from GetProposal()
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+struct ImportanceSample {
+    Double_t energy;
+    Double_t radius;
+    Double_t weight;
+};
+
+class ImportanceSampler {
+   private:
+    std::vector<Double_t> fEnergyEdges;
+    std::vector<Double_t> fRadiusEdges;
+    // Flux of every cell, energy major, and acceptance of every energy and radius cell
+    std::vector<Double_t> fFlux;
+    std::vector<Double_t> fEnergyAcceptance;
+    std::vector<Double_t> fRadiusAcceptance;
+    Double_t fLambda = 1;
+
+    // Cumulative distribution of the proposal and weight of every cell
+    std::vector<Double_t> fCumulative;
+    std::vector<Double_t> fWeights;
+
+    size_t GetNumberOfEnergies() const { return fEnergyEdges.empty() ? 0 : fEnergyEdges.size() - 1; }
+    size_t GetNumberOfRadii() const { return fRadiusEdges.empty() ? 0 : fRadiusEdges.size() - 1; }
+
+    void Update() {
+        fCumulative.clear();
+        fWeights.clear();
+        const size_t nE = GetNumberOfEnergies(), nR = GetNumberOfRadii();
+        if (fFlux.size() != nE * nR || fFlux.empty()) return;
+
+        const Double_t maxE = fEnergyAcceptance.empty() ? 0 : *std::max_element(fEnergyAcceptance.begin(), fEnergyAcceptance.end());
+        const Double_t maxR = fRadiusAcceptance.empty() ? 0 : *std::max_element(fRadiusAcceptance.begin(), fRadiusAcceptance.end());
+        std::vector<Double_t> proposal(fFlux.size());
+        Double_t totalFlux = 0, totalProposal = 0;
+        for (size_t e = 0; e < nE; e++) {
+            for (size_t r = 0; r < nR; r++) {
+                const Double_t a = maxE > 0 ? fEnergyAcceptance[e] / maxE : 1;
+                const Double_t b = maxR > 0 ? fRadiusAcceptance[r] / maxR : 1;
+                const size_t c = e * nR + r;
+                proposal[c] = fFlux[c] * (fLambda + (1 - fLambda) * a * b);
+                totalFlux += fFlux[c];
+                totalProposal += proposal[c];
+            }
+        }
+        if (totalFlux <= 0) return;
+
+        fCumulative.resize(fFlux.size());
+        fWeights.resize(fFlux.size());
+        Double_t sum = 0;
+        for (size_t c = 0; c < fFlux.size(); c++) {
+            sum += proposal[c];
+            fCumulative[c] = sum / totalProposal;
+            fWeights[c] = proposal[c] > 0 ? (fFlux[c] / totalFlux) / (proposal[c] / totalProposal) : 0;
+        }
+        fCumulative.back() = 1;
+    }
+
+   public:
+    // Flux on the cells of the energy (keV) and radius edges, values[e * nR + r] for nE x nR cells
+    Bool_t SetFlux(const std::vector<Double_t>& energyEdges, const std::vector<Double_t>& radiusEdges, const std::vector<Double_t>& values) {
+        if (energyEdges.size() < 2 || radiusEdges.size() < 2 || values.size() != (energyEdges.size() - 1) * (radiusEdges.size() - 1)) {
+            std::cerr << "Error: the flux table does not match its edges" << std::endl;
+            return false;
+        }
+        fEnergyEdges = energyEdges;
+        fRadiusEdges = radiusEdges;
+        fFlux = values;
+        fEnergyAcceptance.clear();
+        fRadiusAcceptance.clear();
+        fLambda = 1;
+        Update();
+        return true;
+    }
+
+    // Relative acceptance per energy and radius cell, empty for flat, and fraction lambda in (0, 1] of the
+    // natural flux kept in the proposal
+    Bool_t SetAcceptance(const std::vector<Double_t>& energyAcceptance, const std::vector<Double_t>& radiusAcceptance, Double_t lambda) {
+        if ((!energyAcceptance.empty() && energyAcceptance.size() != GetNumberOfEnergies()) ||
+            (!radiusAcceptance.empty() && radiusAcceptance.size() != GetNumberOfRadii()) || lambda <= 0 || lambda > 1) {
+            std::cerr << "Error: invalid acceptance of the importance sampler" << std::endl;
+            return false;
+        }
+        fEnergyAcceptance = energyAcceptance;
+        fRadiusAcceptance = radiusAcceptance;
+        fLambda = lambda;
+        Update();
+        return true;
+    }
+
+    Bool_t IsEmpty() const { return fCumulative.empty(); }
+    const std::vector<Double_t>& GetEnergyEdges() const { return fEnergyEdges; }
+    const std::vector<Double_t>& GetRadiusEdges() const { return fRadiusEdges; }
+
+    // Largest weight, 1 / lambda at most
+    Double_t GetMaxWeight() const { return fWeights.empty() ? 0 : *std::max_element(fWeights.begin(), fWeights.end()); }
+
+    // Energy and radius cells of a value, -1 outside the table
+    Int_t GetEnergyCell(Double_t energy) const {
+        auto it = std::upper_bound(fEnergyEdges.begin(), fEnergyEdges.end(), energy);
+        if (it == fEnergyEdges.begin() || it == fEnergyEdges.end()) return -1;
+        return it - fEnergyEdges.begin() - 1;
+    }
+    Int_t GetRadiusCell(Double_t radius) const {
+        auto it = std::upper_bound(fRadiusEdges.begin(), fRadiusEdges.end(), radius);
+        if (it == fRadiusEdges.begin() || it == fRadiusEdges.end()) return -1;
+        return it - fRadiusEdges.begin() - 1;
+    }
+
+    // Importance weight of an event of the proposal, 0 outside the table
+    Double_t GetWeight(Double_t energy, Double_t radius) const {
+        const Int_t e = GetEnergyCell(energy), r = GetRadiusCell(radius);
+        if (e < 0 || r < 0 || fWeights.empty()) return 0;
+        return fWeights[e * GetNumberOfRadii() + r];
+    }
+
+    // Proposal of every cell, energy major, with the total of the natural flux and in its units, to be
+    // tabulated as the flux of the generator
+    std::vector<Double_t> GetProposal() const {
+        std::vector<Double_t> proposal(fFlux.size(), 0);
+        for (size_t c = 0; c < fWeights.size(); c++)
+            if (fWeights[c] > 0) proposal[c] = fFlux[c] / fWeights[c];
+        return proposal;
+    }
+
+    template <class Generator>
+    ImportanceSample Sample(Generator& generator) const {
+        std::uniform_real_distribution<Double_t> uniform(0, 1);
+        const size_t nR = GetNumberOfRadii();
+        const size_t c = std::min<size_t>(std::lower_bound(fCumulative.begin(), fCumulative.end(), uniform(generator)) - fCumulative.begin(),
+                                          fCumulative.size() - 1);
+        const size_t e = c / nR, r = c % nR;
+        ImportanceSample sample;
+        sample.energy = fEnergyEdges[e] + uniform(generator) * (fEnergyEdges[e + 1] - fEnergyEdges[e]);
+        sample.radius = fRadiusEdges[r] + uniform(generator) * (fRadiusEdges[r + 1] - fRadiusEdges[r]);
+        sample.weight = fWeights[c];
+        return sample;
+    }
+};
+
+#endif
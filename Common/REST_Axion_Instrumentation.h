@@ -0,0 +1,213 @@
+#ifndef REST_AXION_INSTRUMENTATION_H
+#define REST_AXION_INSTRUMENTATION_H
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+#include <Rtypes.h>
+
+//*******************************************************************************************************
+//*** Description: Compile-time switchable counters and scoped timers of the hot paths of FieldWorker,
+//*** SharedFieldMap and GSLWorkspacePool, to tell where the runtime of an integration goes: field evaluations
+//*** (interpolated or nearest node), GSL integrations and their subintervals, QAWO table builds and reuses,
+//*** track-profile builds and evaluations, node-cache hits and buffer-gas queries.
+//***
+//*** They are only compiled when REST_AXION_INSTRUMENTATION is defined (e.g. `-DREST_AXION_INSTRUMENTATION` in
+//*** ACLiC, or a #define before the first include); otherwise REST_AXION_COUNT and REST_AXION_SCOPED_TIMER
+//*** expand to nothing and GetCounters returns zeros. Every thread counts into its own block, without atomics;
+//*** GetCounters adds the blocks of all the threads, including the ones that have exited, and must be called
+//*** outside the parallel sections. The difference of Local() before and after a call gives the cost of that
+//*** call on the calling thread, as done per event by EventPropagation and per point by RunScan.
+//***
+//*** Usage:
+//***   Instrumentation::Reset();
+//***   worker.GammaTransmissionFieldMapProbability(Ea, ma);
+//***   Instrumentation::Print();
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+struct InstrumentationCounters {
+    // Field evaluations of the map, with interpolation and at the nearest node
+    ULong64_t fieldInterpolated = 0;
+    ULong64_t fieldNearest = 0;
+
+    ULong64_t standardIntegrals = 0;
+    ULong64_t gslIntegrals = 0;
+    // Subintervals used by the GSL integrations (workspace size at the end of every integral)
+    ULong64_t gslSubintervals = 0;
+    // QAWO tables allocated or recomputed for a new frequency or length, and reused as they were
+    ULong64_t qawoTableBuilds = 0;
+    ULong64_t qawoTableReuses = 0;
+
+    // Track-profile splines built, and integrand evaluations served by them
+    ULong64_t profileBuilds = 0;
+    ULong64_t profileHits = 0;
+    // Node cache of the batched GSL integrations
+    ULong64_t nodeCacheHits = 0;
+    ULong64_t nodeCacheMisses = 0;
+
+    // Buffer-gas queries of the library and of the gas table
+    ULong64_t gasQueries = 0;
+    ULong64_t gasTableQueries = 0;
+
+    // Scoped timers (ns)
+    Double_t standardTime = 0;
+    Double_t gslTime = 0;
+    Double_t profileTime = 0;
+
+    ULong64_t GetFieldEvaluations() const { return fieldInterpolated + fieldNearest; }
+
+    InstrumentationCounters& operator+=(const InstrumentationCounters& other) {
+        fieldInterpolated += other.fieldInterpolated;
+        fieldNearest += other.fieldNearest;
+        standardIntegrals += other.standardIntegrals;
+        gslIntegrals += other.gslIntegrals;
+        gslSubintervals += other.gslSubintervals;
+        qawoTableBuilds += other.qawoTableBuilds;
+        qawoTableReuses += other.qawoTableReuses;
+        profileBuilds += other.profileBuilds;
+        profileHits += other.profileHits;
+        nodeCacheHits += other.nodeCacheHits;
+        nodeCacheMisses += other.nodeCacheMisses;
+        gasQueries += other.gasQueries;
+        gasTableQueries += other.gasTableQueries;
+        standardTime += other.standardTime;
+        gslTime += other.gslTime;
+        profileTime += other.profileTime;
+        return *this;
+    }
+
+    // Counts of this block since an earlier copy of it
+    InstrumentationCounters operator-(const InstrumentationCounters& before) const {
+        InstrumentationCounters d = *this;
+        d.fieldInterpolated -= before.fieldInterpolated;
+        d.fieldNearest -= before.fieldNearest;
+        d.standardIntegrals -= before.standardIntegrals;
+        d.gslIntegrals -= before.gslIntegrals;
+        d.gslSubintervals -= before.gslSubintervals;
+        d.qawoTableBuilds -= before.qawoTableBuilds;
+        d.qawoTableReuses -= before.qawoTableReuses;
+        d.profileBuilds -= before.profileBuilds;
+        d.profileHits -= before.profileHits;
+        d.nodeCacheHits -= before.nodeCacheHits;
+        d.nodeCacheMisses -= before.nodeCacheMisses;
+        d.gasQueries -= before.gasQueries;
+        d.gasTableQueries -= before.gasTableQueries;
+        d.standardTime -= before.standardTime;
+        d.gslTime -= before.gslTime;
+        d.profileTime -= before.profileTime;
+        return d;
+    }
+};
+
+class Instrumentation {
+   private:
+    // Block of a thread, registered while the thread lives and added to the retired counts when it exits
+    struct ThreadBlock {
+        InstrumentationCounters counters;
+        ThreadBlock() {
+            std::lock_guard<std::mutex> lock(GetMutex());
+            GetBlocks().push_back(&counters);
+        }
+        ~ThreadBlock() {
+            std::lock_guard<std::mutex> lock(GetMutex());
+            GetRetired() += counters;
+            auto& blocks = GetBlocks();
+            blocks.erase(std::remove(blocks.begin(), blocks.end(), &counters), blocks.end());
+        }
+    };
+
+    static std::mutex& GetMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static std::vector<InstrumentationCounters*>& GetBlocks() {
+        static std::vector<InstrumentationCounters*> blocks;
+        return blocks;
+    }
+    static InstrumentationCounters& GetRetired() {
+        static InstrumentationCounters retired;
+        return retired;
+    }
+
+   public:
+    static constexpr Bool_t IsEnabled() {
+#if defined(REST_AXION_INSTRUMENTATION)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Counters of the calling thread
+    static InstrumentationCounters& Local() {
+        thread_local ThreadBlock block;
+        return block.counters;
+    }
+
+    // Sum over all the threads, to be called outside the parallel sections
+    static InstrumentationCounters GetCounters() {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        InstrumentationCounters total = GetRetired();
+        for (const auto* counters : GetBlocks()) total += *counters;
+        return total;
+    }
+
+    static void Reset() {
+        std::lock_guard<std::mutex> lock(GetMutex());
+        GetRetired() = {};
+        for (auto* counters : GetBlocks()) *counters = {};
+    }
+
+    static void Print(const InstrumentationCounters& c, std::ostream& out = std::cout) {
+        if (!IsEnabled()) {
+            out << "Instrumentation disabled, compile with REST_AXION_INSTRUMENTATION" << std::endl;
+            return;
+        }
+        const Double_t integrals = std::max<ULong64_t>(1, c.standardIntegrals + c.gslIntegrals);
+        out << "Field evaluations: " << c.GetFieldEvaluations() << " (interpolated: " << c.fieldInterpolated << ", nearest: " << c.fieldNearest
+            << "), per integral: " << c.GetFieldEvaluations() / integrals << std::endl;
+        out << "Integrals, standard: " << c.standardIntegrals << " (" << 1e-6 * c.standardTime << " ms), GSL: " << c.gslIntegrals << " ("
+            << 1e-6 * c.gslTime << " ms)" << std::endl;
+        out << "GSL subintervals: " << c.gslSubintervals << ", per integral: " << c.gslSubintervals / std::max<Double_t>(1, c.gslIntegrals)
+            << std::endl;
+        out << "QAWO tables, built: " << c.qawoTableBuilds << ", reused: " << c.qawoTableReuses << std::endl;
+        out << "Profile cache, builds: " << c.profileBuilds << " (" << 1e-6 * c.profileTime << " ms), hits: " << c.profileHits << std::endl;
+        out << "Node cache, hits: " << c.nodeCacheHits << ", misses: " << c.nodeCacheMisses << std::endl;
+        out << "Buffer gas, library: " << c.gasQueries << ", table: " << c.gasTableQueries << std::endl;
+    }
+
+    static void Print(std::ostream& out = std::cout) { Print(GetCounters(), out); }
+};
+
+#if defined(REST_AXION_INSTRUMENTATION)
+
+// Adds the elapsed time (ns) to a timer of the thread counters when it goes out of scope
+class InstrumentationTimer {
+   private:
+    Double_t& fTimer;
+    std::chrono::steady_clock::time_point fStart;
+
+   public:
+    explicit InstrumentationTimer(Double_t& timer) : fTimer(timer), fStart(std::chrono::steady_clock::now()) {}
+    ~InstrumentationTimer() { fTimer += std::chrono::duration<Double_t, std::nano>(std::chrono::steady_clock::now() - fStart).count(); }
+};
+
+#define REST_AXION_CONCAT_(a, b) a##b
+#define REST_AXION_CONCAT(a, b) REST_AXION_CONCAT_(a, b)
+#define REST_AXION_COUNT(counter, n) (Instrumentation::Local().counter += (n))
+#define REST_AXION_SCOPED_TIMER(timer) InstrumentationTimer REST_AXION_CONCAT(restAxionTimer, __LINE__)(Instrumentation::Local().timer)
+
+#else
+
+#define REST_AXION_COUNT(counter, n) ((void)0)
+#define REST_AXION_SCOPED_TIMER(timer)
+
+#endif
+
+#endif
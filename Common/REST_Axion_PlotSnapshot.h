@@ -0,0 +1,323 @@
+#ifndef REST_AXION_PLOTSNAPSHOT_H
+#define REST_AXION_PLOTSNAPSHOT_H
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <algorithm>
+
+#include <Rtypes.h>
+#include <TXMLEngine.h>
+#include <TFile.h>
+#include <TNamed.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <ROOT/RDataFrame.hxx>
+
+//*******************************************************************************************************
+//*** Description: Single-pass filling of the histograms of a TRestDataSetPlot rml (PlotOpticsDataSet.rml,
+//*** PlotObservablesDataSet.rml) and compact snapshot of them in a ROOT file.
+//***
+//*** The rml is read as TRestDataSetPlot does: the canvas size and divisions, the TRestCut definitions, the
+//*** global addCut, and the plots, each one with its <histo> entries or with its own <variable> entries
+//*** (one variable for a 1D histogram, two for a 2D one). The cuts of a histogram are the global ones, those of
+//*** its plot and its own, an addCut with value="OFF" removing a cut of an outer level. All the histograms are
+//*** booked on one RDataFrame, with the cuts as shared filters and the weights as defined columns, so the
+//*** dataset is read only once for all of them.
+//***
+//*** The snapshot has one directory per plot, in the order of the pads, with its histograms in the order of
+//*** drawing. The fill colour, the axis titles and the draw option (TH1::SetOption) are kept in the histograms,
+//*** the log scale in a "logscale" entry of the directory, and the canvas in the "layout" entry, "width height
+//*** nx ny". RayTracing/REST_Axion_DrawDataSetPlot.C draws it.
+//***
+//*** Usage:
+//***   PlotSnapshot snapshot;
+//***   snapshot.ReadPlot("PlotOpticsDataSet.rml");
+//***   snapshot.Fill("DataSet.root");
+//***   snapshot.Write("OpticsSolarFluxDataSet_Observables_rayTracing.root");
+//***
+//*** Dependencies:
+//*** ROOT TXMLEngine and RDataFrame.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+struct PlotVariable {
+    std::string name;
+    Int_t nBins = 100;
+    Double_t min = 0;
+    Double_t max = 1;
+};
+
+struct PlotHisto {
+    std::string name;
+    std::string weight;
+    std::string option;
+    Int_t fillColor = -1;
+    std::vector<PlotVariable> variables;
+    // Cut name and state, value="ON" or "OFF"
+    std::vector<std::pair<std::string, Bool_t>> cuts;
+};
+
+struct PlotDefinition {
+    std::string name;
+    std::string title;
+    std::string xLabel;
+    std::string yLabel;
+    Bool_t logScale = false;
+    Bool_t stats = true;
+    std::vector<std::pair<std::string, Bool_t>> cuts;
+    std::vector<PlotHisto> histos;
+};
+
+class PlotSnapshot {
+   private:
+    Int_t fWidth = 800;
+    Int_t fHeight = 600;
+    Int_t fDivisionsX = 1;
+    Int_t fDivisionsY = 1;
+    std::string fOutputFileName;
+    std::vector<std::pair<std::string, Bool_t>> fGlobalCuts;
+    std::map<std::string, std::vector<std::string>> fCutDefinitions;
+    std::vector<PlotDefinition> fPlots;
+
+    // Filled histograms, one list per plot
+    std::vector<std::vector<std::shared_ptr<TH1>>> fHistograms;
+
+    static std::string GetAttribute(TXMLEngine& xml, XMLNodePointer_t node, const char* name, const std::string& defaultValue = "") {
+        const char* value = xml.GetAttr(node, name);
+        return value == nullptr ? defaultValue : value;
+    }
+
+    // "(a,b)" as two numbers
+    static std::pair<Double_t, Double_t> ParsePair(const std::string& text) {
+        std::string clean;
+        for (const char c : text)
+            if (c != '(' && c != ')' && c != ' ') clean += (c == ',' ? ' ' : c);
+        std::stringstream stream(clean);
+        Double_t a = 0, b = 0;
+        stream >> a >> b;
+        return {a, b};
+    }
+
+    static void ReadCut(TXMLEngine& xml, XMLNodePointer_t node, std::vector<std::pair<std::string, Bool_t>>& cuts) {
+        const std::string value = GetAttribute(xml, node, "value", "ON");
+        cuts.push_back({GetAttribute(xml, node, "name"), value != "OFF"});
+    }
+
+    static PlotVariable ReadVariable(TXMLEngine& xml, XMLNodePointer_t node) {
+        PlotVariable variable;
+        variable.name = GetAttribute(xml, node, "name");
+        variable.nBins = std::stoi(GetAttribute(xml, node, "nbins", "100"));
+        const std::pair<Double_t, Double_t> range = ParsePair(GetAttribute(xml, node, "range", "(0,1)"));
+        variable.min = range.first;
+        variable.max = range.second;
+        return variable;
+    }
+
+    // Conjunction of the cuts enabled at the global, plot and histogram levels
+    std::string GetFilter(const PlotDefinition& plot, const PlotHisto& histo) const {
+        std::map<std::string, Bool_t> state;
+        std::vector<std::string> order;
+        for (const auto* level : {&fGlobalCuts, &plot.cuts, &histo.cuts}) {
+            for (const auto& cut : *level) {
+                if (state.count(cut.first) == 0) order.push_back(cut.first);
+                state[cut.first] = cut.second;
+            }
+        }
+        std::string filter;
+        for (const auto& name : order) {
+            if (!state[name]) continue;
+            auto it = fCutDefinitions.find(name);
+            if (it == fCutDefinitions.end()) {
+                std::cerr << "Warning: cut " << name << " is not defined" << std::endl;
+                continue;
+            }
+            for (const auto& condition : it->second) filter += (filter.empty() ? "(" : " && (") + condition + ")";
+        }
+        return filter;
+    }
+
+   public:
+    Bool_t ReadPlot(const std::string& filename) {
+        TXMLEngine xml;
+        XMLDocPointer_t document = xml.ParseFile(filename.c_str());
+        if (document == nullptr) {
+            std::cerr << "Error: Unable to parse " << filename << std::endl;
+            return false;
+        }
+        XMLNodePointer_t plot = xml.GetChild(xml.DocGetRootElement(document));
+        while (plot != nullptr && std::string(xml.GetNodeName(plot)) != "TRestDataSetPlot") plot = xml.GetNext(plot);
+        if (plot == nullptr) {
+            std::cerr << "Error: no TRestDataSetPlot in " << filename << std::endl;
+            xml.FreeDoc(document);
+            return false;
+        }
+
+        const std::pair<Double_t, Double_t> size = ParsePair(GetAttribute(xml, plot, "canvasSize", "(800,600)"));
+        const std::pair<Double_t, Double_t> divisions = ParsePair(GetAttribute(xml, plot, "canvasDivisions", "(1,1)"));
+        fWidth = size.first;
+        fHeight = size.second;
+        fDivisionsX = std::max(1., divisions.first);
+        fDivisionsY = std::max(1., divisions.second);
+        fOutputFileName = GetAttribute(xml, plot, "outputFileName");
+        fGlobalCuts.clear();
+        fCutDefinitions.clear();
+        fPlots.clear();
+
+        for (XMLNodePointer_t node = xml.GetChild(plot); node != nullptr; node = xml.GetNext(node)) {
+            const std::string type = xml.GetNodeName(node);
+            if (type == "addCut") {
+                ReadCut(xml, node, fGlobalCuts);
+            } else if (type == "TRestCut") {
+                std::vector<std::string>& conditions = fCutDefinitions[GetAttribute(xml, node, "name")];
+                for (XMLNodePointer_t cut = xml.GetChild(node); cut != nullptr; cut = xml.GetNext(cut))
+                    if (std::string(xml.GetNodeName(cut)) == "cut")
+                        conditions.push_back(GetAttribute(xml, cut, "variable") + GetAttribute(xml, cut, "condition"));
+            } else if (type == "plot" && GetAttribute(xml, node, "value", "ON") != "OFF") {
+                PlotDefinition definition;
+                definition.name = GetAttribute(xml, node, "name");
+                definition.title = GetAttribute(xml, node, "title");
+                definition.xLabel = GetAttribute(xml, node, "xlabel");
+                definition.yLabel = GetAttribute(xml, node, "ylabel");
+                definition.logScale = GetAttribute(xml, node, "logscale", "false") == "true";
+                definition.stats = GetAttribute(xml, node, "stats", "ON") != "OFF";
+
+                // Variables of the plot itself make one histogram named after it
+                PlotHisto own;
+                own.name = definition.name.empty() ? "plot" + std::to_string(fPlots.size()) : definition.name;
+                for (XMLNodePointer_t child = xml.GetChild(node); child != nullptr; child = xml.GetNext(child)) {
+                    const std::string childType = xml.GetNodeName(child);
+                    if (childType == "variable") {
+                        own.variables.push_back(ReadVariable(xml, child));
+                    } else if (childType == "addCut") {
+                        ReadCut(xml, child, definition.cuts);
+                    } else if (childType == "histo") {
+                        PlotHisto histo;
+                        histo.name = GetAttribute(xml, child, "name");
+                        histo.weight = GetAttribute(xml, child, "weight");
+                        histo.option = GetAttribute(xml, child, "option");
+                        for (XMLNodePointer_t entry = xml.GetChild(child); entry != nullptr; entry = xml.GetNext(entry)) {
+                            const std::string entryType = xml.GetNodeName(entry);
+                            if (entryType == "variable")
+                                histo.variables.push_back(ReadVariable(xml, entry));
+                            else if (entryType == "addCut")
+                                ReadCut(xml, entry, histo.cuts);
+                            else if (entryType == "parameter" && GetAttribute(xml, entry, "name") == "fillColor")
+                                histo.fillColor = std::stoi(GetAttribute(xml, entry, "value", "-1"));
+                        }
+                        definition.histos.push_back(histo);
+                    }
+                }
+                if (own.variables.size() == 2) own.option = "colz";
+                if (!own.variables.empty()) definition.histos.insert(definition.histos.begin(), own);
+                fPlots.push_back(definition);
+            }
+        }
+        xml.FreeDoc(document);
+        return !fPlots.empty();
+    }
+
+    const std::vector<PlotDefinition>& GetPlots() const { return fPlots; }
+
+    // outputFileName of the rml, the canvas macro that TRestDataSetPlot would write
+    const std::string& GetOutputFileName() const { return fOutputFileName; }
+
+    size_t GetNumberOfHistograms() const {
+        size_t n = 0;
+        for (const auto& plot : fPlots) n += plot.histos.size();
+        return n;
+    }
+
+    // Fills all the histograms in one pass over the AnalysisTree of the dataset files
+    Bool_t Fill(const std::vector<std::string>& files, const std::string& treeName = "AnalysisTree") {
+        fHistograms.clear();
+        ROOT::RDataFrame frame(treeName, files);
+        std::map<std::string, ROOT::RDF::RNode> filters;
+        std::vector<std::vector<ROOT::RDF::RResultPtr<TH1D>>> histos1D(fPlots.size());
+        std::vector<std::vector<ROOT::RDF::RResultPtr<TH2D>>> histos2D(fPlots.size());
+        std::vector<std::vector<Int_t>> dimensions(fPlots.size());
+
+        size_t weightIndex = 0;
+        for (size_t p = 0; p < fPlots.size(); p++) {
+            for (const auto& histo : fPlots[p].histos) {
+                const std::string filter = GetFilter(fPlots[p], histo);
+                auto it = filters.find(filter);
+                if (it == filters.end()) {
+                    ROOT::RDF::RNode node = frame;
+                    if (!filter.empty()) node = node.Filter(filter, filter);
+                    it = filters.emplace(filter, node).first;
+                }
+                ROOT::RDF::RNode node = it->second;
+                std::string weight;
+                if (!histo.weight.empty()) {
+                    weight = "plotWeight" + std::to_string(weightIndex++);
+                    node = node.Define(weight, histo.weight);
+                }
+
+                const std::string title = fPlots[p].title + ";" + fPlots[p].xLabel + ";" + fPlots[p].yLabel;
+                if (histo.variables.size() == 1) {
+                    const PlotVariable& x = histo.variables[0];
+                    const ROOT::RDF::TH1DModel model(histo.name.c_str(), title.c_str(), x.nBins, x.min, x.max);
+                    histos1D[p].push_back(weight.empty() ? node.Histo1D(model, x.name) : node.Histo1D(model, x.name, weight));
+                    dimensions[p].push_back(1);
+                } else if (histo.variables.size() == 2) {
+                    const PlotVariable &x = histo.variables[0], &y = histo.variables[1];
+                    const ROOT::RDF::TH2DModel model(histo.name.c_str(), title.c_str(), x.nBins, x.min, x.max, y.nBins, y.min, y.max);
+                    histos2D[p].push_back(weight.empty() ? node.Histo2D(model, x.name, y.name) : node.Histo2D(model, x.name, y.name, weight));
+                    dimensions[p].push_back(2);
+                } else {
+                    std::cerr << "Warning: histogram " << histo.name << " has " << histo.variables.size() << " variables, skipped" << std::endl;
+                    dimensions[p].push_back(0);
+                }
+            }
+        }
+
+        // The first result runs the event loop for all of them
+        fHistograms.resize(fPlots.size());
+        for (size_t p = 0; p < fPlots.size(); p++) {
+            size_t i1 = 0, i2 = 0;
+            for (size_t h = 0; h < fPlots[p].histos.size(); h++) {
+                std::shared_ptr<TH1> histogram;
+                if (dimensions[p][h] == 1) histogram = std::shared_ptr<TH1>(static_cast<TH1*>(histos1D[p][i1++]->Clone()));
+                if (dimensions[p][h] == 2) histogram = std::shared_ptr<TH1>(static_cast<TH1*>(histos2D[p][i2++]->Clone()));
+                if (!histogram) continue;
+                histogram->SetDirectory(nullptr);
+                histogram->SetOption(fPlots[p].histos[h].option.c_str());
+                histogram->SetStats(fPlots[p].stats);
+                if (fPlots[p].histos[h].fillColor >= 0) histogram->SetFillColor(fPlots[p].histos[h].fillColor);
+                fHistograms[p].push_back(histogram);
+            }
+        }
+        return true;
+    }
+
+    Bool_t Fill(const std::string& file, const std::string& treeName = "AnalysisTree") {
+        return Fill(std::vector<std::string>{file}, treeName);
+    }
+
+    Bool_t Write(const std::string& filename) const {
+        auto file = std::make_unique<TFile>(filename.c_str(), "RECREATE");
+        if (file->IsZombie()) {
+            std::cerr << "Error: Unable to open " << filename << " for writing" << std::endl;
+            return false;
+        }
+        std::ostringstream layout;
+        layout << fWidth << " " << fHeight << " " << fDivisionsX << " " << fDivisionsY;
+        TNamed("layout", layout.str().c_str()).Write();
+        for (size_t p = 0; p < fHistograms.size(); p++) {
+            TDirectory* directory = file->mkdir(("pad" + std::to_string(p)).c_str(), fPlots[p].name.c_str());
+            directory->cd();
+            if (fPlots[p].logScale) TNamed("logscale", "true").Write();
+            for (const auto& histogram : fHistograms[p]) histogram->Write();
+            file->cd();
+        }
+        file->Close();
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef REST_AXION_PROBABILITYTABLE_H
+#define REST_AXION_PROBABILITYTABLE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <TVector3.h>
+#include "REST_Axion_ThreadPool.h"
+#include "REST_Axion_FieldWorker.h"
+
+//*******************************************************************************************************
+//*** Description: Lookup table of the conversion probability P(x, y, theta_x, theta_y, Ea) of the ray-tracing
+//*** chain for one axion mass and buffer gas, so that the propagation of the events interpolates the table
+//*** instead of integrating every event.
+//***
+//*** The axes are the entrance position (x, y) in mm on the plane z = entranceZ, the slopes of the direction
+//*** theta_x = dx/dz and theta_y = dy/dz, and the energy in keV. The table is built on a uniform grid of every
+//*** axis: the field is sampled once per (x, y, theta_x, theta_y) track and all the energies of the track are
+//*** evaluated in the same batch (FieldWorker::GammaTransmissionProbabilities), with the tracks distributed over
+//*** a pool of threads. The values are interpolated multilinearly in the 5 axes.
+//***
+//*** The tables are persisted in a versioned binary file (magic "RESTAXPT") with the axes, the mass, the gas,
+//*** the field name and the integration step, and Validate compares the interpolated values against the exact
+//*** integration at random points inside the table.
+//***
+//*** Usage:
+//***   ProbabilityTable table;
+//***   table.SetAxis(ProbabilityTable::kX, -350, 350, 36);
+//***   table.Build(map, "He", 2.9836e-10, 1e-3, 50);
+//***   table.Write("babyIAXO_2024_cutoff_1e-3eV.axlut");
+//***   Double_t P = table.GetProbability(position, direction, Ea);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+constexpr char kProbabilityTableMagic[8] = {'R', 'E', 'S', 'T', 'A', 'X', 'P', 'T'};
+constexpr uint32_t kProbabilityTableVersion = 1;
+
+// Uniform axis of the table, stored as is in the files
+struct TableAxis {
+    double min;
+    double max;
+    int32_t n;
+
+    double GetStep() const { return n > 1 ? (max - min) / (n - 1) : 0; }
+    double GetNode(int32_t i) const { return min + i * GetStep(); }
+    bool IsInside(double value) const { return value >= min && value <= max; }
+};
+
+struct ProbabilityTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nAxes;
+    TableAxis axes[5];
+    double ma;
+    double gasDensity;
+    double entranceZ;
+    double integrationStep;
+    char fieldName[64];
+    char gasName[32];
+    uint64_t nValues;
+};
+
+class ProbabilityTable {
+   public:
+    enum Axis { kX = 0, kY = 1, kThetaX = 2, kThetaY = 3, kEnergy = 4 };
+
+   private:
+    std::array<TableAxis, 5> fAxes;
+    std::array<size_t, 5> fStrides;
+    std::vector<float> fValues;
+
+    std::string fFieldName;
+    std::string fGasName;
+    Double_t fMass = 0;
+    Double_t fGasDensity = 0;
+    Double_t fEntranceZ = -11000;
+    Double_t fIntegrationStep = 50;
+
+    void ComputeStrides() {
+        size_t stride = 1;
+        for (Int_t a = 4; a >= 0; a--) {
+            fStrides[a] = stride;
+            stride *= fAxes[a].n;
+        }
+    }
+
+    size_t GetNumberOfValues() const {
+        size_t n = 1;
+        for (const auto& axis : fAxes) n *= axis.n;
+        return n;
+    }
+
+   public:
+    ProbabilityTable() {
+        fAxes[kX] = {-350, 350, 36};
+        fAxes[kY] = {-350, 350, 36};
+        fAxes[kThetaX] = {-0.005, 0.005, 5};
+        fAxes[kThetaY] = {-0.005, 0.005, 5};
+        fAxes[kEnergy] = {0.1, 10, 100};
+        ComputeStrides();
+    }
+
+    void SetAxis(Axis axis, Double_t min, Double_t max, Int_t n) {
+        fAxes[axis] = {min, max, std::max(1, n)};
+        ComputeStrides();
+        fValues.clear();
+    }
+
+    // Plane of the entrance positions of the events, in mm
+    void SetEntranceZ(Double_t z) { fEntranceZ = z; }
+
+    const TableAxis& GetAxis(Axis axis) const { return fAxes[axis]; }
+    Bool_t IsEmpty() const { return fValues.empty(); }
+    Double_t GetMass() const { return fMass; }
+    Double_t GetEntranceZ() const { return fEntranceZ; }
+    const std::string& GetFieldName() const { return fFieldName; }
+    size_t GetMemorySize() const { return fValues.size() * sizeof(float); }
+
+    // Coordinates of the table of an event, the position is moved along its direction to the entrance plane
+    std::array<Double_t, 5> GetCoordinates(const TVector3& position, const TVector3& direction, Double_t Ea) const {
+        const Double_t tx = direction.Z() != 0 ? direction.X() / direction.Z() : 1e30;
+        const Double_t ty = direction.Z() != 0 ? direction.Y() / direction.Z() : 1e30;
+        const Double_t dz = fEntranceZ - position.Z();
+        return {position.X() + tx * dz, position.Y() + ty * dz, tx, ty, Ea};
+    }
+
+    Bool_t IsInside(const std::array<Double_t, 5>& coordinates) const {
+        if (fValues.empty()) return false;
+        for (Int_t a = 0; a < 5; a++)
+            if (!fAxes[a].IsInside(coordinates[a])) return false;
+        return true;
+    }
+
+    Bool_t IsInside(const TVector3& position, const TVector3& direction, Double_t Ea, Double_t ma) const {
+        return std::abs(ma - fMass) <= 1e-9 * std::max(1., std::abs(fMass)) && IsInside(GetCoordinates(position, direction, Ea));
+    }
+
+    // Multilinear interpolation of the 32 nodes around the coordinates, clamped to the table
+    Double_t Interpolate(const std::array<Double_t, 5>& coordinates) const {
+        if (fValues.empty()) return 0;
+        size_t base = 0;
+        std::array<Double_t, 5> weights;
+        std::array<size_t, 5> offsets;
+        for (Int_t a = 0; a < 5; a++) {
+            const TableAxis& axis = fAxes[a];
+            if (axis.n < 2) {
+                weights[a] = 0;
+                offsets[a] = 0;
+                continue;
+            }
+            const Double_t u = std::min(std::max((coordinates[a] - axis.min) / axis.GetStep(), 0.), (Double_t)(axis.n - 1));
+            const Int_t i = std::min((Int_t)u, axis.n - 2);
+            weights[a] = u - i;
+            offsets[a] = fStrides[a];
+            base += i * fStrides[a];
+        }
+
+        Double_t value = 0;
+        for (Int_t corner = 0; corner < 32; corner++) {
+            Double_t weight = 1;
+            size_t index = base;
+            for (Int_t a = 0; a < 5; a++) {
+                const Bool_t upper = (corner >> a) & 1;
+                if (upper && offsets[a] == 0) {
+                    weight = 0;
+                    break;
+                }
+                weight *= upper ? weights[a] : 1 - weights[a];
+                if (upper) index += offsets[a];
+            }
+            if (weight != 0) value += weight * fValues[index];
+        }
+        return value;
+    }
+
+    Double_t GetProbability(const TVector3& position, const TVector3& direction, Double_t Ea) const {
+        return Interpolate(GetCoordinates(position, direction, Ea));
+    }
+
+    // Evaluates every node of the table with the standard integration every integrationStep (mm), or the GSL
+    // integration of the worker settings if it is 0
+    void Build(const SharedFieldMap* map, const std::string& gasName, Double_t gasDensity, Double_t ma, Double_t integrationStep,
+               UInt_t nThreads = 0) {
+        fFieldName = map->GetFieldName();
+        fGasName = gasName;
+        fGasDensity = gasDensity;
+        fMass = ma;
+        fIntegrationStep = integrationStep;
+        fValues.assign(GetNumberOfValues(), 0.f);
+
+        const size_t nTracks = fValues.size() / fAxes[kEnergy].n;
+        nThreads = GetNumberOfThreads(nThreads, nTracks);
+        std::vector<std::pair<Double_t, Double_t>> energyMassPairs;
+        for (Int_t e = 0; e < fAxes[kEnergy].n; e++) energyMassPairs.push_back({fAxes[kEnergy].GetNode(e), ma});
+
+        // The conversion points of the energy axis are the same for all the tracks
+        std::vector<std::unique_ptr<FieldWorker>> workers;
+        for (UInt_t w = 0; w < nThreads; w++) {
+            workers.push_back(std::make_unique<FieldWorker>(map));
+            workers.back()->SetBufferGas(gasName, gasDensity);
+        }
+        const std::vector<ConversionPoint> points = workers[0]->GetConversionPoints(energyMassPairs);
+
+        ParallelFor(nTracks, nThreads, [&](size_t track, UInt_t w) {
+            size_t remainder = track;
+            std::array<Int_t, 4> node;
+            for (Int_t a = 3; a >= 0; a--) {
+                node[a] = remainder % fAxes[a].n;
+                remainder /= fAxes[a].n;
+            }
+            const TVector3 position(fAxes[kX].GetNode(node[kX]), fAxes[kY].GetNode(node[kY]), fEntranceZ);
+            const TVector3 direction = TVector3(fAxes[kThetaX].GetNode(node[kThetaX]), fAxes[kThetaY].GetNode(node[kThetaY]), 1).Unit();
+
+            FieldWorker& worker = *workers[w];
+            worker.SetTrack(position, direction);
+            if (worker.GetTrackLength() <= 0) return;
+
+            std::vector<Double_t> probabilities;
+            if (integrationStep > 0) {
+                probabilities = worker.GammaTransmissionProbabilities(points, integrationStep);
+            } else {
+                for (const auto& probability : worker.GammaTransmissionFieldMapProbabilities(points))
+                    probabilities.push_back(probability.first);
+            }
+            float* values = fValues.data() + track * fAxes[kEnergy].n;
+            for (size_t e = 0; e < probabilities.size(); e++) values[e] = probabilities[e];
+        });
+    }
+
+    Bool_t Write(const std::string& filename) const {
+        ProbabilityTableHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, kProbabilityTableMagic, sizeof(header.magic));
+        header.version = kProbabilityTableVersion;
+        header.nAxes = 5;
+        for (Int_t a = 0; a < 5; a++) header.axes[a] = fAxes[a];
+        header.ma = fMass;
+        header.gasDensity = fGasDensity;
+        header.entranceZ = fEntranceZ;
+        header.integrationStep = fIntegrationStep;
+        std::strncpy(header.fieldName, fFieldName.c_str(), sizeof(header.fieldName) - 1);
+        std::strncpy(header.gasName, fGasName.c_str(), sizeof(header.gasName) - 1);
+        header.nValues = fValues.size();
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Error: unable to write the probability table " << filename << std::endl;
+            return false;
+        }
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)fValues.data(), fValues.size() * sizeof(float));
+        return file.good();
+    }
+
+    // Reads a table, returns false if it is missing or of another version
+    Bool_t Read(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: unable to open the probability table " << filename << std::endl;
+            return false;
+        }
+        ProbabilityTableHeader header;
+        file.read((char*)&header, sizeof(header));
+        if (!file.good() || std::memcmp(header.magic, kProbabilityTableMagic, sizeof(header.magic)) != 0 ||
+            header.version != kProbabilityTableVersion || header.nAxes != 5) {
+            std::cerr << "Error: " << filename << " is not a probability table of version " << kProbabilityTableVersion << std::endl;
+            return false;
+        }
+        for (Int_t a = 0; a < 5; a++) fAxes[a] = header.axes[a];
+        ComputeStrides();
+        if (header.nValues != GetNumberOfValues()) {
+            std::cerr << "Error: " << filename << " is truncated" << std::endl;
+            fValues.clear();
+            return false;
+        }
+        fMass = header.ma;
+        fGasDensity = header.gasDensity;
+        fEntranceZ = header.entranceZ;
+        fIntegrationStep = header.integrationStep;
+        fFieldName = std::string(header.fieldName, strnlen(header.fieldName, sizeof(header.fieldName)));
+        fGasName = std::string(header.gasName, strnlen(header.gasName, sizeof(header.gasName)));
+        fValues.resize(header.nValues);
+        file.read((char*)fValues.data(), fValues.size() * sizeof(float));
+        if (!file.good()) {
+            std::cerr << "Error: " << filename << " is truncated" << std::endl;
+            fValues.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // True if the table was built for this field, gas and mass
+    Bool_t Matches(const std::string& fieldName, const std::string& gasName, Double_t gasDensity, Double_t ma) const {
+        return !fValues.empty() && fieldName == fFieldName && gasName == fGasName &&
+               std::abs(gasDensity - fGasDensity) <= 1e-9 * std::abs(fGasDensity) && std::abs(ma - fMass) <= 1e-9 * std::max(1., std::abs(fMass));
+    }
+
+    struct Validation {
+        size_t nPoints = 0;
+        Double_t maxAbsoluteError = 0;
+        Double_t maxRelativeError = 0;
+        Double_t meanRelativeError = 0;
+    };
+
+    // Compares the table against the exact integration at nPoints random points inside it. The relative error is
+    // taken with respect to the maximum probability of the sample, P vanishes at the zeros of the coherence
+    Validation Validate(const SharedFieldMap* map, size_t nPoints, UInt_t seed = 1) const {
+        Validation validation;
+        if (fValues.empty()) return validation;
+
+        FieldWorker worker(map);
+        worker.SetBufferGas(fGasName, fGasDensity);
+        std::mt19937_64 generator(seed);
+        std::vector<Double_t> exact, interpolated;
+        for (size_t i = 0; i < nPoints; i++) {
+            std::array<Double_t, 5> coordinates;
+            for (Int_t a = 0; a < 5; a++) coordinates[a] = std::uniform_real_distribution<Double_t>(fAxes[a].min, fAxes[a].max)(generator);
+            const TVector3 position(coordinates[kX], coordinates[kY], fEntranceZ);
+            const TVector3 direction = TVector3(coordinates[kThetaX], coordinates[kThetaY], 1).Unit();
+            worker.SetTrack(position, direction);
+            Double_t probability = 0;
+            if (worker.GetTrackLength() > 0)
+                probability = fIntegrationStep > 0 ? worker.GammaTransmissionProbability(coordinates[kEnergy], fMass, fIntegrationStep)
+                                                   : worker.GammaTransmissionFieldMapProbability(coordinates[kEnergy], fMass).first;
+            exact.push_back(probability);
+            interpolated.push_back(Interpolate(coordinates));
+        }
+
+        const Double_t scale = exact.empty() ? 0 : *std::max_element(exact.begin(), exact.end());
+        validation.nPoints = exact.size();
+        for (size_t i = 0; i < exact.size(); i++) {
+            const Double_t error = std::abs(interpolated[i] - exact[i]);
+            validation.maxAbsoluteError = std::max(validation.maxAbsoluteError, error);
+            if (scale > 0) {
+                validation.maxRelativeError = std::max(validation.maxRelativeError, error / scale);
+                validation.meanRelativeError += error / scale / exact.size();
+            }
+        }
+        return validation;
+    }
+};
+
+#endif
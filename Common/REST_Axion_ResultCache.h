@@ -0,0 +1,247 @@
+#ifndef REST_AXION_RESULTCACHE_H
+#define REST_AXION_RESULTCACHE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include <Rtypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//*******************************************************************************************************
+//*** Description: Persistent, content-addressed cache of probability evaluations, shared by all the
+//*** studies that integrate the same (field map, track, Ea, ma, gas, integration settings) points.
+//***
+//*** ResultHasher builds the 64-bit keys, from the content of the field map (SharedFieldMap::GetContentHash)
+//*** and from the parameters of the evaluation (FieldWorker::GetResultKey), so a key does not depend on the
+//*** name of the map or on the macro that computed it.
+//***
+//*** The store is an append-only binary file: a header followed by fixed-size records (key, probability,
+//*** error, runtime and a checksum). Every record is appended with a single write under an exclusive POSIX
+//*** record lock (fcntl, which also holds on NFS), so many processes of a farm can write to the same file;
+//*** readers take a shared lock and skip the records whose checksum does not match, e.g. the tail of a writer
+//*** that was killed. The file is read once when opened, and again from the last read offset when a key is
+//*** missed, to pick up the results of the other writers. A key stored twice keeps its last record.
+//***
+//*** Usage:
+//***   ResultCache cache("ResultCache.axcache");
+//***   std::pair<Double_t, Double_t> prob = worker.GammaTransmissionFieldMapProbability(point, cache);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Incremental 64-bit hash of words (FNV-1a over 8-byte words, with a final avalanche)
+class ResultHasher {
+   private:
+    ULong64_t fHash = 0xcbf29ce484222325ULL;
+
+   public:
+    ResultHasher& Add(ULong64_t word) {
+        fHash = (fHash ^ word) * 0x100000001b3ULL;
+        return *this;
+    }
+    // Doubles by their bit pattern, with -0 as 0
+    ResultHasher& Add(Double_t value) {
+        if (value == 0) value = 0;
+        ULong64_t word;
+        std::memcpy(&word, &value, sizeof(word));
+        return Add(word);
+    }
+    ResultHasher& Add(Int_t value) { return Add((ULong64_t)(Long64_t)value); }
+    ResultHasher& Add(const std::string& text) { return Add(text.data(), text.size()); }
+    ResultHasher& Add(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            ULong64_t word;
+            std::memcpy(&word, bytes + i, sizeof(word));
+            Add(word);
+        }
+        ULong64_t tail = size;
+        for (; i < size; i++) tail = (tail << 8) | bytes[i];
+        return Add(tail);
+    }
+
+    ULong64_t GetHash() const {
+        ULong64_t h = fHash;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+};
+
+struct CachedResult {
+    Double_t probability = 0;
+    Double_t error = 0;
+    // Runtime of the evaluation that produced it (ms)
+    Double_t runtime = 0;
+};
+
+class ResultCache {
+   private:
+    static constexpr char kMagic[8] = {'R', 'A', 'X', 'C', 'A', 'C', 'H', 'E'};
+    static constexpr UInt_t kVersion = 1;
+
+    struct Record {
+        ULong64_t key;
+        Double_t probability;
+        Double_t error;
+        Double_t runtime;
+        ULong64_t checksum;
+    };
+
+    struct Header {
+        char magic[8];
+        UInt_t version;
+        UInt_t recordSize;
+    };
+
+    std::string fFileName;
+    Int_t fDescriptor = -1;
+    off_t fReadOffset = sizeof(Header);
+    std::unordered_map<ULong64_t, CachedResult> fEntries;
+    mutable std::mutex fMutex;
+
+    size_t fHits = 0;
+    size_t fMisses = 0;
+
+    static ULong64_t Checksum(const Record& record) {
+        return ResultHasher().Add(record.key).Add(record.probability).Add(record.error).Add(record.runtime).GetHash();
+    }
+
+    // Whole-file POSIX record lock, blocking until it is granted
+    Bool_t Lock(short type) const {
+        struct flock lock = {};
+        lock.l_type = type;
+        lock.l_whence = SEEK_SET;
+        while (fcntl(fDescriptor, F_SETLKW, &lock) == -1)
+            if (errno != EINTR) return false;
+        return true;
+    }
+    void Unlock() const { Lock(F_UNLCK); }
+
+    // Reads the records appended since the last read, the lock being held
+    void ReadNewRecords() {
+        struct stat status;
+        if (fstat(fDescriptor, &status) != 0) return;
+        const off_t end = sizeof(Header) + (status.st_size - (off_t)sizeof(Header)) / (off_t)sizeof(Record) * (off_t)sizeof(Record);
+        if (end <= fReadOffset) return;
+        std::vector<Record> records((end - fReadOffset) / sizeof(Record));
+        const ssize_t size = pread(fDescriptor, records.data(), records.size() * sizeof(Record), fReadOffset);
+        if (size != (ssize_t)(records.size() * sizeof(Record))) return;
+        fReadOffset = end;
+        for (const auto& record : records)
+            if (record.checksum == Checksum(record)) fEntries[record.key] = {record.probability, record.error, record.runtime};
+    }
+
+   public:
+    ResultCache() = default;
+    explicit ResultCache(const std::string& filename) { Open(filename); }
+    ~ResultCache() { Close(); }
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Opens, or creates, the store and reads all its records
+    Bool_t Open(const std::string& filename) {
+        std::lock_guard<std::mutex> guard(fMutex);
+        if (fDescriptor >= 0) close(fDescriptor);
+        fFileName = filename;
+        fEntries.clear();
+        fReadOffset = sizeof(Header);
+        fDescriptor = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0664);
+        if (fDescriptor < 0) {
+            std::cerr << "Error: Unable to open the result cache " << filename << std::endl;
+            return false;
+        }
+        if (!Lock(F_WRLCK)) {
+            std::cerr << "Error: Unable to lock the result cache " << filename << std::endl;
+            close(fDescriptor);
+            fDescriptor = -1;
+            return false;
+        }
+        Header header = {};
+        struct stat status;
+        fstat(fDescriptor, &status);
+        if (status.st_size == 0) {
+            std::memcpy(header.magic, kMagic, sizeof(kMagic));
+            header.version = kVersion;
+            header.recordSize = sizeof(Record);
+            if (write(fDescriptor, &header, sizeof(header)) != (ssize_t)sizeof(header))
+                std::cerr << "Warning: Unable to write the header of the result cache " << filename << std::endl;
+        } else if (pread(fDescriptor, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                   std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+                   header.recordSize != sizeof(Record)) {
+            std::cerr << "Error: " << filename << " is not a result cache of this version" << std::endl;
+            Unlock();
+            close(fDescriptor);
+            fDescriptor = -1;
+            return false;
+        }
+        ReadNewRecords();
+        Unlock();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> guard(fMutex);
+        if (fDescriptor >= 0) close(fDescriptor);
+        fDescriptor = -1;
+    }
+
+    Bool_t IsOpen() const { return fDescriptor >= 0; }
+    const std::string& GetFileName() const { return fFileName; }
+
+    // Looks the key up, reading the records of the other writers on a miss
+    Bool_t Find(ULong64_t key, CachedResult& result) {
+        std::lock_guard<std::mutex> guard(fMutex);
+        auto it = fEntries.find(key);
+        if (it == fEntries.end() && fDescriptor >= 0 && Lock(F_RDLCK)) {
+            ReadNewRecords();
+            Unlock();
+            it = fEntries.find(key);
+        }
+        if (it == fEntries.end()) {
+            fMisses++;
+            return false;
+        }
+        fHits++;
+        result = it->second;
+        return true;
+    }
+
+    // Appends the result of the key to the store
+    Bool_t Store(ULong64_t key, const CachedResult& result) {
+        std::lock_guard<std::mutex> guard(fMutex);
+        fEntries[key] = result;
+        if (fDescriptor < 0) return false;
+        Record record = {key, result.probability, result.error, result.runtime, 0};
+        record.checksum = Checksum(record);
+        if (!Lock(F_WRLCK)) return false;
+        // Keep whole records even if an earlier writer left a partial one
+        struct stat status;
+        fstat(fDescriptor, &status);
+        const off_t partial = (status.st_size - (off_t)sizeof(Header)) % (off_t)sizeof(Record);
+        Bool_t written = partial == 0 || ftruncate(fDescriptor, status.st_size - partial) == 0;
+        written = written && write(fDescriptor, &record, sizeof(record)) == (ssize_t)sizeof(record);
+        Unlock();
+        if (!written) std::cerr << "Warning: Unable to append to the result cache " << fFileName << std::endl;
+        return written;
+    }
+
+    size_t GetNumberOfEntries() const {
+        std::lock_guard<std::mutex> guard(fMutex);
+        return fEntries.size();
+    }
+    size_t GetHits() const { return fHits; }
+    size_t GetMisses() const { return fMisses; }
+};
+
+#endif
@@ -0,0 +1,521 @@
+#ifndef REST_AXION_SCANENGINE_H
+#define REST_AXION_SCANENGINE_H
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+
+#include <TROOT.h>
+#include <TVector3.h>
+#include "TRestAxionMagneticField.h"
+#include "TRestAxionBufferGas.h"
+#include "TRestAxionField.h"
+#include "REST_Axion_ThreadPool.h"
+#include "REST_Axion_FieldWorker.h"
+
+//*******************************************************************************************************
+//*** Description: Shared parameter-scan engine for the analysis macros. A scan is described declaratively
+//*** by a ScanSpace (field maps, mesh sizes, interpolation, gas densities, masses, accuracies, num_intervals,
+//*** qawo_levels and repetitions). RunScan evaluates the full cartesian product on a pool of threads and
+//*** returns a columnar ScanTable with the probability, error and runtime of every point.
+//***
+//*** By default every field configuration is loaded once as a SharedFieldMap and each thread evaluates it
+//*** through its own FieldWorker handles (REST_Axion_FieldWorker.h). With sharedMaps = false every thread
+//*** owns its own TRestAxionMagneticField/TRestAxionField instances instead, since both classes keep the
+//*** track and the gas as internal state, and the memory used grows with the number of threads.
+//*** With blockedStorage the shared maps are queried through their float32 blocked copy instead
+//*** (REST_Axion_BlockedFieldMap.h), and their library map is released once the copy is built.
+//*** profileCacheStep > 0 keeps B_T along the track as a spline, so that the repeated integrations of the same
+//*** track (masses, accuracies, repetitions) do not query the 3D map again.
+//*** mapFileFolder reads the maps from their preprocessed binary files when they exist (REST_Axion_FieldMapFile.h).
+//*** meshPyramid generates all the mesh sizes of a field from a single load of its native map
+//*** (REST_Axion_FieldPyramid.h). The pyramid is built on the blocked storage, so it requires blockedStorage.
+//*** serialTiming evaluates one point at a time while the other threads wait, so the runtimes are not inflated
+//*** by the points running concurrently. The setup of the workers stays parallel.
+//*** With REST_AXION_INSTRUMENTATION the field evaluations and GSL subintervals of every point are kept in the
+//*** table too (REST_Axion_Instrumentation.h). They are only counted for the shared maps.
+//*** resultCacheFile keeps every probability of the shared maps in a persistent result cache
+//*** (REST_Axion_ResultCache.h), and the points already there are read from it, with the runtime they took.
+//*** Only the first repetition of a point goes through the cache, the others are always integrated and timed.
+//*** shard and nShards evaluate only a slice of the points, the repetitions of a point staying in its shard, so
+//*** a scan can be split over farm jobs (REST_Axion_Sharding.h); with a shared resultCacheFile, a final run
+//*** without shards reads all the points from the cache.
+//***
+//*** Usage:
+//***   ScanSpace space;
+//***   space.fieldNames = {"babyIAXO_2024_cutoff"};
+//***   space.masses = {0.01, 0.1};
+//***   space.gasDensities = {2.9868e-10};
+//***   ScanTable table = RunScan(space);
+//***   table.Average().Write("results.txt");
+//***
+//*** Dependencies:
+//*** `TRestAxionMagneticField::ReMap`, `TRestAxionMagneticField::SetInterpolation`,
+//*** `TRestAxionMagneticField::SetTrack`, `TRestAxionField::GammaTransmissionFieldMapProbability` and
+//*** `TRestAxionBufferGas::GetPhotonMass`, through FieldWorker when the maps are shared.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Declarative description of the parameter space to scan
+struct ScanSpace {
+    std::string cfgFileName = "fields.rml";
+    std::vector<std::string> fieldNames;
+
+    // Mesh sizes in mm passed to ReMap. Empty, or a null mesh size, keeps the native mesh of the map
+    std::vector<TVector3> meshSizes;
+    // Interpolation flags passed to SetInterpolation. Empty keeps the default of the map
+    std::vector<Bool_t> interpolation;
+
+    // Gas name and densities in kg/mm3. A density of 0 (or an empty name) stands for vacuum
+    std::string gasName = "He";
+    std::vector<Double_t> gasDensities = {0};
+
+    // Axion masses in eV. If resonantMass is set, the photon mass of every density is added as well
+    std::vector<Double_t> masses;
+    Bool_t resonantMass = false;
+
+    std::vector<Double_t> accuracies = {0.1};
+    std::vector<Int_t> numIntervals = {100};
+    std::vector<Int_t> qawoLevels = {20};
+    Int_t repetitions = 1;
+
+    // Axion energy in keV and track definition
+    Double_t Ea = 4.2;
+    TVector3 position = TVector3(-5, 5, -11000);
+    TVector3 direction = (TVector3(-5, 5, -11000) - TVector3(5, -5, 11000)).Unit();
+
+    // Load every field map once and share it between the threads through FieldWorker handles. If false,
+    // every thread builds its own TRestAxionMagneticField/TRestAxionField and uses the library integration
+    Bool_t sharedMaps = true;
+
+    // Query the shared maps through their float32 blocked storage (REST_Axion_BlockedFieldMap.h)
+    Bool_t blockedStorage = false;
+
+    // Node spacing in mm of the track-profile cache of the shared-map handles, 0 disables it
+    Double_t profileCacheStep = 0;
+
+    // Folder with the binary field maps written by REST_Axion_ExportFieldMap.C (<fieldName>.axmap). The shared
+    // maps without remapping are read from there when the file exists, and from cfgFileName otherwise
+    std::string mapFileFolder;
+
+    // Generate the mesh sizes as levels of a multi-resolution pyramid (REST_Axion_FieldPyramid.h) of one map
+    // per field, instead of loading and remapping one map per mesh size. It requires blockedStorage
+    Bool_t meshPyramid = false;
+
+    // Evaluate the points one at a time, for runtimes measured with no other point running
+    Bool_t serialTiming = false;
+
+    // Result cache file (REST_Axion_ResultCache.h) shared by the studies, empty disables it. Only used with
+    // shared maps, and for the first repetition of every point
+    std::string resultCacheFile;
+
+    // Slice of the points evaluated by this job: the points p with p % nShards == shard
+    UInt_t shard = 0;
+    UInt_t nShards = 1;
+};
+
+// Columnar result table, one entry per evaluated point in every column
+struct ScanTable {
+    std::vector<std::string> fieldName;
+    std::vector<TVector3> meshSize;
+    std::vector<Int_t> interpolation;   // -1 when the map default was kept
+    std::vector<Double_t> gasDensity;
+    std::vector<Double_t> mass;
+    std::vector<Int_t> onResonance;
+    std::vector<Double_t> accuracy;
+    std::vector<Int_t> numIntervals;
+    std::vector<Int_t> qawoLevels;
+    std::vector<Int_t> repetition;
+
+    std::vector<Double_t> probability;
+    std::vector<Double_t> error;
+    std::vector<Double_t> runtime;      // ms
+    // Cost of the point with REST_AXION_INSTRUMENTATION (REST_Axion_Instrumentation.h), 0 otherwise
+    std::vector<Double_t> fieldEvaluations;
+    std::vector<Double_t> gslSubintervals;
+
+    size_t Size() const { return probability.size(); }
+
+    void Resize(size_t n) {
+        fieldName.resize(n);
+        meshSize.resize(n);
+        interpolation.resize(n);
+        gasDensity.resize(n);
+        mass.resize(n);
+        onResonance.resize(n);
+        accuracy.resize(n);
+        numIntervals.resize(n);
+        qawoLevels.resize(n);
+        repetition.resize(n);
+        probability.resize(n);
+        error.resize(n);
+        runtime.resize(n);
+        fieldEvaluations.resize(n);
+        gslSubintervals.resize(n);
+    }
+
+    // Returns the rows for which the predicate is true
+    std::vector<size_t> Select(const std::function<bool(size_t)>& predicate) const {
+        std::vector<size_t> rows;
+        for (size_t i = 0; i < Size(); i++)
+            if (predicate(i)) rows.push_back(i);
+        return rows;
+    }
+
+    // Collapses the repetitions of every point into their mean probability, error and runtime
+    ScanTable Average() const {
+        ScanTable result;
+        std::map<std::string, size_t> index;
+        std::vector<Int_t> counts;
+        for (size_t i = 0; i < Size(); i++) {
+            std::ostringstream key;
+            key << std::setprecision(17) << fieldName[i] << "|" << meshSize[i].X() << "," << meshSize[i].Y() << "," << meshSize[i].Z() << "|"
+                << interpolation[i] << "|" << gasDensity[i] << "|" << mass[i] << "|" << accuracy[i] << "|"
+                << numIntervals[i] << "|" << qawoLevels[i];
+            auto it = index.find(key.str());
+            if (it == index.end()) {
+                size_t row = result.Size();
+                index[key.str()] = row;
+                result.Resize(row + 1);
+                result.fieldName[row] = fieldName[i];
+                result.meshSize[row] = meshSize[i];
+                result.interpolation[row] = interpolation[i];
+                result.gasDensity[row] = gasDensity[i];
+                result.mass[row] = mass[i];
+                result.onResonance[row] = onResonance[i];
+                result.accuracy[row] = accuracy[i];
+                result.numIntervals[row] = numIntervals[i];
+                result.qawoLevels[row] = qawoLevels[i];
+                result.repetition[row] = 0;
+                result.probability[row] = 0;
+                result.error[row] = 0;
+                result.runtime[row] = 0;
+                result.fieldEvaluations[row] = 0;
+                result.gslSubintervals[row] = 0;
+                counts.push_back(0);
+                it = index.find(key.str());
+            }
+            size_t row = it->second;
+            result.probability[row] += probability[i];
+            result.error[row] += error[i];
+            result.runtime[row] += runtime[i];
+            result.fieldEvaluations[row] += fieldEvaluations[i];
+            result.gslSubintervals[row] += gslSubintervals[i];
+            counts[row]++;
+        }
+        for (size_t row = 0; row < result.Size(); row++) {
+            result.probability[row] /= counts[row];
+            result.error[row] /= counts[row];
+            result.runtime[row] /= counts[row];
+            result.fieldEvaluations[row] /= counts[row];
+            result.gslSubintervals[row] /= counts[row];
+            result.repetition[row] = counts[row];
+        }
+        return result;
+    }
+
+    // Writes the table as tab-separated columns
+    Bool_t Write(const std::string& filename) const {
+        std::ofstream outputFile(filename);
+        if (!outputFile.is_open()) {
+            std::cerr << "Error: Unable to open the file for writing!" << std::endl;
+            return false;
+        }
+        outputFile << "Field\tMesh\tInterpolation\tDensity\tMass\tOnResonance\tAccuracy\tIntervals\tQawoLevels\tRepetition\t"
+                   << "Probability\tError\tTime(ms)" << (Instrumentation::IsEnabled() ? "\tFieldEvaluations\tGSLSubintervals\n" : "\n");
+        for (size_t i = 0; i < Size(); i++) {
+            outputFile << fieldName[i] << "\t(" << meshSize[i].X() << "," << meshSize[i].Y() << "," << meshSize[i].Z() << ")\t"
+                       << interpolation[i] << "\t" << gasDensity[i] << "\t" << mass[i] << "\t" << onResonance[i] << "\t"
+                       << accuracy[i] << "\t" << numIntervals[i] << "\t" << qawoLevels[i] << "\t" << repetition[i] << "\t"
+                       << probability[i] << "\t" << error[i] << "\t" << runtime[i];
+            if (Instrumentation::IsEnabled()) outputFile << "\t" << fieldEvaluations[i] << "\t" << gslSubintervals[i];
+            outputFile << "\n";
+        }
+        outputFile.close();
+        return true;
+    }
+};
+
+// Indices of a single point of the cartesian product
+struct ScanPoint {
+    size_t field;
+    size_t mesh;
+    size_t interpolation;
+    size_t density;
+    Double_t mass;
+    Bool_t onResonance;
+    Double_t accuracy;
+    Int_t numIntervals;
+    Int_t qawoLevels;
+    Int_t repetition;
+};
+
+// Field configuration owned by one worker: one magnetic field and one axion field per gas density
+struct ScanContext {
+    std::unique_ptr<TRestAxionMagneticField> magneticField;
+    std::vector<std::unique_ptr<TRestAxionField>> axionFields;
+};
+
+// Per-thread state. With shared maps only the FieldWorker handles (one per gas density) are per thread
+struct ScanWorker {
+    std::vector<std::unique_ptr<TRestAxionBufferGas>> gases;
+    std::map<std::vector<size_t>, ScanContext> contexts;
+    std::map<std::vector<size_t>, std::vector<std::unique_ptr<FieldWorker>>> handles;
+};
+
+// Enumerates the cartesian product of the scan space, with the repetitions as the innermost loop
+inline std::vector<ScanPoint> EnumerateScan(const ScanSpace& space) {
+    std::vector<ScanPoint> points;
+    const size_t nMesh = std::max<size_t>(1, space.meshSizes.size());
+    const size_t nInterp = std::max<size_t>(1, space.interpolation.size());
+
+    // Masses per density, adding the resonance if requested
+    std::vector<std::vector<std::pair<Double_t, Bool_t>>> massesPerDensity(space.gasDensities.size());
+    for (size_t d = 0; d < space.gasDensities.size(); d++) {
+        for (const auto& ma : space.masses) massesPerDensity[d].push_back({ma, false});
+        if (space.resonantMass) {
+            Double_t resonance = 0;
+            if (!space.gasName.empty() && space.gasDensities[d] > 0) {
+                TRestAxionBufferGas gas;
+                gas.SetGasDensity(space.gasName, space.gasDensities[d]);
+                resonance = gas.GetPhotonMass(space.Ea);
+            }
+            massesPerDensity[d].push_back({resonance, true});
+        }
+    }
+
+    for (size_t f = 0; f < space.fieldNames.size(); f++)
+        for (size_t m = 0; m < nMesh; m++)
+            for (size_t it = 0; it < nInterp; it++)
+                for (size_t d = 0; d < space.gasDensities.size(); d++)
+                    for (const auto& ma : massesPerDensity[d])
+                        for (const auto& accuracy : space.accuracies)
+                            for (const auto& intervals : space.numIntervals)
+                                for (const auto& levels : space.qawoLevels)
+                                    for (Int_t r = 0; r < space.repetitions; r++)
+                                        points.push_back({f, m, it, d, ma.first, ma.second, accuracy, intervals, levels, r});
+    return points;
+}
+
+// Builds the field instances of one worker for every configuration that appears in the points
+inline void BuildScanWorker(const ScanSpace& space, const std::vector<ScanPoint>& points, ScanWorker& worker) {
+    for (const auto& density : space.gasDensities) {
+        std::unique_ptr<TRestAxionBufferGas> gas = nullptr;
+        if (!space.gasName.empty() && density > 0) {
+            gas = std::make_unique<TRestAxionBufferGas>();
+            gas->SetGasDensity(space.gasName, density);
+        }
+        worker.gases.push_back(std::move(gas));
+    }
+
+    for (const auto& point : points) {
+        std::vector<size_t> key = {point.field, point.mesh, point.interpolation};
+        if (worker.contexts.count(key)) continue;
+
+        ScanContext& context = worker.contexts[key];
+        context.magneticField = std::make_unique<TRestAxionMagneticField>(space.cfgFileName.c_str(), space.fieldNames[point.field]);
+        if (!space.meshSizes.empty() && space.meshSizes[point.mesh].Mag() > 0) {
+            for (size_t n = 0; n < context.magneticField->GetNumberOfVolumes(); n++)
+                context.magneticField->ReMap(n, space.meshSizes[point.mesh]);
+        }
+        if (!space.interpolation.empty())
+            context.magneticField->SetInterpolation(space.interpolation[point.interpolation]);
+        context.magneticField->SetTrack(space.position, space.direction);
+
+        for (const auto& gas : worker.gases) {
+            auto axionField = std::make_unique<TRestAxionField>();
+            if (gas != nullptr) axionField->AssignBufferGas(gas.get());
+            axionField->AssignMagneticField(context.magneticField.get());
+            context.axionFields.push_back(std::move(axionField));
+        }
+    }
+}
+
+// Loads every field configuration of the points once, to be shared read-only by all the workers. With meshPyramid
+// the keys of all the mesh sizes of a field share the same map
+inline std::map<std::vector<size_t>, std::shared_ptr<SharedFieldMap>> BuildSharedMaps(const ScanSpace& space,
+                                                                                       const std::vector<ScanPoint>& points) {
+    std::map<std::vector<size_t>, std::shared_ptr<SharedFieldMap>> maps;
+    std::map<std::vector<size_t>, std::shared_ptr<SharedFieldMap>> pyramids;
+    for (const auto& point : points) {
+        std::vector<size_t> key = {point.field, point.mesh, point.interpolation};
+        if (maps.count(key)) continue;
+        const TVector3 meshSize = space.meshSizes.empty() ? TVector3(0, 0, 0) : space.meshSizes[point.mesh];
+        const Int_t interpolation = space.interpolation.empty() ? -1 : (Int_t)space.interpolation[point.interpolation];
+        const std::string mapFileName =
+            space.mapFileFolder.empty() ? "" : space.mapFileFolder + "/" + space.fieldNames[point.field] + ".axmap";
+
+        if (space.meshPyramid) {
+            std::shared_ptr<SharedFieldMap>& map = pyramids[{point.field, point.interpolation}];
+            if (!map) {
+                map = SharedFieldMap::Load(space.cfgFileName, space.fieldNames[point.field], mapFileName, TVector3(0, 0, 0), interpolation);
+                if (space.blockedStorage) {
+                    map->UseBlockedStorage();
+                    map->ReleaseField();
+                }
+            }
+            map->AddResolution(meshSize);
+            maps[key] = map;
+            continue;
+        }
+
+        maps[key] = SharedFieldMap::Load(space.cfgFileName, space.fieldNames[point.field], mapFileName, meshSize, interpolation);
+        if (space.blockedStorage) {
+            maps[key]->UseBlockedStorage();
+            maps[key]->ReleaseField();
+        }
+    }
+    return maps;
+}
+
+// Builds the lightweight handles of one worker, one per shared map and gas density
+inline void BuildScanHandles(const ScanSpace& space, const std::map<std::vector<size_t>, std::shared_ptr<SharedFieldMap>>& maps,
+                             ScanWorker& worker) {
+    for (const auto& map : maps) {
+        auto& handles = worker.handles[map.first];
+        const TVector3 meshSize = space.meshSizes.empty() ? TVector3(0, 0, 0) : space.meshSizes[map.first[1]];
+        for (const auto& density : space.gasDensities) {
+            auto handle = std::make_unique<FieldWorker>(map.second.get());
+            handle->SetBufferGas(space.gasName, density);
+            handle->SetTrack(space.position, space.direction);
+            handle->SetProfileCache(space.profileCacheStep);
+            // The level already exists, AddResolution only looks it up
+            if (map.second->GetPyramid()) handle->SetFieldLevel(map.second->AddResolution(meshSize));
+            handles.push_back(std::move(handle));
+        }
+    }
+}
+
+// Runs the scan on nThreads workers (0 uses all the hardware threads) and returns one row per point
+inline ScanTable RunScan(const ScanSpace& space, UInt_t nThreads = 0, Bool_t verbose = false) {
+    std::vector<ScanPoint> points = EnumerateScan(space);
+    if (space.nShards > 1) {
+        std::vector<ScanPoint> slice;
+        for (size_t i = 0; i < points.size(); i++)
+            if ((i / std::max(1, space.repetitions)) % space.nShards == space.shard) slice.push_back(points[i]);
+        points = slice;
+    }
+
+    ScanTable table;
+    table.Resize(points.size());
+    if (points.empty()) return table;
+    // The levels of the pyramid are generated from the blocked volumes, the library map cannot be timed with them
+    if (space.meshPyramid && !space.blockedStorage) {
+        std::cerr << "Error: meshPyramid requires blockedStorage" << std::endl;
+        table.Resize(0);
+        return table;
+    }
+
+    nThreads = GetNumberOfThreads(nThreads, points.size());
+
+    // Field maps are loaded serially, the parsing of the configuration is not thread-safe
+    std::map<std::vector<size_t>, std::shared_ptr<SharedFieldMap>> maps;
+    std::vector<ScanWorker> workers(nThreads);
+    if (space.sharedMaps) {
+        maps = BuildSharedMaps(space, points);
+        for (auto& worker : workers) BuildScanHandles(space, maps, worker);
+    } else {
+        for (auto& worker : workers) BuildScanWorker(space, points, worker);
+    }
+
+    std::unique_ptr<ResultCache> cache;
+    if (space.sharedMaps && !space.resultCacheFile.empty()) {
+        cache = std::make_unique<ResultCache>(space.resultCacheFile);
+        if (!cache->IsOpen()) cache.reset();
+        // The content hashes sample the maps without blocked storage, done once here before the threads start
+        if (cache)
+            for (const auto& map : maps) map.second->GetContentHash();
+    }
+
+    std::mutex printMutex, timingMutex;
+    ParallelFor(points.size(), nThreads, [&](size_t i, UInt_t w) {
+        const ScanPoint& point = points[i];
+        const std::vector<size_t> key = {point.field, point.mesh, point.interpolation};
+        ScanWorker& worker = workers[w];
+
+        // With serialTiming the evaluation of the point is an exclusive section
+        std::unique_lock<std::mutex> timingLock(timingMutex, std::defer_lock);
+        if (space.serialTiming) timingLock.lock();
+#if defined(REST_AXION_INSTRUMENTATION)
+        const InstrumentationCounters before = Instrumentation::Local();
+#endif
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::pair<Double_t, Double_t> probField;
+        CachedResult cached;
+        Bool_t fromCache = false;
+        if (space.sharedMaps) {
+            FieldWorker* handle = worker.handles.at(key)[point.density].get();
+            handle->SetIntegrationSettings({point.accuracy, point.numIntervals, point.qawoLevels});
+            const ConversionPoint conversion = handle->GetConversionPoint(space.Ea, point.mass);
+            // The timing repetitions bypass the cache
+            const Bool_t useCache = cache && point.repetition == 0;
+            const ULong64_t resultKey = useCache ? handle->GetResultKey(conversion) : 0;
+            fromCache = useCache && cache->Find(resultKey, cached);
+            if (fromCache) {
+                probField = {cached.probability, cached.error};
+            } else {
+                probField = handle->GammaTransmissionFieldMapProbability(conversion);
+                cached = {probField.first, probField.second,
+                          std::chrono::duration<Double_t, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count()};
+                if (useCache) cache->Store(resultKey, cached);
+            }
+        } else {
+            TRestAxionField* axionField = worker.contexts.at(key).axionFields[point.density].get();
+            probField = axionField->GammaTransmissionFieldMapProbability(space.Ea, point.mass, point.accuracy, point.numIntervals,
+                                                                        point.qawoLevels);
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+        if (timingLock.owns_lock()) timingLock.unlock();
+
+        table.fieldName[i] = space.fieldNames[point.field];
+        table.meshSize[i] = space.meshSizes.empty() ? TVector3(0, 0, 0) : space.meshSizes[point.mesh];
+        table.interpolation[i] = space.interpolation.empty() ? -1 : (Int_t)space.interpolation[point.interpolation];
+        table.gasDensity[i] = space.gasDensities[point.density];
+        table.mass[i] = point.mass;
+        table.onResonance[i] = point.onResonance;
+        table.accuracy[i] = point.accuracy;
+        table.numIntervals[i] = point.numIntervals;
+        table.qawoLevels[i] = point.qawoLevels;
+        table.repetition[i] = point.repetition;
+        table.probability[i] = probField.first;
+        table.error[i] = probField.second;
+        table.runtime[i] = fromCache ? cached.runtime : duration.count() / 1000.;
+#if defined(REST_AXION_INSTRUMENTATION)
+        const InstrumentationCounters cost = Instrumentation::Local() - before;
+        table.fieldEvaluations[i] = cost.GetFieldEvaluations();
+        table.gslSubintervals[i] = cost.gslSubintervals;
+#endif
+
+        if (verbose) {
+            std::lock_guard<std::mutex> lock(printMutex);
+            std::cout << "+--------------------------------------------------------------------------+" << std::endl;
+            std::cout << "Point " << i + 1 << "/" << points.size() << ": " << table.fieldName[i] << ", ma: " << point.mass
+                      << ", accuracy: " << point.accuracy << ", density: " << table.gasDensity[i] << std::endl;
+            std::cout << "Probability: " << probField.first << std::endl;
+            std::cout << "Error: " << probField.second << std::endl;
+            std::cout << "Runtime (ms): " << table.runtime[i] << (fromCache ? " (result cache)" : "") << std::endl;
+            if (Instrumentation::IsEnabled())
+                std::cout << "Field evaluations: " << table.fieldEvaluations[i] << ", GSL subintervals: " << table.gslSubintervals[i] << std::endl;
+            std::cout << "+--------------------------------------------------------------------------+" << std::endl;
+        }
+    });
+
+    if (cache && verbose)
+        std::cout << "Result cache " << space.resultCacheFile << ": " << cache->GetHits() << " points read, " << cache->GetMisses()
+                  << " computed" << std::endl;
+
+    return table;
+}
+
+#endif
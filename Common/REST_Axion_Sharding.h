@@ -0,0 +1,200 @@
+#ifndef REST_AXION_SHARDING_H
+#define REST_AXION_SHARDING_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <set>
+#include <algorithm>
+#include <filesystem>
+
+#include <Rtypes.h>
+
+//*******************************************************************************************************
+//*** Description: Deterministic sharding of the ray-tracing runs of RayTracing_BabyIAXO.rml over farm jobs.
+//***
+//*** A ShardPlan splits the REST_EVENTS of every point of a mass/density scan into eventShards shards, so the
+//*** plan has points x eventShards jobs. Every job gets a disjoint, balanced slice of the events of its point
+//*** (firstEvent, events) and its own generator seed, the SplitMix64 output of masterSeed for the job index:
+//*** the seeds are reproducible from (masterSeed, index) only, never 0 (which the generator takes as a random
+//*** seed) and checked to be distinct, so two jobs never replay the same events. The jobs run restManager with
+//*** the REST_ variables of the rml set in their environment, as the other REST_ variables: REST_EVENTS,
+//*** REST_SEED, REST_AXION_MASS, REST_GAS_DENSITY and REST_SHARD_SUFFIX, which tags the output file name.
+//***
+//*** The plan is written as a tab-separated manifest, read back by the merge stage to check that every shard
+//*** is there once and that the shards of every point tile its events, and as an HTCondor submit file with one
+//*** queued job per manifest row.
+//***
+//*** Usage:
+//***   ShardPlan plan(1000000, 10, 20240601);
+//***   plan.SetScan({1e-3, 1e-2}, {2.9836e-10});
+//***   plan.WriteManifest("Shards/manifest.txt");
+//***   plan.WriteCondorSubmit("Shards/shards.sub", "RayTracing_BabyIAXO.rml", "Shards/manifest.txt");
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// One step of the SplitMix64 generator, advancing the state
+inline ULong64_t SplitMix64(ULong64_t& state) {
+    ULong64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+struct ShardJob {
+    UInt_t index = 0;
+    // Scan point and shard of the events of the point
+    UInt_t point = 0;
+    UInt_t shard = 0;
+    ULong64_t firstEvent = 0;
+    ULong64_t events = 0;
+    UInt_t seed = 0;
+    Double_t mass = 0;
+    Double_t density = 0;
+
+    // Suffix of the output file name of the job, REST_SHARD_SUFFIX
+    std::string GetSuffix() const {
+        std::ostringstream suffix;
+        suffix << "_Shard" << std::setw(4) << std::setfill('0') << index;
+        return suffix.str();
+    }
+};
+
+class ShardPlan {
+   private:
+    ULong64_t fTotalEvents = 0;
+    UInt_t fEventShards = 1;
+    ULong64_t fMasterSeed = 0;
+    std::vector<Double_t> fMasses;
+    std::vector<Double_t> fDensities;
+    std::vector<ShardJob> fJobs;
+
+    void Build() {
+        fJobs.clear();
+        if (fEventShards == 0) return;
+        ULong64_t state = fMasterSeed;
+        std::set<UInt_t> seeds;
+        UInt_t index = 0;
+        for (size_t d = 0; d < fDensities.size(); d++)
+            for (size_t m = 0; m < fMasses.size(); m++) {
+                ULong64_t first = 0;
+                for (UInt_t s = 0; s < fEventShards; s++) {
+                    ShardJob job;
+                    job.index = index++;
+                    job.point = d * fMasses.size() + m;
+                    job.shard = s;
+                    job.firstEvent = first;
+                    job.events = fTotalEvents / fEventShards + (s < fTotalEvents % fEventShards);
+                    first += job.events;
+                    // Positive 31-bit seed, as the Int_t seed of the generator, redrawn if null or already taken
+                    do {
+                        job.seed = (UInt_t)(SplitMix64(state) >> 33);
+                    } while (job.seed == 0 || !seeds.insert(job.seed).second);
+                    job.mass = fMasses[m];
+                    job.density = fDensities[d];
+                    fJobs.push_back(job);
+                }
+            }
+    }
+
+   public:
+    ShardPlan() = default;
+    // The scan defaults to the mass and density of RayTracing_BabyIAXO.rml
+    ShardPlan(ULong64_t totalEvents, UInt_t eventShards, ULong64_t masterSeed)
+        : fTotalEvents(totalEvents), fEventShards(eventShards), fMasterSeed(masterSeed), fMasses({1e-3}), fDensities({2.9836e-10}) {
+        Build();
+    }
+
+    // Masses in eV and gas densities in kg/mm3 of the scan, every pair being one point
+    void SetScan(const std::vector<Double_t>& masses, const std::vector<Double_t>& densities) {
+        fMasses = masses;
+        fDensities = densities;
+        Build();
+    }
+
+    ULong64_t GetTotalEvents() const { return fTotalEvents; }
+    UInt_t GetEventShards() const { return fEventShards; }
+    ULong64_t GetMasterSeed() const { return fMasterSeed; }
+    size_t GetNumberOfPoints() const { return fMasses.size() * fDensities.size(); }
+    const std::vector<ShardJob>& GetJobs() const { return fJobs; }
+
+    // Environment of the restManager run of a job
+    static std::string GetEnvironment(const ShardJob& job) {
+        std::ostringstream environment;
+        environment << std::setprecision(10) << "REST_EVENTS=" << job.events << " REST_SEED=" << job.seed << " REST_AXION_MASS=" << job.mass
+                    << " REST_GAS_DENSITY=" << job.density << " REST_SHARD_SUFFIX=" << job.GetSuffix();
+        return environment.str();
+    }
+
+    Bool_t WriteManifest(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error: Unable to open " << filename << " for writing" << std::endl;
+            return false;
+        }
+        file << "# totalEvents=" << fTotalEvents << " eventShards=" << fEventShards << " masterSeed=" << fMasterSeed << "\n";
+        file << "Index\tPoint\tShard\tFirstEvent\tEvents\tSeed\tMass\tDensity\tSuffix\n";
+        file << std::setprecision(10);
+        for (const auto& job : fJobs)
+            file << job.index << "\t" << job.point << "\t" << job.shard << "\t" << job.firstEvent << "\t" << job.events << "\t" << job.seed
+                 << "\t" << job.mass << "\t" << job.density << "\t" << job.GetSuffix() << "\n";
+        return true;
+    }
+
+    // Jobs of a manifest written by WriteManifest, empty if it cannot be read
+    static std::vector<ShardJob> ReadManifest(const std::string& filename) {
+        std::vector<ShardJob> jobs;
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error: Unable to open " << filename << std::endl;
+            return jobs;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#' || line.compare(0, 5, "Index") == 0) continue;
+            std::istringstream row(line);
+            ShardJob job;
+            std::string suffix;
+            if (row >> job.index >> job.point >> job.shard >> job.firstEvent >> job.events >> job.seed >> job.mass >> job.density >> suffix)
+                jobs.push_back(job);
+            else
+                std::cerr << "Warning: manifest line not understood: " << line << std::endl;
+        }
+        return jobs;
+    }
+
+    // HTCondor submit file running restManager on the rml for every job of the manifest. The jobs run in the
+    // current directory, where the rml finds its files, and log to the logs folder next to the submit file
+    Bool_t WriteCondorSubmit(const std::string& filename, const std::string& rmlFileName, const std::string& manifestFileName,
+                             const std::string& executable = "restManager") const {
+        std::ofstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error: Unable to open " << filename << " for writing" << std::endl;
+            return false;
+        }
+        const std::string logFolder = (std::filesystem::absolute(filename).parent_path() / "logs").string();
+        file << "# " << fJobs.size() << " shards written by REST_Axion_ShardJobs.C, one per row of " << manifestFileName << "\n";
+        file << "initialdir = " << std::filesystem::current_path().string() << "\n";
+        file << "executable = " << executable << "\n";
+        file << "arguments = --c " << rmlFileName << "\n";
+        file << "environment = \"REST_EVENTS=$(Events) REST_SEED=$(Seed) REST_AXION_MASS=$(Mass) REST_GAS_DENSITY=$(Density) "
+                "REST_SHARD_SUFFIX=$(Suffix)\"\n";
+        file << "getenv = True\n";
+        file << "output = " << logFolder << "/shard$(Index).out\n";
+        file << "error = " << logFolder << "/shard$(Index).err\n";
+        file << "log = " << logFolder << "/shards.log\n";
+        file << "queue Index, Point, Shard, FirstEvent, Events, Seed, Mass, Density, Suffix from (\n";
+        file << std::setprecision(10);
+        for (const auto& job : fJobs)
+            file << "    " << job.index << ", " << job.point << ", " << job.shard << ", " << job.firstEvent << ", " << job.events << ", "
+                 << job.seed << ", " << job.mass << ", " << job.density << ", " << job.GetSuffix() << "\n";
+        file << ")\n";
+        return true;
+    }
+};
+
+#endif
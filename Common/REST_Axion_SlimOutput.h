@@ -0,0 +1,153 @@
+#ifndef REST_AXION_SLIMOUTPUT_H
+#define REST_AXION_SLIMOUTPUT_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <regex>
+#include <cstring>
+#include <cstdint>
+
+#include <Rtypes.h>
+#include <RVersion.h>
+#include <Compression.h>
+#include <ROOT/RNTupleModel.hxx>
+#include <ROOT/RNTupleWriter.hxx>
+#include <ROOT/RNTupleWriteOptions.hxx>
+
+//*******************************************************************************************************
+//*** Description: Slim columnar output of the ray-tracing observables. Only a selection of observables,
+//*** by default those read by REST_DataSet.rml, is written to an RNTuple, one column per observable plus the
+//*** eventID, with lz4, zstd or zlib compression. It archives full runs; the runs of the dataset are written slim
+//*** by the chain itself with REST_SLIM_OUTPUT=true, as a TTree that DataSetBuilder reads.
+//***
+//*** The columns are double by default. With a number of mantissa bits between 1 and 23 they are written as
+//*** float and the mantissa is rounded to those bits, which leaves the low bits zero and lets the compression
+//*** squeeze them out: 10 bits keep a relative precision of 5e-4, enough for positions and efficiencies.
+//***
+//*** Usage:
+//***   SlimOutputSettings settings;
+//***   settings.compression = "zstd";
+//***   settings.mantissaBits = 12;
+//***   SlimWriter writer("run.slim.root", ReadDataSetObservables("REST_DataSet.rml"), settings);
+//***   writer.Fill(eventID, values);
+//***
+//*** Dependencies:
+//*** ROOT 6.30 or later for RNTuple.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 36, 0)
+namespace RNTupleAPI = ROOT;
+#else
+namespace RNTupleAPI = ROOT::Experimental;
+#endif
+
+struct SlimOutputSettings {
+    // lz4, zstd or zlib
+    std::string compression = "zstd";
+    Int_t level = 5;
+    // Mantissa bits of the float columns, 0 writes double columns
+    Int_t mantissaBits = 0;
+    std::string ntupleName = "events";
+};
+
+// Observables of the <observables list="..."/> entries of a TRestDataSet rml, in order
+inline std::vector<std::string> ReadDataSetObservables(const std::string& filename) {
+    std::vector<std::string> observables;
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to open " << filename << std::endl;
+        return observables;
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    const std::string text = content.str();
+    const std::regex entry("<observables\\s+list\\s*=\\s*\"([^\"]*)\"");
+    for (std::sregex_iterator it(text.begin(), text.end(), entry), end; it != end; ++it) {
+        std::stringstream list((*it)[1].str());
+        std::string name;
+        while (std::getline(list, name, ','))
+            if (!name.empty()) observables.push_back(name);
+    }
+    return observables;
+}
+
+// Rounds the mantissa of a float to bits (1 to 23), to nearest
+inline float TruncateMantissa(float value, Int_t bits) {
+    if (bits <= 0 || bits >= 23) return value;
+    uint32_t word;
+    std::memcpy(&word, &value, sizeof(word));
+    const uint32_t dropped = 23 - bits;
+    const uint32_t exponent = word & 0x7f800000u;
+    if (exponent == 0x7f800000u) return value;
+    word += 1u << (dropped - 1);
+    word &= ~((1u << dropped) - 1);
+    std::memcpy(&value, &word, sizeof(word));
+    return value;
+}
+
+class SlimWriter {
+   private:
+    std::vector<std::string> fObservables;
+    SlimOutputSettings fSettings;
+    std::unique_ptr<RNTupleAPI::RNTupleWriter> fWriter;
+    std::shared_ptr<Int_t> fEventID;
+    std::vector<std::shared_ptr<Double_t>> fDoubles;
+    std::vector<std::shared_ptr<float>> fFloats;
+    size_t fEntries = 0;
+
+    static Int_t GetCompressionSettings(const SlimOutputSettings& settings) {
+        if (settings.compression == "lz4") return ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kLZ4, settings.level);
+        if (settings.compression == "zlib") return ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kZLIB, settings.level);
+        if (settings.compression != "zstd")
+            std::cerr << "Warning: unknown compression " << settings.compression << ", using zstd" << std::endl;
+        return ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kZSTD, settings.level);
+    }
+
+   public:
+    SlimWriter(const std::string& filename, const std::vector<std::string>& observables, const SlimOutputSettings& settings = {})
+        : fObservables(observables), fSettings(settings) {
+        auto model = RNTupleAPI::RNTupleModel::Create();
+        fEventID = model->MakeField<Int_t>("eventID");
+        for (const auto& name : fObservables) {
+            if (fSettings.mantissaBits > 0)
+                fFloats.push_back(model->MakeField<float>(name));
+            else
+                fDoubles.push_back(model->MakeField<Double_t>(name));
+        }
+
+        RNTupleAPI::RNTupleWriteOptions options;
+        options.SetCompression(GetCompressionSettings(fSettings));
+        fWriter = RNTupleAPI::RNTupleWriter::Recreate(std::move(model), fSettings.ntupleName, filename, options);
+    }
+
+    const std::vector<std::string>& GetObservables() const { return fObservables; }
+    size_t GetEntries() const { return fEntries; }
+
+    // One value per selected observable, in the order of GetObservables
+    void Fill(Int_t eventID, const std::vector<Double_t>& values) {
+        if (values.size() != fObservables.size()) {
+            std::cerr << "Error: " << values.size() << " values for " << fObservables.size() << " observables" << std::endl;
+            return;
+        }
+        *fEventID = eventID;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (fSettings.mantissaBits > 0)
+                *fFloats[i] = TruncateMantissa(values[i], fSettings.mantissaBits);
+            else
+                *fDoubles[i] = values[i];
+        }
+        fWriter->Fill();
+        fEntries++;
+    }
+
+    // Flushes and closes the file, also done on destruction
+    void Close() { fWriter.reset(); }
+};
+
+#endif
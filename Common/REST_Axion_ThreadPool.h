@@ -0,0 +1,52 @@
+#ifndef REST_AXION_THREADPOOL_H
+#define REST_AXION_THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#include <TROOT.h>
+
+//*******************************************************************************************************
+//*** Description: Minimal thread pool used by the Common helpers. ParallelFor distributes the indices
+//*** [0, n) dynamically over nThreads workers and calls func(index, worker), so that every worker can keep
+//*** its own state (field handles, GSL workspaces, ...) indexed by the worker number.
+//***
+//*** GetNumberOfThreads(0) returns the number of hardware threads. The calling thread is used as worker 0.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Number of workers to use for n tasks: 0 means all the hardware threads
+inline UInt_t GetNumberOfThreads(UInt_t nThreads, size_t n = 0) {
+    if (nThreads == 0) nThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (n > 0) nThreads = std::min<size_t>(nThreads, n);
+    return std::max(1u, nThreads);
+}
+
+// Calls func(index, worker) for every index in [0, n) on nThreads workers
+inline void ParallelFor(size_t n, UInt_t nThreads, const std::function<void(size_t, UInt_t)>& func) {
+    if (n == 0) return;
+    nThreads = GetNumberOfThreads(nThreads, n);
+
+    if (nThreads == 1) {
+        for (size_t i = 0; i < n; i++) func(i, 0);
+        return;
+    }
+
+    ROOT::EnableThreadSafety();
+
+    std::atomic<size_t> next(0);
+    auto work = [&](UInt_t worker) {
+        for (size_t i = next++; i < n; i = next++) func(i, worker);
+    };
+
+    std::vector<std::thread> threads;
+    for (UInt_t t = 1; t < nThreads; t++) threads.emplace_back(work, t);
+    work(0);
+    for (auto& thread : threads) thread.join();
+}
+
+#endif
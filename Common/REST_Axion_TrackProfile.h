@@ -0,0 +1,81 @@
+#ifndef REST_AXION_TRACKPROFILE_H
+#define REST_AXION_TRACKPROFILE_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include <Rtypes.h>
+
+//*******************************************************************************************************
+//*** Description: Natural cubic spline of a 1D profile sampled on a uniform grid, used to keep the
+//*** transversal field B_T(l) along a track once it has been evaluated, so that later integrations of the
+//*** same track read the spline instead of the 3D field map.
+//***
+//*** Usage:
+//***   TrackProfile profile;
+//***   profile.Build(length, 2., [&](Double_t l) { return worker.GetTransversalComponentInParametricTrack(l); });
+//***   Double_t Bt = profile.Evaluate(l);
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+class TrackProfile {
+   private:
+    Double_t fStep = 0;
+    Double_t fLength = 0;
+    std::vector<Double_t> fValues;
+    // Second derivatives at the nodes
+    std::vector<Double_t> fCurvatures;
+
+   public:
+    Bool_t IsEmpty() const { return fValues.empty(); }
+    Double_t GetStep() const { return fStep; }
+    Double_t GetLength() const { return fLength; }
+    size_t GetNumberOfNodes() const { return fValues.size(); }
+
+    void Clear() {
+        fValues.clear();
+        fCurvatures.clear();
+        fStep = fLength = 0;
+    }
+
+    // Samples func on [0, length] with nodes at most step apart and fits the spline
+    void Build(Double_t length, Double_t step, const std::function<Double_t(Double_t)>& func) {
+        Clear();
+        if (length <= 0 || step <= 0) return;
+
+        const size_t nCells = std::max<size_t>(1, (size_t)std::ceil(length / step));
+        fLength = length;
+        fStep = length / nCells;
+        fValues.resize(nCells + 1);
+        for (size_t i = 0; i <= nCells; i++) fValues[i] = func(i * fStep);
+
+        // Tridiagonal system of the natural spline on a uniform grid: M[i-1] + 4 M[i] + M[i+1] = 6 d2y[i] / h^2
+        const size_t n = fValues.size();
+        fCurvatures.assign(n, 0);
+        if (n < 3) return;
+        std::vector<Double_t> diagonal(n, 4), rhs(n, 0);
+        for (size_t i = 1; i + 1 < n; i++) rhs[i] = 6 * (fValues[i + 1] - 2 * fValues[i] + fValues[i - 1]) / (fStep * fStep);
+        for (size_t i = 2; i + 1 < n; i++) {
+            const Double_t factor = 1 / diagonal[i - 1];
+            diagonal[i] -= factor;
+            rhs[i] -= factor * rhs[i - 1];
+        }
+        for (size_t i = n - 2; i >= 1; i--) fCurvatures[i] = (rhs[i] - fCurvatures[i + 1]) / diagonal[i];
+    }
+
+    // Value at l, clamped to [0, length]
+    Double_t Evaluate(Double_t l) const {
+        if (fValues.empty()) return 0;
+        if (fValues.size() == 1) return fValues[0];
+        const Double_t u = std::min(std::max(l / fStep, 0.), (Double_t)(fValues.size() - 1));
+        const size_t i = std::min((size_t)u, fValues.size() - 2);
+        const Double_t b = u - i, a = 1 - b;
+        const Double_t h2 = fStep * fStep / 6;
+        return a * fValues[i] + b * fValues[i + 1] + ((a * a * a - a) * fCurvatures[i] + (b * b * b - b) * fCurvatures[i + 1]) * h2;
+    }
+};
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef REST_AXION_TRACKSET_H
+#define REST_AXION_TRACKSET_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include <Rtypes.h>
+#include <TVector3.h>
+#include <TCanvas.h>
+#include <TGraph.h>
+#include <TMultiGraph.h>
+#include <TLegend.h>
+#include "REST_Axion_ThreadPool.h"
+#include "REST_Axion_FieldWorker.h"
+
+//*******************************************************************************************************
+//*** Description: Batch of tracks through a SharedFieldMap, shared by the drawing and the integration of
+//*** the tracks instead of every consumer computing them again.
+//***
+//*** The entry and exit points of all the tracks are found once, with the intersection of the line from the
+//*** start to the end point with the volumes of the map (SharedFieldMap::GetFieldBoundaries). Sample then
+//*** evaluates B_T every dL along the part of every track inside the field, in parallel over tracks, into a
+//*** single contiguous buffer, track after track. The standard integrations of any conversion point read the
+//*** samples, SetWorkerTrack places a FieldWorker on a track without another boundary query for the GSL
+//*** integration, and DrawTracks draws the geometry and the profiles from the same data.
+//***
+//*** With SetSampleFromStart the samples start at the start point of every track and run every dL up to its
+//*** end point, zero outside the field, as `TRestAxionMagneticField::GetTransversalComponentAlongPath(start,
+//*** end, dL)`, so the absorption of the buffer gas is accumulated from the start point as in that path.
+//***
+//*** Usage:
+//***   TrackSet tracks(&map);
+//***   tracks.SetTracks(startPoints, endPoints);
+//***   tracks.Sample(10, nThreads);
+//***   std::vector<Double_t> probabilities = tracks.GammaTransmissionProbabilities(worker.GetConversionPoint(Ea, ma));
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+class TrackSet {
+   private:
+    struct Track {
+        TVector3 start, end;
+        // Entry point and unit direction, the track crossing the field for length mm (0 when it misses it)
+        TVector3 entry, direction;
+        Double_t length = 0;
+        // First sample in the buffer and number of samples
+        size_t offset = 0;
+        size_t nSamples = 0;
+        // Time of the sampling of the track (μs)
+        Double_t samplingTime = 0;
+    };
+
+    const SharedFieldMap* fMap = nullptr;
+    std::vector<Track> fTracks;
+    std::vector<Double_t> fSamples;
+    Double_t fStep = 0;
+    size_t fGeneration = 0;
+    Bool_t fFromStart = false;
+
+   public:
+    TrackSet(const SharedFieldMap* map) : fMap(map) {}
+
+    // Tracks from every start point to its end point, their entry and exit points computed here
+    void SetTracks(const std::vector<TVector3>& startPoints, const std::vector<TVector3>& endPoints) {
+        fTracks.clear();
+        fSamples.clear();
+        fStep = 0;
+        if (startPoints.size() != endPoints.size()) {
+            std::cerr << "Error: " << startPoints.size() << " start points for " << endPoints.size() << " end points" << std::endl;
+            return;
+        }
+        fTracks.resize(startPoints.size());
+        for (size_t t = 0; t < fTracks.size(); t++) {
+            Track& track = fTracks[t];
+            track.start = startPoints[t];
+            track.end = endPoints[t];
+            track.direction = (track.end - track.start).Unit();
+            track.entry = track.start;
+            const std::vector<TVector3> boundaries = fMap->GetFieldBoundaries(track.start, track.direction);
+            if (boundaries.size() != 2) continue;
+            track.entry = boundaries[0];
+            track.length = (boundaries[1] - boundaries[0]).Mag();
+        }
+    }
+
+    size_t GetNumberOfTracks() const { return fTracks.size(); }
+    const TVector3& GetStartPoint(size_t t) const { return fTracks[t].start; }
+    const TVector3& GetEndPoint(size_t t) const { return fTracks[t].end; }
+    const TVector3& GetEntryPoint(size_t t) const { return fTracks[t].entry; }
+    TVector3 GetExitPoint(size_t t) const { return fTracks[t].entry + fTracks[t].length * fTracks[t].direction; }
+    const TVector3& GetDirection(size_t t) const { return fTracks[t].direction; }
+    Double_t GetLength(size_t t) const { return fTracks[t].length; }
+    Bool_t CrossesField(size_t t) const { return fTracks[t].length > 0; }
+
+    // Samples from the start point of the tracks to their end point instead of along the field part only. The
+    // tracks have to be sampled again
+    void SetSampleFromStart(Bool_t fromStart) {
+        fFromStart = fromStart;
+        fSamples.clear();
+        fStep = 0;
+    }
+    Bool_t GetSampleFromStart() const { return fFromStart; }
+
+    // First sample of a track, its start or its entry point
+    const TVector3& GetSampleOrigin(size_t t) const { return fFromStart ? fTracks[t].start : fTracks[t].entry; }
+
+    // Number of samples of a track every dL (mm), 0 when it misses the field
+    size_t GetNumberOfSamples(size_t t, Double_t dL) const {
+        const Track& track = fTracks[t];
+        if (dL <= 0 || track.length <= 0) return 0;
+        if (fFromStart) return (size_t)std::ceil((track.end - track.start).Mag() / dL);
+        return (size_t)(track.length / dL) + 1;
+    }
+
+    // Samples B_T every dL (mm) along every track, from its sample origin, in parallel over the tracks
+    void Sample(Double_t dL, UInt_t nThreads = 1) {
+        fSamples.clear();
+        fStep = dL;
+        fGeneration = fMap->GetGeneration();
+        if (dL <= 0) return;
+        size_t offset = 0;
+        for (size_t t = 0; t < fTracks.size(); t++) {
+            fTracks[t].offset = offset;
+            fTracks[t].nSamples = GetNumberOfSamples(t, dL);
+            offset += fTracks[t].nSamples;
+        }
+        fSamples.resize(offset);
+        ParallelFor(fTracks.size(), GetNumberOfThreads(nThreads, fTracks.size()), [&](size_t t, UInt_t) {
+            Track& track = fTracks[t];
+            const auto start = std::chrono::steady_clock::now();
+            fMap->SampleTransversalComponent(GetSampleOrigin(t), track.direction, dL, track.nSamples, fSamples.data() + track.offset);
+            track.samplingTime = std::chrono::duration<Double_t, std::micro>(std::chrono::steady_clock::now() - start).count();
+        });
+    }
+
+    Bool_t IsSampled() const { return fStep > 0 && fGeneration == fMap->GetGeneration(); }
+    Double_t GetStep() const { return fStep; }
+
+    // Samples of a track, every GetStep() mm from its sample origin
+    const Double_t* GetProfile(size_t t) const { return fSamples.data() + fTracks[t].offset; }
+    size_t GetNumberOfSamples(size_t t) const { return fTracks[t].nSamples; }
+    std::vector<Double_t> GetProfileValues(size_t t) const { return {GetProfile(t), GetProfile(t) + GetNumberOfSamples(t)}; }
+    Double_t GetSamplingTime(size_t t) const { return fTracks[t].samplingTime; }
+
+    // Places the worker on a track, with the entry point and length found here
+    void SetWorkerTrack(FieldWorker& worker, size_t t) const { worker.SetTrack(fTracks[t].entry, fTracks[t].direction, fTracks[t].length); }
+
+    // Standard integration of a conversion point over the samples of every track, in parallel over the tracks
+    std::vector<Double_t> GammaTransmissionProbabilities(const ConversionPoint& point, UInt_t nThreads = 1) const {
+        std::vector<Double_t> probabilities(fTracks.size(), 0);
+        if (!IsSampled()) {
+            std::cerr << "Error: the tracks are not sampled for the current field" << std::endl;
+            return probabilities;
+        }
+        const Double_t q = MomentumTransfer(point.Ea, point.ma, point.mg);
+        ParallelFor(fTracks.size(), GetNumberOfThreads(nThreads, fTracks.size()), [&](size_t t, UInt_t) {
+            if (fTracks[t].nSamples == 0) return;
+            REST_AXION_COUNT(standardIntegrals, 1);
+            probabilities[t] = fMap->GetBLFactor() * CoherenceSum(GetProfile(t), fTracks[t].nSamples, fStep, q, point.Gamma);
+        });
+        return probabilities;
+    }
+
+    // Batched standard integration of many conversion points per track, probabilities[t][p]
+    std::vector<std::vector<Double_t>> GammaTransmissionProbabilities(const std::vector<ConversionPoint>& points, UInt_t nThreads = 1) const {
+        std::vector<std::vector<Double_t>> probabilities(fTracks.size(), std::vector<Double_t>(points.size(), 0));
+        if (!IsSampled()) {
+            std::cerr << "Error: the tracks are not sampled for the current field" << std::endl;
+            return probabilities;
+        }
+        std::vector<Double_t> q, Gamma;
+        for (const auto& point : points) {
+            q.push_back(MomentumTransfer(point.Ea, point.ma, point.mg));
+            Gamma.push_back(point.Gamma);
+        }
+        ParallelFor(fTracks.size(), GetNumberOfThreads(nThreads, fTracks.size()), [&](size_t t, UInt_t) {
+            if (fTracks[t].nSamples == 0) return;
+            REST_AXION_COUNT(standardIntegrals, points.size());
+            CoherenceSumBatch(GetProfile(t), fTracks[t].nSamples, fStep, q.data(), Gamma.data(), points.size(), probabilities[t].data());
+            for (auto& probability : probabilities[t]) probability *= fMap->GetBLFactor();
+        });
+        return probabilities;
+    }
+
+    // Draws the tracks of the indices (all of them if empty) from the entry to the exit of the field, in the
+    // XZ and YZ planes, and their sampled profiles. The canvas is owned by the caller
+    TCanvas* DrawTracks(const std::vector<size_t>& indices = {}, const std::string& name = "TrackSet") const {
+        std::vector<size_t> selected = indices;
+        if (selected.empty())
+            for (size_t t = 0; t < fTracks.size(); t++) selected.push_back(t);
+
+        TCanvas* canvas = new TCanvas(name.c_str(), name.c_str(), 1500, 500);
+        canvas->Divide(3, 1);
+        TMultiGraph* xz = new TMultiGraph((name + "_XZ").c_str(), ";Z (mm);X (mm)");
+        TMultiGraph* yz = new TMultiGraph((name + "_YZ").c_str(), ";Z (mm);Y (mm)");
+        TMultiGraph* profiles = new TMultiGraph((name + "_Profiles").c_str(), ";l (mm);B_{T} (T)");
+        TLegend* legend = new TLegend(0.6, 0.7, 0.88, 0.88);
+        std::vector<Int_t> colors = {kRed, kBlue, kGreen + 2, kMagenta, kOrange + 7, kCyan + 2};
+        for (size_t k = 0; k < selected.size(); k++) {
+            const size_t t = selected[k];
+            if (t >= fTracks.size() || !CrossesField(t)) continue;
+            const Int_t color = colors[k % colors.size()];
+            const TVector3 entry = GetEntryPoint(t), exit = GetExitPoint(t);
+            Double_t z[2] = {entry.Z(), exit.Z()}, x[2] = {entry.X(), exit.X()}, y[2] = {entry.Y(), exit.Y()};
+            TGraph* graphXZ = new TGraph(2, z, x);
+            TGraph* graphYZ = new TGraph(2, z, y);
+            graphXZ->SetLineColor(color);
+            graphYZ->SetLineColor(color);
+            xz->Add(graphXZ, "L");
+            yz->Add(graphYZ, "L");
+            if (!IsSampled() || GetNumberOfSamples(t) == 0) continue;
+            std::vector<Double_t> l(GetNumberOfSamples(t));
+            for (size_t i = 0; i < l.size(); i++) l[i] = i * fStep;
+            TGraph* profile = new TGraph(l.size(), l.data(), GetProfile(t));
+            profile->SetLineColor(color);
+            profile->SetLineWidth(2);
+            profiles->Add(profile, "L");
+            legend->AddEntry(profile, ("Track " + std::to_string(t)).c_str(), "l");
+        }
+        canvas->cd(1);
+        xz->Draw("A");
+        canvas->cd(2);
+        yz->Draw("A");
+        canvas->cd(3);
+        profiles->Draw("A");
+        legend->Draw();
+        canvas->Update();
+        return canvas;
+    }
+};
+
+#endif
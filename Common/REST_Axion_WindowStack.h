@@ -0,0 +1,209 @@
+#ifndef REST_AXION_WINDOWSTACK_H
+#define REST_AXION_WINDOWSTACK_H
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include <Rtypes.h>
+#include "TRestAxionXrayWindow.h"
+
+//*******************************************************************************************************
+//*** Description: Combined transmission of a stack of TRestAxionXrayWindow on the same plane, as the
+//*** windows of one `TRestAxionTransmissionProcess` in RayTracing_BabyIAXO.rml.
+//***
+//*** At every point of the plane a window either transmits like its material, T_w(E), or is open (1) or
+//*** blocked (0) by its pattern mask (TRestPatternMask). The geometry of the stack is rasterised once into a
+//*** bitmap of pixels, each one holding the class of the point: which windows are present and whether any of
+//*** them blocks. The transmission of every class, the product of the materials present, is tabulated on a
+//*** uniform energy grid. An event costs one pixel load and one linear interpolation, and a batch of events
+//*** is evaluated in a single pass with Evaluate.
+//***
+//*** The classes are found from the library at two probe energies: a window is open at a pixel if it
+//*** transmits 1 at both, blocked if it transmits 0, and present otherwise. The material curve of a window is
+//*** taken at its first present pixel. The pixel size sets the resolution of the mask boundaries, use
+//*** GetNumberOfClasses/Validate to check the rasterisation.
+//***
+//*** Usage:
+//***   WindowStack stack;
+//***   stack.AddWindow(&mylar);
+//***   stack.AddWindow(&strongBack);
+//***   stack.Build(10, 0.05, 0.1, 20, 0.01);      // half size (mm), pixel (mm), Emin, Emax, step (keV)
+//***   Double_t T = stack.GetTransmission(Ea, x, y);
+//***
+//*** Dependencies:
+//*** `TRestAxionXrayWindow::GetTransmission(energy, x, y)`, at build time.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+class WindowStack {
+   private:
+    std::vector<TRestAxionXrayWindow*> fWindows;
+
+    // Raster of the plane, [-fHalfSize, fHalfSize] in x and y, and class of every pixel
+    Double_t fHalfSize = 0;
+    Double_t fPixel = 0;
+    Double_t fInvPixel = 0;
+    Int_t fNumberOfPixels = 0;
+    std::vector<uint8_t> fPixelClass;
+
+    // Energy grid and transmission of every class, one row of fNumberOfEnergies per class
+    Double_t fEmin = 0;
+    Double_t fStep = 0;
+    Double_t fInvStep = 0;
+    Int_t fNumberOfEnergies = 0;
+    std::vector<float> fTransmission;
+    std::vector<uint32_t> fClassKeys;
+
+    // Class of the points outside the raster, the transmission there is taken from the library
+    static constexpr uint8_t kOutside = 255;
+
+    // Bit w of the key: window w present, last bit: blocked
+    static constexpr uint32_t kBlocked = 1u << 31;
+
+   public:
+    void AddWindow(TRestAxionXrayWindow* window) {
+        fWindows.push_back(window);
+        Clear();
+    }
+
+    size_t GetNumberOfWindows() const { return fWindows.size(); }
+    size_t GetNumberOfClasses() const { return fClassKeys.size(); }
+    Bool_t IsEmpty() const { return fTransmission.empty(); }
+    size_t GetMemorySize() const { return fPixelClass.size() + fTransmission.size() * sizeof(float); }
+
+    void Clear() {
+        fPixelClass.clear();
+        fTransmission.clear();
+        fClassKeys.clear();
+        fNumberOfPixels = fNumberOfEnergies = 0;
+    }
+
+    // Rasterises [-halfSize, halfSize]^2 (mm) with pixels of pixelSize (mm) and tabulates the classes between
+    // Emin and Emax (keV) every step (keV). Returns false if the stack has more classes than the bitmap holds
+    Bool_t Build(Double_t halfSize, Double_t pixelSize, Double_t Emin, Double_t Emax, Double_t step) {
+        Clear();
+        if (fWindows.empty() || fWindows.size() > 31 || halfSize <= 0 || pixelSize <= 0 || Emax <= Emin || step <= 0) return false;
+
+        fHalfSize = halfSize;
+        fNumberOfPixels = std::max(1, (Int_t)std::ceil(2 * halfSize / pixelSize));
+        fPixel = 2 * halfSize / fNumberOfPixels;
+        fInvPixel = 1 / fPixel;
+        fNumberOfEnergies = std::max(2, (Int_t)std::ceil((Emax - Emin) / step) + 1);
+        fEmin = Emin;
+        fStep = (Emax - Emin) / (fNumberOfEnergies - 1);
+        fInvStep = 1 / fStep;
+
+        const Double_t probe[2] = {Emin + 0.25 * (Emax - Emin), Emin + 0.75 * (Emax - Emin)};
+        std::vector<std::pair<Double_t, Double_t>> presentAt(fWindows.size(), {0, 0});
+        std::vector<Bool_t> found(fWindows.size(), false);
+        std::map<uint32_t, uint8_t> classes;
+
+        fPixelClass.assign((size_t)fNumberOfPixels * fNumberOfPixels, 0);
+        for (Int_t iy = 0; iy < fNumberOfPixels; iy++) {
+            for (Int_t ix = 0; ix < fNumberOfPixels; ix++) {
+                const Double_t x = -halfSize + (ix + 0.5) * fPixel, y = -halfSize + (iy + 0.5) * fPixel;
+                uint32_t key = 0;
+                for (size_t w = 0; w < fWindows.size(); w++) {
+                    const Double_t t0 = fWindows[w]->GetTransmission(probe[0], x, y);
+                    const Double_t t1 = fWindows[w]->GetTransmission(probe[1], x, y);
+                    if (t0 == 0 && t1 == 0) {
+                        key |= kBlocked;
+                    } else if (t0 != 1 || t1 != 1) {
+                        key |= 1u << w;
+                        if (!found[w]) presentAt[w] = {x, y};
+                        found[w] = true;
+                    }
+                }
+                if (key & kBlocked) key = kBlocked;
+                auto it = classes.find(key);
+                if (it == classes.end()) {
+                    if (classes.size() >= kOutside) {
+                        std::cerr << "Error: the window stack has more than " << (Int_t)kOutside << " classes" << std::endl;
+                        Clear();
+                        return false;
+                    }
+                    it = classes.emplace(key, classes.size()).first;
+                    fClassKeys.push_back(key);
+                }
+                fPixelClass[(size_t)iy * fNumberOfPixels + ix] = it->second;
+            }
+        }
+
+        // Material curves of the windows and product of every class
+        std::vector<std::vector<Double_t>> material(fWindows.size(), std::vector<Double_t>(fNumberOfEnergies, 1));
+        for (size_t w = 0; w < fWindows.size(); w++) {
+            if (!found[w]) continue;
+            for (Int_t e = 0; e < fNumberOfEnergies; e++)
+                material[w][e] = fWindows[w]->GetTransmission(fEmin + e * fStep, presentAt[w].first, presentAt[w].second);
+        }
+        fTransmission.assign(fClassKeys.size() * fNumberOfEnergies, 1.f);
+        for (size_t c = 0; c < fClassKeys.size(); c++) {
+            float* row = fTransmission.data() + c * fNumberOfEnergies;
+            for (Int_t e = 0; e < fNumberOfEnergies; e++) {
+                if (fClassKeys[c] & kBlocked) {
+                    row[e] = 0;
+                    continue;
+                }
+                Double_t product = 1;
+                for (size_t w = 0; w < fWindows.size(); w++)
+                    if (fClassKeys[c] & (1u << w)) product *= material[w][e];
+                row[e] = product;
+            }
+        }
+        return true;
+    }
+
+    // Class of the pixel of (x, y) in mm, kOutside outside the raster
+    uint8_t GetClass(Double_t x, Double_t y) const {
+        const Double_t u = (x + fHalfSize) * fInvPixel, v = (y + fHalfSize) * fInvPixel;
+        if (!(u >= 0 && v >= 0 && u < fNumberOfPixels && v < fNumberOfPixels)) return kOutside;
+        return fPixelClass[(size_t)v * fNumberOfPixels + (size_t)u];
+    }
+
+    // Transmission of a class at Ea (keV), clamped to the energy range
+    Double_t GetClassTransmission(uint8_t c, Double_t Ea) const {
+        const float* row = fTransmission.data() + (size_t)c * fNumberOfEnergies;
+        const Double_t u = std::min(std::max((Ea - fEmin) * fInvStep, 0.), fNumberOfEnergies - 1.000001);
+        const Int_t i = (Int_t)u;
+        const Double_t t = u - i;
+        return row[i] + t * (row[i + 1] - row[i]);
+    }
+
+    // Transmission of the whole stack at Ea (keV) and (x, y) (mm)
+    Double_t GetTransmission(Double_t Ea, Double_t x, Double_t y) const {
+        const uint8_t c = GetClass(x, y);
+        if (c != kOutside) return GetClassTransmission(c, Ea);
+        Double_t product = 1;
+        for (const auto& window : fWindows) product *= window->GetTransmission(Ea, x, y);
+        return product;
+    }
+
+    // Transmission of n events in one pass
+    void Evaluate(const Double_t* Ea, const Double_t* x, const Double_t* y, size_t n, Double_t* transmission) const {
+        for (size_t i = 0; i < n; i++) transmission[i] = GetTransmission(Ea[i], x[i], y[i]);
+    }
+
+    // Maximum difference with the product of the library windows at n points (Ea, x, y). The differences
+    // concentrate on the pixels crossed by the mask boundaries
+    Double_t Validate(const std::vector<Double_t>& Ea, const std::vector<Double_t>& x, const std::vector<Double_t>& y,
+                      size_t* nMismatches = nullptr, Double_t tolerance = 1e-3) const {
+        Double_t maxDifference = 0;
+        size_t mismatches = 0;
+        for (size_t i = 0; i < Ea.size(); i++) {
+            Double_t product = 1;
+            for (const auto& window : fWindows) product *= window->GetTransmission(Ea[i], x[i], y[i]);
+            const Double_t difference = std::abs(GetTransmission(Ea[i], x[i], y[i]) - product);
+            maxDifference = std::max(maxDifference, difference);
+            if (difference > tolerance) mismatches++;
+        }
+        if (nMismatches != nullptr) *nMismatches = mismatches;
+        return maxDifference;
+    }
+};
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef REST_AXION_WOLTERPACKETTRACER_H
+#define REST_AXION_WOLTERPACKETTRACER_H
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include <Rtypes.h>
+#include "REST_Axion_ThreadPool.h"
+
+//*******************************************************************************************************
+//*** Description: Packet ray tracer of the nested shells of a true Wolter I optics, as the xmm
+//*** TRestAxionTrueWolterOptics of RayTracing_BabyIAXO.rml.
+//***
+//*** Every shell is a paraboloid in front of the intersection plane (z in [-Lm, 0] from the optics center) and
+//*** a hyperboloid behind it (z in [0, Lm]), both written as quadrics of revolution
+//***   r^2 = A + B z + C z^2,
+//*** with the radius R3 at the intersection plane, the focal length F and equal grazing angles at the
+//*** intersection: tan(4 alpha) = R3 / F. A ray is intersected and reflected with the same closed-form
+//*** arithmetic on any shell, so that W rays (W = 4, 8, 16) are traced together in structure-of-arrays lanes
+//*** without branches, that the compiler vectorises. Lost rays are kept in the packet with efficiency 0.
+//***
+//*** - The candidate shell of a ray is found from its radius at the entrance plane in a uniform bucket table
+//***   finer than the spacing of the shells, one load and one comparison, instead of a search over the shells.
+//***   The ray is lost if it enters through the thickness of a shell or outside the optics.
+//*** - The reflectivity of the mirrors is looked up in a grid of (grazing angle, energy), bilinearly
+//***   interpolated, tabulated once from the library mirror.
+//*** - The ray must reflect once on the paraboloid and once on the hyperboloid of its shell, and clear the back
+//***   of the inner shell at the intersection and exit planes. The efficiency is the product of the two
+//***   reflectivities, and the ray is left at the exit plane (z = Lm) with its reflected direction.
+//***
+//*** Usage:
+//***   WolterPacketTracer tracer;
+//***   tracer.SetGeometry(R3, thickness, mirrorLength, focal);    // mm
+//***   tracer.SetCenter(7000);                                     // opticsPosition
+//***   tracer.BuildReflectivity(reflectivity, 0.05, 0.1, 10);     // rad, keV
+//***   tracer.Trace(rays);                                         // WolterRays, in place
+//***
+//*** Dependencies:
+//*** none, the geometry and the reflectivity are given by the macro from the library optics.
+//***
+//*** Author: Raul Ena
+//*******************************************************************************************************
+
+// Rays of the tracer in structure-of-arrays layout, in mm and keV. Trace leaves them at the exit plane
+struct WolterRays {
+    std::vector<Double_t> x, y, z;
+    std::vector<Double_t> dx, dy, dz;
+    std::vector<Double_t> energy;
+    std::vector<Double_t> efficiency;
+    std::vector<Int_t> shell;
+
+    size_t size() const { return x.size(); }
+
+    void resize(size_t n) {
+        for (auto v : {&x, &y, &z, &dx, &dy, &dz, &energy, &efficiency}) v->resize(n);
+        shell.resize(n);
+    }
+
+    void Set(size_t i, Double_t px, Double_t py, Double_t pz, Double_t ux, Double_t uy, Double_t uz, Double_t E) {
+        const Double_t norm = 1 / std::sqrt(ux * ux + uy * uy + uz * uz);
+        x[i] = px;
+        y[i] = py;
+        z[i] = pz;
+        dx[i] = ux * norm;
+        dy[i] = uy * norm;
+        dz[i] = uz * norm;
+        energy[i] = E;
+        efficiency[i] = 0;
+        shell[i] = -1;
+    }
+};
+
+// Reflectivity on a uniform grid of grazing angle (rad) and energy (keV), 0 above the maximum angle
+class ReflectivityTable {
+   private:
+    Double_t fMaxAngle = 0;
+    Double_t fInvAngleStep = 0;
+    Double_t fEmin = 0;
+    Double_t fInvEnergyStep = 0;
+    Int_t fNumberOfAngles = 0;
+    Int_t fNumberOfEnergies = 0;
+    std::vector<Double_t> fValues;
+
+   public:
+    void Build(const std::function<Double_t(Double_t, Double_t)>& reflectivity, Double_t maxAngle, Double_t Emin, Double_t Emax,
+               Int_t nAngles = 501, Int_t nEnergies = 500) {
+        fMaxAngle = maxAngle;
+        fNumberOfAngles = std::max(2, nAngles);
+        fNumberOfEnergies = std::max(2, nEnergies);
+        const Double_t angleStep = maxAngle / (fNumberOfAngles - 1), energyStep = (Emax - Emin) / (fNumberOfEnergies - 1);
+        fInvAngleStep = 1 / angleStep;
+        fEmin = Emin;
+        fInvEnergyStep = 1 / energyStep;
+        fValues.resize((size_t)fNumberOfAngles * fNumberOfEnergies);
+        for (Int_t a = 0; a < fNumberOfAngles; a++)
+            for (Int_t e = 0; e < fNumberOfEnergies; e++)
+                fValues[(size_t)a * fNumberOfEnergies + e] = reflectivity(a * angleStep, Emin + e * energyStep);
+    }
+
+    Bool_t IsEmpty() const { return fValues.empty(); }
+
+    Double_t Get(Double_t angle, Double_t Ea) const {
+        const Double_t u = std::min(std::max(angle * fInvAngleStep, 0.), fNumberOfAngles - 1.000001);
+        const Double_t v = std::min(std::max((Ea - fEmin) * fInvEnergyStep, 0.), fNumberOfEnergies - 1.000001);
+        const Int_t i = (Int_t)u, j = (Int_t)v;
+        const Double_t tu = u - i, tv = v - j;
+        const Double_t* row = fValues.data() + (size_t)i * fNumberOfEnergies + j;
+        const Double_t low = row[0] + tv * (row[1] - row[0]);
+        const Double_t high = row[fNumberOfEnergies] + tv * (row[fNumberOfEnergies + 1] - row[fNumberOfEnergies]);
+        return (angle <= fMaxAngle) * (low + tu * (high - low));
+    }
+};
+
+class WolterPacketTracer {
+   private:
+    // Quadric of every shell, r^2 = A + B z + C z^2 with z from the intersection plane
+    struct Quadric {
+        Double_t A, B, C;
+    };
+
+    std::vector<Quadric> fParaboloid;
+    std::vector<Quadric> fHyperboloid;
+    std::vector<Double_t> fEntranceRadius;
+    std::vector<Double_t> fThickness;
+
+    // Radius of the back of the inner shell, 0 for the innermost one, at the entrance, intersection and exit planes
+    std::vector<Double_t> fEntranceBack;
+    std::vector<Double_t> fMiddleBack;
+    std::vector<Double_t> fExitBack;
+    Double_t fMirrorLength = 0;
+    Double_t fFocal = 0;
+    Double_t fCenter = 0;
+
+    // First shell with entrance radius above the lower edge of every bucket
+    std::vector<Int_t> fBuckets;
+    Double_t fInvBucketSize = 0;
+
+    ReflectivityTable fReflectivity;
+    UInt_t fNumberOfThreads = 0;
+
+    static Double_t Radius2(const Quadric& s, Double_t z) { return s.A + s.B * z + s.C * z * z; }
+
+    // Intersection with the quadric (A, B, C) of a ray from inside it: distance to the wall, negative if there is
+    // none. t solves a t^2 + 2 b t + c = 0 with c < 0, in the form that is stable for grazing rays (a ~ 0)
+    static Double_t Intersect(Double_t A, Double_t B, Double_t C, Double_t x, Double_t y, Double_t z, Double_t dx, Double_t dy,
+                              Double_t dz) {
+        const Double_t a = dx * dx + dy * dy - C * dz * dz;
+        const Double_t b = x * dx + y * dy - C * z * dz - 0.5 * B * dz;
+        const Double_t c = x * x + y * y - (A + B * z + C * z * z);
+        const Double_t D = b * b - a * c;
+        const Double_t denominator = b + std::sqrt(std::max(D, 0.));
+        const Double_t t = -c / denominator;
+        return (D >= 0) & (denominator > 0) ? t : -1;
+    }
+
+    // Specular reflection on the quadric (B, C) at the point (x, y, z), returns the grazing angle (rad)
+    static Double_t Reflect(Double_t B, Double_t C, Double_t x, Double_t y, Double_t z, Double_t& dx, Double_t& dy, Double_t& dz) {
+        const Double_t nx = 2 * x, ny = 2 * y, nz = -B - 2 * C * z;
+        const Double_t nn = nx * nx + ny * ny + nz * nz;
+        const Double_t dn = dx * nx + dy * ny + dz * nz;
+        const Double_t f = 2 * dn / nn;
+        dx -= f * nx;
+        dy -= f * ny;
+        dz -= f * nz;
+        // asin(s) = s + s^3 / 6 to 1e-7 below 2 degrees
+        const Double_t sine = std::abs(dn) / std::sqrt(nn);
+        return sine + sine * sine * sine / 6.;
+    }
+
+    // Every stage is a loop over the W lanes with the coefficients of the shells gathered first, so that it has
+    // no control flow and vectorises (-O3, and -fno-math-errno for the square roots)
+    template <size_t W>
+    void TracePacket(WolterRays& rays, size_t first) const {
+        const size_t count = std::min(W, rays.size() - first);
+        const Double_t Lm = fMirrorLength;
+        const Int_t lastShell = fEntranceRadius.size() - 1;
+
+        Double_t x[W], y[W], z[W], dx[W], dy[W], dz[W], E[W], alive[W], efficiency[W];
+        Double_t A[W], B[W], C[W], back[W];
+        Int_t shell[W];
+        for (size_t i = 0; i < W; i++) {
+            const size_t k = first + std::min(i, count - 1);
+            x[i] = rays.x[k];
+            y[i] = rays.y[k];
+            z[i] = rays.z[k] - fCenter;
+            dx[i] = rays.dx[k];
+            dy[i] = rays.dy[k];
+            dz[i] = rays.dz[k];
+            E[i] = rays.energy[k];
+        }
+
+        // Entrance plane
+        for (size_t i = 0; i < W; i++) {
+            const Double_t t = (-Lm - z[i]) / dz[i];
+            alive[i] = dz[i] > 0;
+            x[i] += t * dx[i];
+            y[i] += t * dy[i];
+            z[i] = -Lm;
+        }
+
+        // Candidate shell: the first one with the entrance radius above the ray
+        for (size_t i = 0; i < W; i++) {
+            const Double_t r = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+            const Int_t bucket = std::min<Double_t>(r * fInvBucketSize, fBuckets.size() - 1);
+            const Int_t k = fBuckets[bucket];
+            const Int_t candidate = k + (r >= fEntranceRadius[std::min(k, lastShell)]);
+            shell[i] = std::min(candidate, lastShell);
+            alive[i] *= (candidate <= lastShell) & (r >= fEntranceBack[shell[i]]);
+        }
+
+        // Paraboloid
+        for (size_t i = 0; i < W; i++) {
+            A[i] = fParaboloid[shell[i]].A;
+            B[i] = fParaboloid[shell[i]].B;
+            C[i] = fParaboloid[shell[i]].C;
+            back[i] = fMiddleBack[shell[i]];
+        }
+        for (size_t i = 0; i < W; i++) {
+            const Double_t t = Intersect(A[i], B[i], C[i], x[i], y[i], z[i], dx[i], dy[i], dz[i]);
+            x[i] += t * dx[i];
+            y[i] += t * dy[i];
+            z[i] += t * dz[i];
+            alive[i] *= (t > 0) & (z[i] <= 0);
+            const Double_t angle = Reflect(B[i], C[i], x[i], y[i], z[i], dx[i], dy[i], dz[i]);
+            efficiency[i] = fReflectivity.Get(angle, E[i]);
+
+            // Back of the inner shell at the intersection plane
+            const Double_t s = -z[i] / dz[i];
+            const Double_t px = x[i] + s * dx[i], py = y[i] + s * dy[i];
+            alive[i] *= (dz[i] > 0) & (px * px + py * py >= back[i] * back[i]);
+        }
+
+        // Hyperboloid
+        for (size_t i = 0; i < W; i++) {
+            A[i] = fHyperboloid[shell[i]].A;
+            B[i] = fHyperboloid[shell[i]].B;
+            C[i] = fHyperboloid[shell[i]].C;
+            back[i] = fExitBack[shell[i]];
+        }
+        for (size_t i = 0; i < W; i++) {
+            const Double_t t = Intersect(A[i], B[i], C[i], x[i], y[i], z[i], dx[i], dy[i], dz[i]);
+            x[i] += t * dx[i];
+            y[i] += t * dy[i];
+            z[i] += t * dz[i];
+            alive[i] *= (t > 0) & (z[i] >= 0) & (z[i] <= Lm);
+            const Double_t angle = Reflect(B[i], C[i], x[i], y[i], z[i], dx[i], dy[i], dz[i]);
+            efficiency[i] *= fReflectivity.Get(angle, E[i]);
+
+            // Exit plane and back of the inner shell there
+            const Double_t s = (Lm - z[i]) / dz[i];
+            x[i] += s * dx[i];
+            y[i] += s * dy[i];
+            z[i] = Lm;
+            alive[i] *= (dz[i] > 0) & (x[i] * x[i] + y[i] * y[i] >= back[i] * back[i]);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            const size_t k = first + i;
+            const Bool_t reflected = alive[i] > 0;
+            rays.efficiency[k] = reflected ? efficiency[i] : 0;
+            rays.shell[k] = reflected ? shell[i] : -1;
+            if (!reflected) continue;
+            rays.x[k] = x[i];
+            rays.y[k] = y[i];
+            rays.z[k] = z[i] + fCenter;
+            rays.dx[k] = dx[i];
+            rays.dy[k] = dy[i];
+            rays.dz[k] = dz[i];
+        }
+    }
+
+   public:
+    // Shells from their radius at the intersection plane R3 (mm, increasing), their thickness (mm), the mirror
+    // length Lm (mm) of both surfaces and the focal length F (mm) from the intersection plane
+    Bool_t SetGeometry(const std::vector<Double_t>& R3, const std::vector<Double_t>& thickness, Double_t mirrorLength, Double_t focal) {
+        fParaboloid.clear();
+        fHyperboloid.clear();
+        fEntranceRadius.clear();
+        fThickness.clear();
+        fEntranceBack.clear();
+        fMiddleBack.clear();
+        fExitBack.clear();
+        fBuckets.clear();
+        if (R3.empty() || R3.size() != thickness.size() || mirrorLength <= 0 || focal <= 0 || !std::is_sorted(R3.begin(), R3.end())) {
+            std::cerr << "Error: invalid Wolter geometry" << std::endl;
+            return false;
+        }
+        fMirrorLength = mirrorLength;
+        fFocal = focal;
+        fThickness = thickness;
+
+        for (const auto& r : R3) {
+            // Paraboloid focused at the far focus zP of the hyperboloid, which focuses at F
+            const Double_t alpha = std::atan(r / focal) / 4.;
+            const Double_t zP = r / std::tan(2 * alpha);
+            const Double_t P = std::sqrt(zP * zP + r * r) - zP;
+            fParaboloid.push_back({P * P + 2 * P * zP, -2 * P, 0});
+
+            const Double_t zc = (zP + focal) / 2, c = (zP - focal) / 2;
+            const Double_t a = (std::sqrt(r * r + zP * zP) - std::sqrt(r * r + focal * focal)) / 2;
+            const Double_t b2 = c * c - a * a;
+            fHyperboloid.push_back({b2 * (zc * zc / (a * a) - 1), -2 * zc * b2 / (a * a), b2 / (a * a)});
+
+            fEntranceRadius.push_back(std::sqrt(Radius2(fParaboloid.back(), -mirrorLength)));
+        }
+        for (size_t k = 0; k < R3.size(); k++) {
+            const Bool_t inner = k > 0;
+            fEntranceBack.push_back(inner ? fEntranceRadius[k - 1] + thickness[k - 1] : 0);
+            fMiddleBack.push_back(inner ? R3[k - 1] + thickness[k - 1] : 0);
+            fExitBack.push_back(inner ? std::sqrt(Radius2(fHyperboloid[k - 1], mirrorLength)) + thickness[k - 1] : 0);
+        }
+
+        // Buckets of half the closest spacing of the entrance radii, at most one radius per bucket
+        Double_t spacing = fEntranceRadius[0];
+        for (size_t k = 1; k < fEntranceRadius.size(); k++) spacing = std::min(spacing, fEntranceRadius[k] - fEntranceRadius[k - 1]);
+        const Double_t bucketSize = std::max(spacing / 2, fEntranceRadius.back() * 1e-6);
+        fInvBucketSize = 1 / bucketSize;
+        const size_t nBuckets = (size_t)(fEntranceRadius.back() * fInvBucketSize) + 2;
+        fBuckets.resize(nBuckets);
+        for (size_t b = 0; b < nBuckets; b++)
+            fBuckets[b] = std::upper_bound(fEntranceRadius.begin(), fEntranceRadius.end(), b * bucketSize) - fEntranceRadius.begin();
+        return true;
+    }
+
+    // Position along z of the intersection plane, opticsPosition in the rml
+    void SetCenter(Double_t z) { fCenter = z; }
+    Double_t GetCenter() const { return fCenter; }
+    void SetNumberOfThreads(UInt_t n) { fNumberOfThreads = n; }
+
+    // Tabulates reflectivity(angle in rad, energy in keV) up to maxAngle between Emin and Emax
+    void BuildReflectivity(const std::function<Double_t(Double_t, Double_t)>& reflectivity, Double_t maxAngle, Double_t Emin,
+                           Double_t Emax, Int_t nAngles = 501, Int_t nEnergies = 500) {
+        fReflectivity.Build(reflectivity, maxAngle, Emin, Emax, nAngles, nEnergies);
+    }
+
+    size_t GetNumberOfShells() const { return fEntranceRadius.size(); }
+    Double_t GetEntranceRadius(size_t k) const { return fEntranceRadius[k]; }
+    Double_t GetEntranceZ() const { return fCenter - fMirrorLength; }
+
+    // Shell entered by a ray at radius r (mm) of the entrance plane, -1 through a thickness or outside the optics.
+    // margin (mm) widens the openings
+    Int_t GetEntranceShell(Double_t r, Double_t margin = 0) const {
+        if (fEntranceRadius.empty() || r < 0) return -1;
+        const Int_t lastShell = fEntranceRadius.size() - 1;
+        const Int_t k = fBuckets[std::min<Double_t>(r * fInvBucketSize, fBuckets.size() - 1)];
+        const Int_t candidate = k + (r >= fEntranceRadius[std::min(k, lastShell)]);
+        if (candidate <= lastShell && r >= fEntranceBack[candidate] - margin) return candidate;
+        // Within the margin of the opening of the shell below
+        if (candidate > 0 && r < fEntranceRadius[candidate - 1] + margin) return candidate - 1;
+        return -1;
+    }
+    Double_t GetExitZ() const { return fCenter + fMirrorLength; }
+
+    // Traces all the rays in packets of width W (1, 4, 8 or 16), spread over the threads
+    void Trace(WolterRays& rays, size_t width = 8) const {
+        if (fEntranceRadius.empty() || fReflectivity.IsEmpty()) {
+            std::cerr << "Error: the Wolter tracer has no geometry or reflectivity" << std::endl;
+            return;
+        }
+        if (width != 1 && width != 4 && width != 16) width = 8;
+        const size_t nPackets = (rays.size() + width - 1) / width;
+        ParallelFor(nPackets, GetNumberOfThreads(fNumberOfThreads, nPackets), [&](size_t p, UInt_t) {
+            if (width == 1)
+                TracePacket<1>(rays, p);
+            else if (width == 4)
+                TracePacket<4>(rays, 4 * p);
+            else if (width == 16)
+                TracePacket<16>(rays, 16 * p);
+            else
+                TracePacket<8>(rays, 8 * p);
+        });
+    }
+};
+
+#endif